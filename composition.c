@@ -0,0 +1,160 @@
+/* DWM composition
+   dwmapi is loaded at runtime, so the template still starts on Windows 2000/XP and
+   with composition turned off; in both cases every function below reports false
+   and the window keeps the plain WS_POPUP | WS_THICKFRAME path.
+   https://learn.microsoft.com/en-us/windows/win32/dwm/customframe */
+
+#ifndef WM_DWMCOMPOSITIONCHANGED
+	#define WM_DWMCOMPOSITIONCHANGED 	0x031E
+#endif
+
+typedef struct DwmMargins {
+	int cxLeftWidth;
+	int cxRightWidth;
+	int cyTopHeight;
+	int cyBottomHeight;
+} DwmMargins;
+
+/* DWM_TIMING_INFO of dwmapi.h, packed as it is there */
+#pragma pack(push, 1)
+typedef struct DwmTimingInfo {
+	UINT32 cbSize;
+	UINT32 rateRefresh[2];
+	UINT64 qpcRefreshPeriod;
+	UINT32 rateCompose[2];
+	UINT64 qpcVBlank;
+	UINT64 cRefresh;
+	UINT cDXRefresh;
+	UINT64 qpcCompose;
+	UINT64 cFrame;							/* the compositions so far */
+	UINT cDXPresent;
+	UINT64 cRefreshFrame;
+	UINT64 cFrameSubmitted;
+	UINT cDXPresentSubmitted;
+	UINT64 cFrameConfirmed;
+	UINT cDXPresentConfirmed;
+	UINT64 cRefreshConfirmed;
+	UINT cDXRefreshConfirmed;
+	UINT64 cFramesLate;
+	UINT cFramesOutstanding;
+	UINT64 cFrameDisplayed;
+	UINT64 qpcFrameDisplayed;
+	UINT64 cRefreshFrameDisplayed;
+	UINT64 cFrameComplete;
+	UINT64 qpcFrameComplete;
+	UINT64 cFramePending;
+	UINT64 qpcFramePending;
+	UINT64 cFramesDisplayed;
+	UINT64 cFramesComplete;
+	UINT64 cFramesPending;
+	UINT64 cFramesAvailable;
+	UINT64 cFramesDropped;
+	UINT64 cFramesMissed;
+	UINT64 cRefreshNextDisplayed;
+	UINT64 cRefreshNextPresented;
+	UINT64 cRefreshesDisplayed;
+	UINT64 cRefreshesPresented;
+	UINT64 cRefreshStarted;
+	UINT64 cPixelsReceived;
+	UINT64 cPixelsDrawn;
+	UINT64 cBuffersEmpty;
+} DwmTimingInfo;
+#pragma pack(pop)
+
+typedef HRESULT (WINAPI *DwmIsCompositionEnabledProc)(BOOL *enabled);
+typedef HRESULT (WINAPI *DwmExtendFrameIntoClientAreaProc)(HWND hwnd, const DwmMargins *margins);
+typedef BOOL (WINAPI *DwmDefWindowProcProc)(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam, LRESULT *result);
+typedef HRESULT (WINAPI *DwmFlushProc)(void);
+typedef HRESULT (WINAPI *DwmGetCompositionTimingInfoProc)(HWND hwnd, DwmTimingInfo *info);
+
+static struct {
+	bool loaded;
+	bool composited;
+	HMODULE module;
+	DwmIsCompositionEnabledProc is_composition_enabled;
+	DwmExtendFrameIntoClientAreaProc extend_frame_into_client_area;
+	DwmDefWindowProcProc def_window_proc;
+	DwmFlushProc flush;
+	DwmGetCompositionTimingInfoProc get_composition_timing_info;
+} dwm;
+
+/* query again after WM_DWMCOMPOSITIONCHANGED */
+bool dwm_update_composition(void) {
+	if (!dwm.loaded) {
+		dwm.loaded = true;
+		dwm.module = LoadLibrary("dwmapi.dll");
+		if (dwm.module != NULL) {
+			/* cast through void (*)(void), the generic function pointer type, to keep -Wcast-function-type quiet */
+			dwm.is_composition_enabled = (DwmIsCompositionEnabledProc) (void (*)(void)) GetProcAddress(dwm.module, "DwmIsCompositionEnabled");
+			dwm.extend_frame_into_client_area = (DwmExtendFrameIntoClientAreaProc) (void (*)(void)) GetProcAddress(dwm.module, "DwmExtendFrameIntoClientArea");
+			dwm.def_window_proc = (DwmDefWindowProcProc) (void (*)(void)) GetProcAddress(dwm.module, "DwmDefWindowProc");
+			dwm.flush = (DwmFlushProc) (void (*)(void)) GetProcAddress(dwm.module, "DwmFlush");
+			dwm.get_composition_timing_info = (DwmGetCompositionTimingInfoProc) (void (*)(void)) GetProcAddress(dwm.module, "DwmGetCompositionTimingInfo");
+		}
+	}
+	BOOL enabled = false;
+	dwm.composited = dwm.is_composition_enabled != NULL && dwm.extend_frame_into_client_area != NULL
+					&& SUCCEEDED(dwm.is_composition_enabled(&enabled)) && enabled;
+	return dwm.composited;
+}
+
+bool dwm_is_composited(void) {
+	if (!dwm.loaded) {
+		dwm_update_composition();
+	}
+	return dwm.composited;
+}
+
+/* A one pixel frame is enough for DWM to give the popup its native shadow and to keep
+   the window in the redirection surface while it is activated, snapped or resized.
+   The bottom edge is used since it is never black (transparent) in our drawing. */
+bool dwm_extend_frame(HWND hwnd) {
+	if (!dwm_is_composited()) {
+		return false;
+	}
+	DwmMargins margins = { 0, 0, 0, 1 };
+	return SUCCEEDED(dwm.extend_frame_into_client_area(hwnd, &margins));
+}
+
+/* let DWM answer first (hit testing of the extended frame) */
+bool dwm_def_window_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam, LRESULT *result) {
+	return dwm.composited && dwm.def_window_proc != NULL && dwm.def_window_proc(hwnd, msg, wparam, lparam, result);
+}
+
+/* wait for the next composition pass */
+bool dwm_flush(void) {
+	return dwm.composited && dwm.flush != NULL && SUCCEEDED(dwm.flush());
+}
+
+/* the number of compositions DWM has done, false when it does not tell */
+bool dwm_frame_count(UINT64 *count) {
+	if (!dwm.loaded) {
+		dwm_update_composition();
+	}
+	if (dwm.get_composition_timing_info == NULL) {
+		return false;
+	}
+	DwmTimingInfo info = { .cbSize = sizeof(DwmTimingInfo) };
+	if (FAILED(dwm.get_composition_timing_info(NULL, &info))) {		/* NULL: the whole desktop, required since Windows 8.1 */
+		return false;
+	}
+	*count = info.cFrame;
+	return true;
+}
+
+/* the QPC time of the last vblank and the refresh period, false when DWM does not tell */
+bool dwm_timing(UINT64 *qpc_vblank, UINT64 *qpc_refresh_period) {
+	if (!dwm.loaded) {
+		dwm_update_composition();
+	}
+	if (dwm.get_composition_timing_info == NULL) {
+		return false;
+	}
+	DwmTimingInfo info = { .cbSize = sizeof(DwmTimingInfo) };
+	if (FAILED(dwm.get_composition_timing_info(NULL, &info)) || info.qpcRefreshPeriod == 0) {
+		return false;
+	}
+	*qpc_vblank = info.qpcVBlank;
+	*qpc_refresh_period = info.qpcRefreshPeriod;
+	return true;
+}
@@ -0,0 +1,245 @@
+/* Shared memory frame ring
+   The client area can show frames rendered by another process. The window creates a
+   named file mapping holding a header and a ring of 32bpp frames, and one DIB section
+   per frame on top of that mapping, so a frame is presented with a single BitBlt
+   straight from the shared memory. The producer opens the mapping by name, renders
+   into a frame the window is not reading, publishes it and signals the
+   "<name>.ready" event; the window then presents the latest published frame.
+   On the headless backend the mapping is a POSIX shared memory object and the event a
+   named semaphore, so the same protocol runs between Linux processes.
+
+   The producer never takes the latest or the presenting frame, so with three frames
+   it never waits and the window never sees a half written frame. */
+
+#define FRAME_RING_MAGIC 		0x46574953	/* "SIWF" */
+#define FRAME_RING_VERSION 		1
+#define FRAME_RING_MAX_FRAMES 	4
+#define FRAME_RING_ALIGNMENT 	65536		/* allocation granularity, a frame can be mapped on its own */
+#define WM_FRAME_READY 			(WM_APP + 1)
+
+typedef struct FrameRingHeader {
+	UINT32 magic;
+	UINT32 version;
+	UINT32 frame_count;
+	UINT32 width, height;					/* the capacity of a frame */
+	UINT32 stride;							/* in pixels */
+	UINT32 frame_offset[FRAME_RING_MAX_FRAMES];
+	volatile LONG frame_width[FRAME_RING_MAX_FRAMES];	/* the size rendered into each frame */
+	volatile LONG frame_height[FRAME_RING_MAX_FRAMES];
+	volatile LONG client_width;				/* the size the window shows, written by the window */
+	volatile LONG client_height;
+	volatile LONG latest;					/* the last published frame, -1 before the first */
+	volatile LONG presenting;				/* the frame the window is reading, -1 for none */
+	volatile LONG sequence;					/* the number of published frames */
+} FrameRingHeader;
+
+typedef struct FrameRing {
+	HANDLE mapping;
+	HANDLE ready;
+	FrameRingHeader *header;
+	/* window side */
+	HWND hwnd;
+	HDC hdc;
+	HBITMAP bitmaps[FRAME_RING_MAX_FRAMES];
+	HGDIOBJ old_bitmap;
+	HANDLE watcher;
+	volatile LONG posted;
+	volatile LONG quit;
+	/* producer side */
+	LONG producing;
+} FrameRing;
+
+static void frame_ring_names(const char *name, char *mapping_name, char *event_name, size_t size) {
+	snprintf(mapping_name, size, "Local\\siw-%s", name);
+	snprintf(event_name, size, "Local\\siw-%s.ready", name);
+}
+
+void frame_ring_close(FrameRing *ring) {
+	if (ring == NULL) {
+		return;
+	}
+	if (ring->watcher != NULL) {
+		InterlockedExchange(&ring->quit, 1);
+		SetEvent(ring->ready);
+		WaitForSingleObject(ring->watcher, INFINITE);
+		CloseHandle(ring->watcher);
+	}
+	if (ring->hdc != NULL) {
+		if (ring->old_bitmap != NULL) {
+			SelectObject(ring->hdc, ring->old_bitmap);
+		}
+		DeleteDC(ring->hdc);
+	}
+	for (int i = 0; i < FRAME_RING_MAX_FRAMES; i++) {
+		if (ring->bitmaps[i] != NULL) {
+			DeleteObject(ring->bitmaps[i]);
+		}
+	}
+	if (ring->header != NULL) {
+		UnmapViewOfFile(ring->header);
+	}
+	if (ring->ready != NULL) {
+		CloseHandle(ring->ready);
+	}
+	if (ring->mapping != NULL) {
+		CloseHandle(ring->mapping);
+	}
+	free(ring);
+}
+
+/* one WM_FRAME_READY in the queue at a time, however fast the producer is */
+static DWORD WINAPI frame_ring_watch(LPVOID param) {
+	FrameRing *ring = (FrameRing*) param;
+	while (WaitForSingleObject(ring->ready, INFINITE) == WAIT_OBJECT_0 && !ring->quit) {
+		if (InterlockedExchange(&ring->posted, 1) == 0) {
+			PostMessage(ring->hwnd, WM_FRAME_READY, 0, 0);
+		}
+	}
+	return 0;
+}
+
+/* Window side: frames of width x height, hwnd receives WM_FRAME_READY on every published frame. */
+FrameRing* frame_ring_create(HWND hwnd, const char *name, int frame_count, int width, int height) {
+	if (frame_count < 3 || frame_count > FRAME_RING_MAX_FRAMES || width <= 0 || height <= 0) {
+		return NULL;
+	}
+	FrameRing *ring = (FrameRing*) calloc(1, sizeof(FrameRing));
+	assert(ring != NULL);
+	ring->hwnd = hwnd;
+	char mapping_name[MAX_PATH], event_name[MAX_PATH];
+	frame_ring_names(name, mapping_name, event_name, MAX_PATH);
+
+	size_t frame_size = ((size_t) width*height*sizeof(UINT32) + FRAME_RING_ALIGNMENT - 1)/FRAME_RING_ALIGNMENT*FRAME_RING_ALIGNMENT;
+	size_t size = FRAME_RING_ALIGNMENT + frame_count*frame_size;
+	ring->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD) ((UINT64) size >> 32), (DWORD) size, mapping_name);
+	if (ring->mapping == NULL || GetLastError() == ERROR_ALREADY_EXISTS) {
+		frame_ring_close(ring);				/* the name belongs to another window */
+		return NULL;
+	}
+	ring->header = (FrameRingHeader*) MapViewOfFile(ring->mapping, FILE_MAP_ALL_ACCESS, 0, 0, FRAME_RING_ALIGNMENT);
+	ring->ready = CreateEvent(NULL, false, false, event_name);
+	ring->hdc = CreateCompatibleDC(NULL);
+	if (ring->header == NULL || ring->ready == NULL || ring->hdc == NULL) {
+		frame_ring_close(ring);
+		return NULL;
+	}
+
+	FrameRingHeader *header = ring->header;
+	header->version = FRAME_RING_VERSION;
+	header->frame_count = frame_count;
+	header->width = width;
+	header->height = height;
+	header->stride = width;
+	header->latest = -1;
+	header->presenting = -1;
+	BITMAPINFO bmi = { 0 };
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = width;
+	bmi.bmiHeader.biHeight = -height;		/* top-down */
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+	for (int i = 0; i < frame_count; i++) {
+		header->frame_offset[i] = (UINT32) (FRAME_RING_ALIGNMENT + i*frame_size);
+		void *bits;
+		ring->bitmaps[i] = CreateDIBSection(ring->hdc, &bmi, DIB_RGB_COLORS, &bits, ring->mapping, header->frame_offset[i]);
+		if (ring->bitmaps[i] == NULL) {
+			frame_ring_close(ring);
+			return NULL;
+		}
+	}
+	ring->old_bitmap = SelectObject(ring->hdc, ring->bitmaps[0]);
+	InterlockedExchange((volatile LONG*) &header->magic, FRAME_RING_MAGIC);		/* the producer may open it now */
+
+	ring->watcher = CreateThread(NULL, 0, frame_ring_watch, ring, 0, NULL);
+	if (ring->watcher == NULL) {
+		frame_ring_close(ring);
+		return NULL;
+	}
+	return ring;
+}
+
+/* call on WM_FRAME_READY */
+void frame_ring_acknowledge(FrameRing *ring) {
+	InterlockedExchange(&ring->posted, 0);
+}
+
+void frame_ring_set_client_size(FrameRing *ring, int width, int height) {
+	if (ring->header->client_width != width || ring->header->client_height != height) {
+		InterlockedExchange(&ring->header->client_width, width);
+		InterlockedExchange(&ring->header->client_height, height);
+	}
+}
+
+/* Blit the latest frame to x, y; size receives the part of the client it covered
+   (zero before the first frame). */
+bool frame_ring_present(FrameRing *ring, HDC hdc, int x, int y, SIZE *size) {
+	FrameRingHeader *header = ring->header;
+	LONG frame;
+	do {
+		frame = InterlockedCompareExchange(&header->latest, 0, 0);
+		InterlockedExchange(&header->presenting, frame);
+	} while (frame != InterlockedCompareExchange(&header->latest, 0, 0));
+	if (frame < 0 || frame >= (LONG) header->frame_count) {
+		InterlockedExchange(&header->presenting, -1);
+		*size = (SIZE) { 0, 0 };
+		return false;
+	}
+	size->cx = header->frame_width[frame] < header->client_width ? header->frame_width[frame] : header->client_width;
+	size->cy = header->frame_height[frame] < header->client_height ? header->frame_height[frame] : header->client_height;
+	SelectObject(ring->hdc, ring->bitmaps[frame]);
+	BitBlt(hdc, x, y, size->cx, size->cy, ring->hdc, 0, 0, SRCCOPY);
+	GdiFlush();								/* the blit has read the frame */
+	InterlockedExchange(&header->presenting, -1);
+	return true;
+}
+
+/* Producer side: open the ring created by the window. */
+FrameRing* frame_ring_open(const char *name) {
+	FrameRing *ring = (FrameRing*) calloc(1, sizeof(FrameRing));
+	assert(ring != NULL);
+	ring->producing = -1;
+	char mapping_name[MAX_PATH], event_name[MAX_PATH];
+	frame_ring_names(name, mapping_name, event_name, MAX_PATH);
+	ring->mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, false, mapping_name);
+	ring->ready = OpenEvent(EVENT_MODIFY_STATE | SYNCHRONIZE, false, event_name);
+	ring->header = ring->mapping != NULL ? (FrameRingHeader*) MapViewOfFile(ring->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+	if (ring->header == NULL || ring->ready == NULL
+		|| InterlockedCompareExchange((volatile LONG*) &ring->header->magic, 0, 0) != FRAME_RING_MAGIC
+		|| ring->header->version != FRAME_RING_VERSION) {
+		frame_ring_close(ring);
+		return NULL;
+	}
+	return ring;
+}
+
+/* A frame to render into at the size the window shows, clamped to the capacity. */
+UINT32* frame_ring_begin(FrameRing *ring, int *width, int *height, int *stride) {
+	FrameRingHeader *header = ring->header;
+	LONG latest = InterlockedCompareExchange(&header->latest, 0, 0);
+	LONG presenting = InterlockedCompareExchange(&header->presenting, 0, 0);
+	LONG frame = 0;
+	while (frame == latest || frame == presenting) {
+		frame++;
+	}
+	ring->producing = frame;
+	*width = header->client_width > 0 && header->client_width < (LONG) header->width ? header->client_width : (LONG) header->width;
+	*height = header->client_height > 0 && header->client_height < (LONG) header->height ? header->client_height : (LONG) header->height;
+	*stride = header->stride;
+	return (UINT32*) ((char*) header + header->frame_offset[frame]);
+}
+
+/* Publish the frame from frame_ring_begin, width and height are the size rendered. */
+void frame_ring_end(FrameRing *ring, int width, int height) {
+	FrameRingHeader *header = ring->header;
+	LONG frame = ring->producing;
+	if (frame < 0) {
+		return;
+	}
+	InterlockedExchange(&header->frame_width[frame], width);
+	InterlockedExchange(&header->frame_height[frame], height);
+	InterlockedExchange(&header->latest, frame);
+	InterlockedIncrement(&header->sequence);
+	ring->producing = -1;
+	SetEvent(ring->ready);
+}
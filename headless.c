@@ -0,0 +1,3077 @@
+/* Headless Win32 shim: the subset of kernel32/user32/gdi32/shell32 used by siw,
+   implemented on top of POSIX with a software framebuffer per window, so win_proc
+   can be driven and profiled on Linux.
+   build: cc -DHEADLESS main.c -o main -lpthread -lrt */
+#ifndef HEADLESS_C
+#define HEADLESS_C
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHIM static __attribute__((unused))
+
+typedef int BOOL;
+typedef long HRESULT;
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define S_OK ((HRESULT) 0)
+#define E_INVALIDARG ((HRESULT) 0x80070057L)
+typedef unsigned char BYTE;
+typedef BYTE *LPBYTE;
+typedef unsigned short WORD;
+typedef short SHORT;
+typedef unsigned long DWORD;
+typedef int32_t LONG;						/* 32 bits as on Windows (LLP64), it is shared between processes */
+typedef unsigned int UINT;
+typedef int INT;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef intptr_t INT_PTR;
+typedef uintptr_t UINT_PTR;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef ULONG_PTR DWORD_PTR;
+typedef ULONG_PTR SIZE_T;
+typedef UINT_PTR WPARAM;
+typedef LONG_PTR LPARAM;
+typedef LONG_PTR LRESULT;
+typedef unsigned short ATOM;
+typedef DWORD COLORREF;
+typedef char CHAR;
+typedef const char *LPCSTR;
+typedef char *LPSTR;
+typedef void *LPVOID;
+typedef const void *LPCVOID;
+typedef void *HANDLE;
+typedef void *HMODULE;
+typedef void *HINSTANCE;
+typedef struct ShimWindow *HWND;
+typedef struct ShimDC *HDC;
+typedef struct ShimGdi *HGDIOBJ;
+typedef struct ShimGdi *HPEN;
+typedef struct ShimGdi *HBRUSH;
+typedef struct ShimGdi *HFONT;
+typedef struct ShimGdi *HBITMAP;
+typedef struct ShimGdi *HICON;
+typedef struct ShimGdi *HCURSOR;
+typedef struct ShimMenu *HMENU;
+typedef struct ShimMonitor *HMONITOR;
+typedef INT_PTR (*FARPROC)();
+
+#define WINAPI
+#define CALLBACK
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define INFINITE 0xFFFFFFFF
+
+#define LOWORD(l) ((WORD)(((DWORD_PTR)(l)) & 0xffff))
+#define HIWORD(l) ((WORD)((((DWORD_PTR)(l)) >> 16) & 0xffff))
+#define MAKELONG(a, b) ((LONG)(((WORD)(((DWORD_PTR)(a)) & 0xffff)) | ((DWORD)((WORD)(((DWORD_PTR)(b)) & 0xffff))) << 16))
+#define MAKELPARAM(l, h) ((LPARAM)(DWORD)MAKELONG(l, h))
+#define MAKEWPARAM(l, h) ((WPARAM)(DWORD)MAKELONG(l, h))
+#define RGB(r, g, b) ((COLORREF)(((BYTE)(r) | ((WORD)((BYTE)(g)) << 8)) | (((DWORD)(BYTE)(b)) << 16)))
+#define GetRValue(c) ((BYTE)(c))
+#define GetGValue(c) ((BYTE)(((WORD)(c)) >> 8))
+#define GetBValue(c) ((BYTE)((c) >> 16))
+#define MAKEINTRESOURCE(i) ((LPSTR)((ULONG_PTR)((WORD)(i))))
+
+typedef struct RECT { LONG left, top, right, bottom; } RECT, *LPRECT;
+typedef struct POINT { LONG x, y; } POINT, *LPPOINT;
+typedef struct SIZE { LONG cx, cy; } SIZE;
+typedef union LARGE_INTEGER { struct { DWORD LowPart; LONG HighPart; }; INT64 QuadPart; } LARGE_INTEGER;
+
+typedef LRESULT (*WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+typedef BOOL (*MONITORENUMPROC)(HMONITOR, HDC, LPRECT, LPARAM);
+typedef BOOL (*WNDENUMPROC)(HWND, LPARAM);
+
+typedef struct MSG { HWND hwnd; UINT message; WPARAM wParam; LPARAM lParam; DWORD time; POINT pt; } MSG;
+typedef struct PAINTSTRUCT { HDC hdc; BOOL fErase; RECT rcPaint; BOOL fRestore; BOOL fIncUpdate; BYTE rgbReserved[32]; } PAINTSTRUCT;
+typedef struct WNDCLASSEX {
+	UINT cbSize; UINT style; WNDPROC lpfnWndProc; int cbClsExtra; int cbWndExtra; HINSTANCE hInstance;
+	HICON hIcon; HCURSOR hCursor; HBRUSH hbrBackground; LPCSTR lpszMenuName; LPCSTR lpszClassName; HICON hIconSm;
+} WNDCLASSEX;
+typedef struct CREATESTRUCT {
+	LPVOID lpCreateParams; HINSTANCE hInstance; HMENU hMenu; HWND hwndParent;
+	int cy; int cx; int y; int x; LONG style; LPCSTR lpszName; LPCSTR lpszClass; DWORD dwExStyle;
+} CREATESTRUCT;
+typedef struct WINDOWPOS { HWND hwnd; HWND hwndInsertAfter; int x; int y; int cx; int cy; UINT flags; } WINDOWPOS;
+typedef struct NCCALCSIZE_PARAMS { RECT rgrc[3]; WINDOWPOS *lppos; } NCCALCSIZE_PARAMS;
+typedef struct MINMAXINFO { POINT ptReserved; POINT ptMaxSize; POINT ptMaxPosition; POINT ptMinTrackSize; POINT ptMaxTrackSize; } MINMAXINFO;
+#define CCHDEVICENAME 32
+typedef struct MONITORINFO { DWORD cbSize; RECT rcMonitor; RECT rcWork; DWORD dwFlags; } MONITORINFO;
+typedef struct MONITORINFOEX { DWORD cbSize; RECT rcMonitor; RECT rcWork; DWORD dwFlags; CHAR szDevice[CCHDEVICENAME]; } MONITORINFOEX;
+typedef struct APPBARDATA { DWORD cbSize; HWND hWnd; UINT uCallbackMessage; UINT uEdge; RECT rc; LPARAM lParam; } APPBARDATA;
+typedef struct TRACKMOUSEEVENT { DWORD cbSize; DWORD dwFlags; HWND hwndTrack; DWORD dwHoverTime; } TRACKMOUSEEVENT;
+typedef struct WINDOWPLACEMENT { UINT length; UINT flags; UINT showCmd; POINT ptMinPosition; POINT ptMaxPosition; RECT rcNormalPosition; } WINDOWPLACEMENT;
+#define LF_FACESIZE 32
+typedef struct LOGFONT {
+	LONG lfHeight; LONG lfWidth; LONG lfEscapement; LONG lfOrientation; LONG lfWeight;
+	BYTE lfItalic; BYTE lfUnderline; BYTE lfStrikeOut; BYTE lfCharSet; BYTE lfOutPrecision;
+	BYTE lfClipPrecision; BYTE lfQuality; BYTE lfPitchAndFamily; CHAR lfFaceName[LF_FACESIZE];
+} LOGFONT;
+typedef struct BITMAP { LONG bmType; LONG bmWidth; LONG bmHeight; LONG bmWidthBytes; WORD bmPlanes; WORD bmBitsPixel; LPVOID bmBits; } BITMAP;
+typedef struct BITMAPINFOHEADER {
+	DWORD biSize; LONG biWidth; LONG biHeight; WORD biPlanes; WORD biBitCount; DWORD biCompression;
+	DWORD biSizeImage; LONG biXPelsPerMeter; LONG biYPelsPerMeter; DWORD biClrUsed; DWORD biClrImportant;
+} BITMAPINFOHEADER;
+typedef struct RGBQUAD { BYTE rgbBlue; BYTE rgbGreen; BYTE rgbRed; BYTE rgbReserved; } RGBQUAD;
+typedef struct BITMAPINFO { BITMAPINFOHEADER bmiHeader; RGBQUAD bmiColors[1]; } BITMAPINFO;
+typedef struct SECURITY_ATTRIBUTES { DWORD nLength; LPVOID lpSecurityDescriptor; BOOL bInheritHandle; } SECURITY_ATTRIBUTES;
+typedef struct SYSTEM_INFO {
+	WORD wProcessorArchitecture; WORD wReserved; DWORD dwPageSize; LPVOID lpMinimumApplicationAddress;
+	LPVOID lpMaximumApplicationAddress; DWORD_PTR dwActiveProcessorMask; DWORD dwNumberOfProcessors;
+	DWORD dwProcessorType; DWORD dwAllocationGranularity; WORD wProcessorLevel; WORD wProcessorRevision;
+} SYSTEM_INFO;
+typedef struct PROCESS_MEMORY_COUNTERS {
+	DWORD cb; DWORD PageFaultCount; SIZE_T PeakWorkingSetSize; SIZE_T WorkingSetSize;
+	SIZE_T QuotaPeakPagedPoolUsage; SIZE_T QuotaPagedPoolUsage; SIZE_T QuotaPeakNonPagedPoolUsage;
+	SIZE_T QuotaNonPagedPoolUsage; SIZE_T PagefileUsage; SIZE_T PeakPagefileUsage;
+} PROCESS_MEMORY_COUNTERS;
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+/* messages */
+#define WM_NULL 0x0000
+#define WM_CREATE 0x0001
+#define WM_DESTROY 0x0002
+#define WM_MOVE 0x0003
+#define WM_SIZE 0x0005
+#define WM_ACTIVATE 0x0006
+#define WM_SETFOCUS 0x0007
+#define WM_KILLFOCUS 0x0008
+#define WM_ENABLE 0x000A
+#define WM_SETREDRAW 0x000B
+#define WM_SETTEXT 0x000C
+#define WM_GETTEXT 0x000D
+#define WM_GETTEXTLENGTH 0x000E
+#define WM_PAINT 0x000F
+#define WM_CLOSE 0x0010
+#define WM_QUERYENDSESSION 0x0011
+#define WM_QUERYOPEN 0x0013
+#define WM_ENDSESSION 0x0016
+#define WM_QUIT 0x0012
+#define WM_ERASEBKGND 0x0014
+#define WM_SYSCOLORCHANGE 0x0015
+#define WM_SHOWWINDOW 0x0018
+#define WM_WININICHANGE 0x001A
+#define WM_SETTINGCHANGE WM_WININICHANGE
+#define WM_DEVMODECHANGE 0x001B
+#define WM_ACTIVATEAPP 0x001C
+#define WM_FONTCHANGE 0x001D
+#define WM_TIMECHANGE 0x001E
+#define WM_CANCELMODE 0x001F
+#define WM_SETCURSOR 0x0020
+#define WM_MOUSEACTIVATE 0x0021
+#define WM_GETMINMAXINFO 0x0024
+#define WM_WINDOWPOSCHANGING 0x0046
+#define WM_WINDOWPOSCHANGED 0x0047
+#define WM_NCCREATE 0x0081
+#define WM_NCDESTROY 0x0082
+#define WM_NCCALCSIZE 0x0083
+#define WM_NCHITTEST 0x0084
+#define WM_NCPAINT 0x0085
+#define WM_NCACTIVATE 0x0086
+#define WM_DISPLAYCHANGE 0x007E
+#define WM_GETICON 0x007F
+#define WM_SETICON 0x0080
+#define WM_NCMOUSEMOVE 0x00A0
+#define WM_NCLBUTTONDOWN 0x00A1
+#define WM_NCLBUTTONUP 0x00A2
+#define WM_NCLBUTTONDBLCLK 0x00A3
+#define WM_NCRBUTTONDOWN 0x00A4
+#define WM_NCRBUTTONUP 0x00A5
+#define WM_KEYDOWN 0x0100
+#define WM_KEYUP 0x0101
+#define WM_CHAR 0x0102
+#define WM_SYSKEYDOWN 0x0104
+#define WM_SYSKEYUP 0x0105
+#define WM_SYSCHAR 0x0106
+#define WM_SYSCOMMAND 0x0112
+#define WM_TIMER 0x0113
+#define WM_INITMENU 0x0116
+#define WM_INITMENUPOPUP 0x0117
+#define WM_MENUSELECT 0x011F
+#define WM_ENTERIDLE 0x0121
+#define WM_MOUSEMOVE 0x0200
+#define WM_LBUTTONDOWN 0x0201
+#define WM_LBUTTONUP 0x0202
+#define WM_RBUTTONDOWN 0x0204
+#define WM_RBUTTONUP 0x0205
+#define WM_CAPTURECHANGED 0x0215
+#define WM_ENTERSIZEMOVE 0x0231
+#define WM_EXITSIZEMOVE 0x0232
+#define WM_NCMOUSELEAVE 0x02A2
+#define WM_MOUSELEAVE 0x02A3
+#define WM_DPICHANGED 0x02E0
+#define WM_PRINT 0x0317
+#define WM_PRINTCLIENT 0x0318
+#define WM_APPCOMMAND 0x0319
+#define WM_THEMECHANGED 0x031A
+#define WM_CLIPBOARDUPDATE 0x031D
+#define WM_DWMCOMPOSITIONCHANGED 0x031E
+#define WM_HANDHELDFIRST 0x0358
+#define WM_HANDHELDLAST 0x035F
+#define WM_AFXFIRST 0x0360
+#define WM_AFXLAST 0x037F
+#define WM_PENWINFIRST 0x0380
+#define WM_PENWINLAST 0x038F
+#define WM_CHILDACTIVATE 0x0022
+#define WM_QUEUESYNC 0x0023
+#define WM_PAINTICON 0x0026
+#define WM_ICONERASEBKGND 0x0027
+#define WM_NEXTDLGCTL 0x0028
+#define WM_SPOOLERSTATUS 0x002A
+#define WM_DRAWITEM 0x002B
+#define WM_MEASUREITEM 0x002C
+#define WM_DELETEITEM 0x002D
+#define WM_VKEYTOITEM 0x002E
+#define WM_CHARTOITEM 0x002F
+#define WM_SETFONT 0x0030
+#define WM_GETFONT 0x0031
+#define WM_SETHOTKEY 0x0032
+#define WM_GETHOTKEY 0x0033
+#define WM_QUERYDRAGICON 0x0037
+#define WM_COMPAREITEM 0x0039
+#define WM_GETOBJECT 0x003D
+#define WM_COMPACTING 0x0041
+#define WM_COMMNOTIFY 0x0044
+#define WM_POWER 0x0048
+#define WM_COPYDATA 0x004A
+#define WM_CANCELJOURNAL 0x004B
+#define WM_NOTIFY 0x004E
+#define WM_INPUTLANGCHANGEREQUEST 0x0050
+#define WM_INPUTLANGCHANGE 0x0051
+#define WM_TCARD 0x0052
+#define WM_HELP 0x0053
+#define WM_USERCHANGED 0x0054
+#define WM_NOTIFYFORMAT 0x0055
+#define WM_CONTEXTMENU 0x007B
+#define WM_STYLECHANGING 0x007C
+#define WM_STYLECHANGED 0x007D
+#define WM_GETDLGCODE 0x0087
+#define WM_SYNCPAINT 0x0088
+#define WM_NCRBUTTONDBLCLK 0x00A6
+#define WM_NCMBUTTONDOWN 0x00A7
+#define WM_NCMBUTTONUP 0x00A8
+#define WM_NCMBUTTONDBLCLK 0x00A9
+#define WM_NCXBUTTONDOWN 0x00AB
+#define WM_NCXBUTTONUP 0x00AC
+#define WM_NCXBUTTONDBLCLK 0x00AD
+#define WM_INPUT_DEVICE_CHANGE 0x00FE
+#define WM_INPUT 0x00FF
+#define WM_DEADCHAR 0x0103
+#define WM_SYSDEADCHAR 0x0107
+#define WM_IME_STARTCOMPOSITION 0x010D
+#define WM_IME_ENDCOMPOSITION 0x010E
+#define WM_IME_COMPOSITION 0x010F
+#define WM_INITDIALOG 0x0110
+#define WM_COMMAND 0x0111
+#define WM_HSCROLL 0x0114
+#define WM_VSCROLL 0x0115
+#define WM_MENUCHAR 0x0120
+#define WM_MENURBUTTONUP 0x0122
+#define WM_MENUDRAG 0x0123
+#define WM_MENUGETOBJECT 0x0124
+#define WM_UNINITMENUPOPUP 0x0125
+#define WM_MENUCOMMAND 0x0126
+#define WM_CHANGEUISTATE 0x0127
+#define WM_UPDATEUISTATE 0x0128
+#define WM_QUERYUISTATE 0x0129
+#define WM_CTLCOLORMSGBOX 0x0132
+#define WM_CTLCOLOREDIT 0x0133
+#define WM_CTLCOLORLISTBOX 0x0134
+#define WM_CTLCOLORBTN 0x0135
+#define WM_CTLCOLORDLG 0x0136
+#define WM_CTLCOLORSCROLLBAR 0x0137
+#define WM_CTLCOLORSTATIC 0x0138
+#define WM_LBUTTONDBLCLK 0x0203
+#define WM_RBUTTONDBLCLK 0x0206
+#define WM_MBUTTONDOWN 0x0207
+#define WM_MBUTTONUP 0x0208
+#define WM_MBUTTONDBLCLK 0x0209
+#define WM_MOUSEWHEEL 0x020A
+#define WM_XBUTTONDOWN 0x020B
+#define WM_XBUTTONUP 0x020C
+#define WM_XBUTTONDBLCLK 0x020D
+#define WM_PARENTNOTIFY 0x0210
+#define WM_ENTERMENULOOP 0x0211
+#define WM_EXITMENULOOP 0x0212
+#define WM_NEXTMENU 0x0213
+#define WM_SIZING 0x0214
+#define WM_MOVING 0x0216
+#define WM_POWERBROADCAST 0x0218
+#define WM_DEVICECHANGE 0x0219
+#define WM_MDICREATE 0x0220
+#define WM_MDIDESTROY 0x0221
+#define WM_MDIACTIVATE 0x0222
+#define WM_MDIRESTORE 0x0223
+#define WM_MDINEXT 0x0224
+#define WM_MDIMAXIMIZE 0x0225
+#define WM_MDITILE 0x0226
+#define WM_MDICASCADE 0x0227
+#define WM_MDIICONARRANGE 0x0228
+#define WM_MDIGETACTIVE 0x0229
+#define WM_MDISETMENU 0x0230
+#define WM_DROPFILES 0x0233
+#define WM_MDIREFRESHMENU 0x0234
+#define WM_IME_SETCONTEXT 0x0281
+#define WM_IME_NOTIFY 0x0282
+#define WM_IME_CONTROL 0x0283
+#define WM_IME_COMPOSITIONFULL 0x0284
+#define WM_IME_SELECT 0x0285
+#define WM_IME_CHAR 0x0286
+#define WM_IME_REQUEST 0x0288
+#define WM_IME_KEYDOWN 0x0290
+#define WM_IME_KEYUP 0x0291
+#define WM_MOUSEHOVER 0x02A1
+#define WM_NCMOUSEHOVER 0x02A0
+#define WM_WTSSESSION_CHANGE 0x02B1
+#define WM_TABLET_FIRST 0x02C0
+#define WM_TABLET_LAST 0x02DF
+#define WM_CUT 0x0300
+#define WM_COPY 0x0301
+#define WM_PASTE 0x0302
+#define WM_CLEAR 0x0303
+#define WM_UNDO 0x0304
+#define WM_RENDERFORMAT 0x0305
+#define WM_RENDERALLFORMATS 0x0306
+#define WM_DESTROYCLIPBOARD 0x0307
+#define WM_DRAWCLIPBOARD 0x0308
+#define WM_PAINTCLIPBOARD 0x0309
+#define WM_VSCROLLCLIPBOARD 0x030A
+#define WM_SIZECLIPBOARD 0x030B
+#define WM_ASKCBFORMATNAME 0x030C
+#define WM_CHANGECBCHAIN 0x030D
+#define WM_HSCROLLCLIPBOARD 0x030E
+#define WM_QUERYNEWPALETTE 0x030F
+#define WM_PALETTEISCHANGING 0x0310
+#define WM_PALETTECHANGED 0x0311
+#define WM_HOTKEY 0x0312
+#define WM_USER 0x0400
+#define WM_APP 0x8000
+
+/* hit test */
+#define HTERROR (-2)
+#define HTTRANSPARENT (-1)
+#define HTNOWHERE 0
+#define HTCLIENT 1
+#define HTCAPTION 2
+#define HTSYSMENU 3
+#define HTMINBUTTON 8
+#define HTMAXBUTTON 9
+#define HTLEFT 10
+#define HTRIGHT 11
+#define HTTOP 12
+#define HTTOPLEFT 13
+#define HTTOPRIGHT 14
+#define HTBOTTOM 15
+#define HTBOTTOMLEFT 16
+#define HTBOTTOMRIGHT 17
+#define HTCLOSE 20
+
+/* window styles */
+#define WS_OVERLAPPED 0x00000000L
+#define WS_POPUP 0x80000000L
+#define WS_MINIMIZE 0x20000000L
+#define WS_VISIBLE 0x10000000L
+#define WS_MAXIMIZE 0x01000000L
+#define WS_CAPTION 0x00C00000L
+#define WS_SYSMENU 0x00080000L
+#define WS_THICKFRAME 0x00040000L
+#define WS_MINIMIZEBOX 0x00020000L
+#define WS_MAXIMIZEBOX 0x00010000L
+#define WS_EX_TOOLWINDOW 0x00000080L
+#define WS_EX_NOACTIVATE 0x08000000L
+#define CS_OWNDC 0x0020
+#define CW_USEDEFAULT ((int)0x80000000)
+#define GWL_STYLE (-16)
+#define GWL_EXSTYLE (-20)
+#define GWLP_USERDATA (-21)
+#define GCLP_HICONSM (-34)
+
+/* ShowWindow / SetWindowPos */
+#define SW_HIDE 0
+#define SW_SHOWNORMAL 1
+#define SW_NORMAL 1
+#define SW_SHOWMINIMIZED 2
+#define SW_SHOWMAXIMIZED 3
+#define SW_MAXIMIZE 3
+#define SW_SHOWNOACTIVATE 4
+#define SW_SHOW 5
+#define SW_MINIMIZE 6
+#define SW_SHOWMINNOACTIVE 7
+#define SW_SHOWNA 8
+#define SW_RESTORE 9
+#define SWP_NOSIZE 0x0001
+#define SWP_NOMOVE 0x0002
+#define SWP_NOZORDER 0x0004
+#define SWP_NOREDRAW 0x0008
+#define SWP_NOACTIVATE 0x0010
+#define SWP_FRAMECHANGED 0x0020
+#define SWP_SHOWWINDOW 0x0040
+#define SWP_HIDEWINDOW 0x0080
+#define SWP_NOCOPYBITS 0x0100
+#define SWP_NOOWNERZORDER 0x0200
+#define SWP_NOSENDCHANGING 0x0400
+#define SWP_STATECHANGED 0x8000
+#define WPF_RESTORETOMAXIMIZED 0x0002
+#define WA_INACTIVE 0
+#define WA_ACTIVE 1
+#define WA_CLICKACTIVE 2
+#define WVR_VALIDRECTS 0x0400
+#define WVR_REDRAW 0x0300
+#define SIZE_RESTORED 0
+#define SIZE_MINIMIZED 1
+#define SIZE_MAXIMIZED 2
+
+/* redraw */
+#define RDW_INVALIDATE 0x0001
+#define RDW_INTERNALPAINT 0x0002
+#define RDW_ERASE 0x0004
+#define RDW_VALIDATE 0x0008
+#define RDW_NOINTERNALPAINT 0x0010
+#define RDW_NOERASE 0x0020
+#define RDW_NOCHILDREN 0x0040
+#define RDW_ALLCHILDREN 0x0080
+#define RDW_UPDATENOW 0x0100
+#define RDW_ERASENOW 0x0200
+#define RDW_FRAME 0x0400
+#define RDW_NOFRAME 0x0800
+
+#define PRF_CHECKVISIBLE 0x0001
+#define PRF_NONCLIENT 0x0002
+#define PRF_CLIENT 0x0004
+#define PRF_ERASEBKGND 0x0008
+#define PRF_CHILDREN 0x0010
+#define PRF_OWNED 0x0020
+
+/* system commands and menus */
+#define SC_SIZE 0xF000
+#define SC_MOVE 0xF010
+#define SC_MINIMIZE 0xF020
+#define SC_MAXIMIZE 0xF030
+#define SC_CLOSE 0xF060
+#define SC_MOUSEMENU 0xF090
+#define SC_KEYMENU 0xF100
+#define SC_RESTORE 0xF120
+#define MF_BYCOMMAND 0x0000
+#define MF_BYPOSITION 0x0400
+#define MF_ENABLED 0x0000
+#define MF_GRAYED 0x0001
+#define MF_DISABLED 0x0002
+#define TPM_LEFTALIGN 0x0000
+#define TPM_RIGHTALIGN 0x0008
+#define TPM_RIGHTBUTTON 0x0002
+#define TPM_RETURNCMD 0x0100
+
+/* input */
+#define TME_LEAVE 0x00000002
+#define TME_NONCLIENT 0x00000010
+#define TME_CANCEL 0x80000000
+#define VK_TAB 0x09
+#define VK_RETURN 0x0D
+#define VK_SHIFT 0x10
+#define VK_CONTROL 0x11
+#define VK_MENU 0x12
+#define VK_ESCAPE 0x1B
+#define VK_SPACE 0x20
+#define VK_LEFT 0x25
+#define VK_UP 0x26
+#define VK_RIGHT 0x27
+#define VK_DOWN 0x28
+#define VK_F10 0x79
+#define MK_LBUTTON 0x0001
+#define PM_NOREMOVE 0x0000
+#define PM_REMOVE 0x0001
+
+/* metrics and resources */
+#define SM_CXSCREEN 0
+#define SM_CYSCREEN 1
+#define SM_CXFRAME 32
+#define SM_CYFRAME 33
+#define SM_CXSMICON 49
+#define SM_CYSMICON 50
+#define SM_MENUDROPALIGNMENT 40
+#define SM_CXPADDEDBORDER 92
+#define IDI_APPLICATION MAKEINTRESOURCE(32512)
+#define IDC_ARROW MAKEINTRESOURCE(32512)
+#define IDC_SIZEALL MAKEINTRESOURCE(32646)
+#define IDC_HAND MAKEINTRESOURCE(32649)
+#define COLOR_WINDOW 5
+#define COLOR_WINDOWTEXT 8
+#define COLOR_HIGHLIGHT 13
+#define COLOR_HIGHLIGHTTEXT 14
+#define COLOR_BTNFACE 15
+#define COLOR_GRAYTEXT 17
+#define COLOR_ACTIVECAPTION 2
+#define COLOR_INACTIVECAPTION 3
+#define COLOR_CAPTIONTEXT 9
+#define COLOR_INACTIVECAPTIONTEXT 19
+#define COLOR_ACTIVEBORDER 10
+#define SPI_SETWORKAREA 0x002F
+#define SPI_GETWORKAREA 0x0030
+#define SPI_GETHIGHCONTRAST 0x0042
+#define SPI_SETHIGHCONTRAST 0x0043
+#define HCF_HIGHCONTRASTON 0x00000001
+typedef struct HIGHCONTRAST { UINT cbSize; DWORD dwFlags; LPSTR lpszDefaultScheme; } HIGHCONTRAST;
+
+/* advapi32 */
+typedef struct ShimKey *HKEY;
+#define HKEY_CURRENT_USER ((HKEY)(ULONG_PTR)0x80000001)
+#define KEY_READ 0x20019
+#define REG_DWORD 4
+
+/* monitors and appbars */
+#define MONITOR_DEFAULTTONULL 0x00000000
+#define MONITOR_DEFAULTTOPRIMARY 0x00000001
+#define MONITOR_DEFAULTTONEAREST 0x00000002
+#define MONITORINFOF_PRIMARY 0x00000001
+#define ABM_GETSTATE 0x00000004
+#define ABM_GETTASKBARPOS 0x00000005
+#define ABM_GETAUTOHIDEBAR 0x00000007
+#define ABM_GETAUTOHIDEBAREX 0x0000000b
+#define ABE_LEFT 0
+#define ABE_TOP 1
+#define ABE_RIGHT 2
+#define ABE_BOTTOM 3
+
+/* gdi */
+#define PS_SOLID 0
+#define PS_DOT 2
+#define TRANSPARENT 1
+#define OPAQUE 2
+#define ETO_OPAQUE 0x0002
+#define ETO_CLIPPED 0x0004
+#define FW_NORMAL 400
+#define FW_BOLD 700
+#define DEFAULT_CHARSET 1
+#define OUT_DEFAULT_PRECIS 0
+#define CLIP_DEFAULT_PRECIS 0
+#define DEFAULT_QUALITY 0
+#define ANTIALIASED_QUALITY 4
+#define CLEARTYPE_QUALITY 5
+#define DEFAULT_PITCH 0
+#define DEFAULT_GUI_FONT 17
+#define DI_NORMAL 0x0003
+#define DI_COMPAT 0x0004
+#define SRCCOPY 0x00CC0020
+#define NULLREGION 1
+#define SIMPLEREGION 2
+#define LOGPIXELSX 88
+#define LOGPIXELSY 90
+#define BI_RGB 0
+#define DIB_RGB_COLORS 0
+#define GR_GDIOBJECTS 0
+#define GR_USEROBJECTS 1
+#define AC_SRC_OVER 0x00
+#define AC_SRC_ALPHA 0x01
+typedef struct BLENDFUNCTION { BYTE BlendOp; BYTE BlendFlags; BYTE SourceConstantAlpha; BYTE AlphaFormat; } BLENDFUNCTION;
+
+/* kernel */
+#define ERROR_SUCCESS 0
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_ALREADY_EXISTS 183
+#define ERROR_FILENAME_EXCED_RANGE 206
+#define INVALID_HANDLE_VALUE ((HANDLE)(LONG_PTR)-1)
+#define INVALID_FILE_SIZE ((DWORD)0xFFFFFFFF)
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define FILE_SHARE_READ 0x00000001
+#define FILE_SHARE_WRITE 0x00000002
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define OPEN_ALWAYS 4
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define FILE_ATTRIBUTE_TEMPORARY 0x00000100
+#define FILE_FLAG_WRITE_THROUGH 0x80000000
+#define MOVEFILE_REPLACE_EXISTING 0x00000001
+#define MOVEFILE_WRITE_THROUGH 0x00000008
+#define PAGE_READONLY 0x02
+#define PAGE_READWRITE 0x04
+#define FILE_MAP_WRITE 0x0002
+#define FILE_MAP_READ 0x0004
+#define FILE_MAP_ALL_ACCESS 0x000F001F
+#define MEM_COMMIT 0x00001000
+#define MEM_RESERVE 0x00002000
+#define MEM_RELEASE 0x00008000
+#define WAIT_OBJECT_0 0x00000000
+#define WAIT_TIMEOUT 0x00000102
+#define WAIT_FAILED 0xFFFFFFFF
+#define EVENT_MODIFY_STATE 0x0002
+#define SYNCHRONIZE 0x00100000
+#define QS_ALLINPUT 0x04FF
+#define MWMO_INPUTAVAILABLE 0x0004
+
+/* ---------------------------------------------------------------------------- */
+
+typedef enum ShimGdiKind {
+	ShimGdi_Pen,
+	ShimGdi_Brush,
+	ShimGdi_Font,
+	ShimGdi_Bitmap,
+	ShimGdi_Icon,
+	ShimGdi_Cursor,
+} ShimGdiKind;
+
+typedef struct ShimGdi {
+	ShimGdiKind kind;
+	bool stock;
+	COLORREF color;
+	int width;
+	LOGFONT lf;
+	int bmp_width, bmp_height;
+	UINT32 *pixels;
+	bool owns_pixels;
+	void *section_base;
+	size_t section_length;
+} ShimGdi;
+
+typedef struct ShimDC {
+	struct ShimWindow *window;
+	HBITMAP bitmap;
+	HBITMAP default_bitmap;
+	HPEN pen;
+	HBRUSH brush;
+	HFONT font;
+	COLORREF bk_color, text_color;
+	int bk_mode;
+	POINT pos;
+	POINT viewport;
+	RECT clip;
+	bool has_clip;
+	bool is_memory;
+	struct {
+		POINT viewport;
+		RECT clip;
+		bool has_clip;
+	} saved[4];								/* by SaveDC, only the clip and the viewport */
+	int saved_count;
+} ShimDC;
+
+typedef struct ShimMenu {
+	UINT enabled_state[8];
+	UINT ids[8];
+	const char *text[8];
+	int count;
+} ShimMenu;
+
+typedef struct ShimWindow {
+	struct ShimClass *cls;
+	HWND next;
+	DWORD style, ex_style;
+	RECT rect;
+	RECT client;							/* relative to rect.left/top */
+	RECT normal;
+	bool is_restore_maximized;				/* minimized from maximized, WPF_RESTORETOMAXIMIZED */
+	char text[256];
+	LONG_PTR user_data;
+	RECT invalid;
+	bool has_invalid;
+	bool erase;
+	bool destroyed;
+	bool track_leave;
+	ShimDC dc;
+	UINT32 *pixels;
+	int fb_width, fb_height;
+	HMENU sysmenu;
+	HCURSOR cursor;
+} ShimWindow;
+
+typedef struct ShimClass {
+	char name[64];
+	WNDPROC proc;
+	UINT style;
+	HICON icon;
+	bool used;
+} ShimClass;
+
+typedef struct ShimMonitor {
+	RECT rc_monitor;
+	RECT rc_work;
+	UINT dpi;
+	char device[CCHDEVICENAME];
+} ShimMonitor;
+
+typedef struct HeadlessMessageStat {
+	UINT64 count;
+	UINT64 total_ns;
+} HeadlessMessageStat;
+
+typedef enum ShimHandleKind {
+	ShimHandle_Thread,
+	ShimHandle_Event,
+	ShimHandle_NamedEvent,
+	ShimHandle_Semaphore,
+	ShimHandle_File,
+	ShimHandle_Mapping,
+} ShimHandleKind;
+
+typedef struct ShimHandle {
+	ShimHandleKind kind;
+	pthread_t thread;
+	bool joined;
+	DWORD exit_code;
+	LPTHREAD_START_ROUTINE start;
+	LPVOID param;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool signaled, manual_reset;
+	LONG count, max_count;					/* semaphores */
+	sem_t *sem;
+	int fd;
+	size_t length;
+	char name[MAX_PATH];					/* named objects, unlinked when the creator closes them */
+	bool owner;
+} ShimHandle;
+
+#define HEADLESS_MAX_MONITORS 32
+#define HEADLESS_STAT_MESSAGES (WM_USER + 1)	/* last slot collects WM_USER and above */
+#define HEADLESS_QUEUE_SIZE 65536
+
+static struct {
+	ShimClass classes[16];
+	char window_messages[16][64];			/* RegisterWindowMessage, 0xC000 + index */
+	int window_message_count;
+	HWND windows;
+	int window_count;
+	HWND focus, active, capture;
+	ShimMonitor monitors[HEADLESS_MAX_MONITORS];
+	int monitor_count;
+	bool autohide[4];
+	bool light_theme;
+	bool high_contrast;
+	UINT dpi;
+	MSG queue[HEADLESS_QUEUE_SIZE];
+	size_t queue_head, queue_tail;
+	bool quit;
+	int quit_code;
+	pthread_mutex_t queue_mutex;
+	pthread_cond_t queue_cond;
+	DWORD last_error;
+	long gdi_objects;
+	long user_objects;
+	HeadlessMessageStat stats[HEADLESS_STAT_MESSAGES + 1];
+	UINT64 invalidate_calls;
+	UINT64 appbar_calls;
+	UINT64 monitor_calls;
+	UINT64 presents;
+	UINT64 text_calls;
+	POINT cursor_pos;
+	bool keys[256];							/* down, for GetKeyState */
+	UINT64 menu_calls;						/* EnableMenuItem */
+	void *mappings[64];
+	size_t mapping_lengths[64];
+} headless = {
+	.queue_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.queue_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static ShimGdi headless_stock_font = { .kind = ShimGdi_Font, .stock = true, .lf = { .lfHeight = -12, .lfWeight = FW_NORMAL, .lfFaceName = "Shim Sans" } };
+static ShimGdi headless_stock_pen = { .kind = ShimGdi_Pen, .stock = true, .width = 1 };
+static ShimGdi headless_stock_brush = { .kind = ShimGdi_Brush, .stock = true, .color = 0xffffff };
+static ShimGdi headless_stock_bitmap = { .kind = ShimGdi_Bitmap, .stock = true };
+static ShimGdi headless_app_icon = { .kind = ShimGdi_Icon, .stock = true, .color = 0x3f7fbf };
+static ShimGdi headless_cursor = { .kind = ShimGdi_Cursor, .stock = true };
+
+static UINT64 headless_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64) ts.tv_sec * 1000000000ull + (UINT64) ts.tv_nsec;
+}
+
+static UINT32 headless_pixel(COLORREF color) {
+	return ((color & 0xff) << 16) | (color & 0xff00) | ((color >> 16) & 0xff);
+}
+
+/* ------------------------------- configuration ------------------------------- */
+
+/* Scriptable display topology: monitors[i] with work area works[i]. */
+SHIM void headless_set_monitors(const RECT *monitors, const RECT *works, int count) {
+	assert(count > 0 && count <= HEADLESS_MAX_MONITORS);
+	headless.monitor_count = count;
+	for (int i = 0; i < count; i++) {
+		headless.monitors[i].rc_monitor = monitors[i];
+		headless.monitors[i].rc_work = works[i];
+		headless.monitors[i].dpi = headless.dpi ? headless.dpi : 96;
+		snprintf(headless.monitors[i].device, CCHDEVICENAME, "\\\\.\\DISPLAY%d", i + 1);
+	}
+}
+
+SHIM void headless_set_autohide(UINT edge, bool autohide) {
+	assert(edge <= ABE_BOTTOM);
+	headless.autohide[edge] = autohide;
+}
+
+/* SIW_MONITORS="l,t,r,b[,wl,wt,wr,wb];..." and SIW_AUTOHIDE="left,top,right,bottom" */
+static void headless_init(void) {
+	if (headless.monitor_count > 0) {
+		return;
+	}
+	RECT monitors[HEADLESS_MAX_MONITORS], works[HEADLESS_MAX_MONITORS];
+	int count = 0;
+	const char *spec = getenv("SIW_MONITORS");
+	while (spec != NULL && *spec != '\0' && count < HEADLESS_MAX_MONITORS) {
+		long v[8];
+		int n = 0;
+		char *end;
+		while (n < 8) {
+			v[n] = strtol(spec, &end, 10);
+			if (end == spec) {
+				break;
+			}
+			n++;
+			spec = end;
+			if (*spec != ',') {
+				break;
+			}
+			spec++;
+		}
+		if (n != 4 && n != 8) {
+			break;
+		}
+		monitors[count] = (RECT) { v[0], v[1], v[2], v[3] };
+		works[count] = n == 8 ? (RECT) { v[4], v[5], v[6], v[7] } : monitors[count];
+		count++;
+		if (*spec == ';') {
+			spec++;
+		}
+	}
+	if (count == 0) {
+		monitors[0] = (RECT) { 0, 0, 1920, 1080 };
+		works[0] = (RECT) { 0, 0, 1920, 1040 };
+		count = 1;
+	}
+	headless_set_monitors(monitors, works, count);
+	const char *autohide = getenv("SIW_AUTOHIDE");
+	if (autohide != NULL) {
+		headless.autohide[ABE_LEFT] = strstr(autohide, "left") != NULL;
+		headless.autohide[ABE_TOP] = strstr(autohide, "top") != NULL;
+		headless.autohide[ABE_RIGHT] = strstr(autohide, "right") != NULL;
+		headless.autohide[ABE_BOTTOM] = strstr(autohide, "bottom") != NULL;
+	}
+	const char *theme = getenv("SIW_THEME");
+	if (theme != NULL) {
+		headless.light_theme = strcmp(theme, "light") == 0;
+		headless.high_contrast = strcmp(theme, "high-contrast") == 0;
+	}
+}
+
+/* ------------------------------- rect helpers ------------------------------- */
+
+SHIM BOOL SetRect(RECT *r, int left, int top, int right, int bottom) {
+	*r = (RECT) { left, top, right, bottom };
+	return TRUE;
+}
+
+SHIM BOOL SetRectEmpty(RECT *r) {
+	*r = (RECT) { 0, 0, 0, 0 };
+	return TRUE;
+}
+
+SHIM BOOL CopyRect(RECT *dst, const RECT *src) {
+	*dst = *src;
+	return TRUE;
+}
+
+SHIM BOOL IsRectEmpty(const RECT *r) {
+	return r->right <= r->left || r->bottom <= r->top;
+}
+
+SHIM BOOL EqualRect(const RECT *a, const RECT *b) {
+	return a->left == b->left && a->top == b->top && a->right == b->right && a->bottom == b->bottom;
+}
+
+SHIM BOOL OffsetRect(RECT *r, int dx, int dy) {
+	r->left += dx; r->right += dx;
+	r->top += dy; r->bottom += dy;
+	return TRUE;
+}
+
+SHIM BOOL InflateRect(RECT *r, int dx, int dy) {
+	r->left -= dx; r->right += dx;
+	r->top -= dy; r->bottom += dy;
+	return TRUE;
+}
+
+SHIM BOOL PtInRect(const RECT *r, POINT pt) {
+	return pt.x >= r->left && pt.x < r->right && pt.y >= r->top && pt.y < r->bottom;
+}
+
+SHIM BOOL IntersectRect(RECT *dst, const RECT *a, const RECT *b) {
+	RECT r = { a->left > b->left ? a->left : b->left, a->top > b->top ? a->top : b->top,
+			a->right < b->right ? a->right : b->right, a->bottom < b->bottom ? a->bottom : b->bottom };
+	if (IsRectEmpty(&r)) {
+		SetRectEmpty(dst);
+		return FALSE;
+	}
+	*dst = r;
+	return TRUE;
+}
+
+SHIM BOOL UnionRect(RECT *dst, const RECT *a, const RECT *b) {
+	if (IsRectEmpty(a)) {
+		*dst = *b;
+	}
+	else if (IsRectEmpty(b)) {
+		*dst = *a;
+	}
+	else {
+		*dst = (RECT) { a->left < b->left ? a->left : b->left, a->top < b->top ? a->top : b->top,
+				a->right > b->right ? a->right : b->right, a->bottom > b->bottom ? a->bottom : b->bottom };
+	}
+	return !IsRectEmpty(dst);
+}
+
+/* ------------------------------- kernel32 ------------------------------- */
+
+SHIM DWORD GetLastError(void) {
+	return headless.last_error;
+}
+
+SHIM void SetLastError(DWORD error) {
+	headless.last_error = error;
+}
+
+SHIM HMODULE GetModuleHandle(LPCSTR name) {
+	(void) name;
+	return (HMODULE) &headless;
+}
+
+SHIM DWORD GetModuleFileName(HMODULE module, LPSTR buffer, DWORD size) {
+	(void) module;
+	ssize_t n = readlink("/proc/self/exe", buffer, size - 1);
+	if (n < 0) {
+		headless.last_error = ERROR_FILE_NOT_FOUND;
+		return 0;
+	}
+	buffer[n] = '\0';
+	return (DWORD) n;
+}
+
+#define HEADLESS_REFRESH_NS 	16666667ull		/* the composition clock, 60 Hz */
+
+/* the start of DWM_TIMING_INFO up to cFrame, all the shim fills */
+#pragma pack(push, 1)
+typedef struct ShimTimingInfo {
+	UINT32 cbSize;
+	UINT32 rateRefresh[2];
+	UINT64 qpcRefreshPeriod;
+	UINT32 rateCompose[2];
+	UINT64 qpcVBlank;
+	UINT64 cRefresh;
+	UINT cDXRefresh;
+	UINT64 qpcCompose;
+	UINT64 cFrame;
+} ShimTimingInfo;
+#pragma pack(pop)
+
+/* there is no compositor, a composition is counted on every tick of a 60 Hz clock */
+static HRESULT headless_dwm_timing_info(HWND hwnd, ShimTimingInfo *info) {
+	if (hwnd != NULL || info->cbSize < sizeof(ShimTimingInfo)) {
+		return E_INVALIDARG;
+	}
+	UINT64 now = headless_now_ns();
+	info->rateRefresh[0] = info->rateCompose[0] = 60;
+	info->rateRefresh[1] = info->rateCompose[1] = 1;
+	info->qpcRefreshPeriod = HEADLESS_REFRESH_NS;
+	info->cRefresh = info->cFrame = now / HEADLESS_REFRESH_NS;
+	info->qpcVBlank = info->qpcCompose = info->cFrame*HEADLESS_REFRESH_NS;
+	return S_OK;
+}
+
+static int headless_dwmapi;					/* the module handle of dwmapi.dll */
+
+SHIM HMODULE LoadLibrary(LPCSTR name) {
+	/* dwmapi only tells the composition timing, it reports composition as off; no uxtheme */
+	return strcmp(name, "dwmapi.dll") == 0 ? (HMODULE) &headless_dwmapi : NULL;
+}
+
+SHIM FARPROC GetProcAddress(HMODULE module, LPCSTR name) {
+	if (module == (HMODULE) &headless_dwmapi && strcmp(name, "DwmGetCompositionTimingInfo") == 0) {
+		return (FARPROC) (void (*)(void)) headless_dwm_timing_info;
+	}
+	return NULL;
+}
+
+SHIM BOOL FreeLibrary(HMODULE module) {
+	(void) module;
+	return TRUE;
+}
+
+SHIM HANDLE GetCurrentProcess(void) {
+	return (HANDLE) (LONG_PTR) -1;
+}
+
+SHIM DWORD GetCurrentThreadId(void) {
+	return (DWORD) (ULONG_PTR) pthread_self();
+}
+
+SHIM void GetSystemInfo(SYSTEM_INFO *si) {
+	memset(si, 0, sizeof(*si));
+	si->dwPageSize = (DWORD) sysconf(_SC_PAGESIZE);
+	si->dwAllocationGranularity = 65536;
+	const char *override = getenv("SIW_CPUS");
+	long cpus = override != NULL ? atol(override) : sysconf(_SC_NPROCESSORS_ONLN);
+	si->dwNumberOfProcessors = cpus > 0 ? (DWORD) cpus : 1;
+}
+
+SHIM int MulDiv(int number, int numerator, int denominator) {
+	if (denominator == 0) {
+		return -1;
+	}
+	INT64 value = (INT64) number * numerator;
+	value += (value < 0) == (denominator < 0) ? denominator/2 : -denominator/2;
+	return (int) (value / denominator);
+}
+
+SHIM void Sleep(DWORD ms) {
+	struct timespec ts = { ms / 1000, (long) (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+SHIM DWORD GetTickCount(void) {
+	return (DWORD) (headless_now_ns() / 1000000ull);
+}
+
+SHIM BOOL QueryPerformanceCounter(LARGE_INTEGER *counter) {
+	counter->QuadPart = (INT64) headless_now_ns();
+	return TRUE;
+}
+
+SHIM BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency) {
+	frequency->QuadPart = 1000000000;
+	return TRUE;
+}
+
+SHIM LONG InterlockedIncrement(LONG volatile *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+SHIM LONG InterlockedDecrement(LONG volatile *p) { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+SHIM LONG InterlockedExchange(LONG volatile *p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+SHIM LONG InterlockedExchangeAdd(LONG volatile *p, LONG v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+SHIM LONG InterlockedCompareExchange(LONG volatile *p, LONG v, LONG cmp) {
+	__atomic_compare_exchange_n(p, &cmp, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return cmp;
+}
+SHIM LONG InterlockedOr(LONG volatile *p, LONG v) { return __atomic_fetch_or(p, v, __ATOMIC_SEQ_CST); }
+SHIM LONG InterlockedAnd(LONG volatile *p, LONG v) { return __atomic_fetch_and(p, v, __ATOMIC_SEQ_CST); }
+SHIM void MemoryBarrier(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+SHIM void InitializeCriticalSection(CRITICAL_SECTION *cs) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(cs, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+SHIM void EnterCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_lock(cs); }
+SHIM void LeaveCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_unlock(cs); }
+SHIM void DeleteCriticalSection(CRITICAL_SECTION *cs) { pthread_mutex_destroy(cs); }
+
+static ShimHandle *headless_new_handle(ShimHandleKind kind) {
+	ShimHandle *h = (ShimHandle*) calloc(1, sizeof(ShimHandle));
+	assert(h != NULL);
+	h->kind = kind;
+	h->fd = -1;
+	pthread_mutex_init(&h->mutex, NULL);
+	pthread_cond_init(&h->cond, NULL);
+	return h;
+}
+
+static void *headless_thread_start(void *param) {
+	ShimHandle *h = (ShimHandle*) param;
+	DWORD code = h->start(h->param);
+	pthread_mutex_lock(&h->mutex);
+	h->exit_code = code;
+	h->signaled = true;
+	pthread_cond_broadcast(&h->cond);
+	pthread_mutex_unlock(&h->mutex);
+	return NULL;
+}
+
+SHIM HANDLE CreateThread(SECURITY_ATTRIBUTES *sa, SIZE_T stack, LPTHREAD_START_ROUTINE start, LPVOID param, DWORD flags, DWORD *id) {
+	(void) sa; (void) stack; (void) flags;
+	ShimHandle *h = headless_new_handle(ShimHandle_Thread);
+	h->start = start;
+	h->param = param;
+	h->manual_reset = true;
+	if (pthread_create(&h->thread, NULL, headless_thread_start, h) != 0) {
+		free(h);
+		return NULL;
+	}
+	if (id != NULL) {
+		*id = (DWORD) (ULONG_PTR) h->thread;
+	}
+	return h;
+}
+
+/* false, with the last error set, when the name does not fit */
+static bool headless_event_name(char *out, size_t size, LPCSTR name) {
+	int length = snprintf(out, size, "/%s", name);
+	if (length < 0 || (size_t) length >= size) {
+		headless.last_error = ERROR_FILENAME_EXCED_RANGE;
+		return false;
+	}
+	for (char *p = out + 1; *p; p++) {
+		if (*p == '/' || *p == '\\') {
+			*p = '_';
+		}
+	}
+	return true;
+}
+
+SHIM HANDLE CreateEvent(SECURITY_ATTRIBUTES *sa, BOOL manual_reset, BOOL initial, LPCSTR name) {
+	(void) sa;
+	if (name != NULL) {
+		/* named events cross the process boundary as POSIX semaphores (auto-reset only) */
+		char sem_name[MAX_PATH];
+		if (!headless_event_name(sem_name, sizeof(sem_name), name)) {
+			return NULL;
+		}
+		ShimHandle *h = headless_new_handle(ShimHandle_NamedEvent);
+		headless.last_error = ERROR_SUCCESS;
+		h->sem = sem_open(sem_name, O_CREAT | O_EXCL, 0600, initial ? 1 : 0);
+		h->owner = h->sem != SEM_FAILED;
+		if (h->sem == SEM_FAILED && errno == EEXIST) {
+			h->sem = sem_open(sem_name, 0);
+			headless.last_error = ERROR_ALREADY_EXISTS;
+		}
+		if (h->sem == SEM_FAILED) {
+			free(h);
+			return NULL;
+		}
+		snprintf(h->name, sizeof(h->name), "%s", sem_name);
+		return h;
+	}
+	ShimHandle *h = headless_new_handle(ShimHandle_Event);
+	h->manual_reset = manual_reset;
+	h->signaled = initial;
+	return h;
+}
+
+SHIM HANDLE OpenEvent(DWORD access, BOOL inherit, LPCSTR name) {
+	(void) access; (void) inherit;
+	char sem_name[MAX_PATH];
+	if (!headless_event_name(sem_name, sizeof(sem_name), name)) {
+		return NULL;
+	}
+	sem_t *sem = sem_open(sem_name, 0);
+	if (sem == SEM_FAILED) {
+		headless.last_error = ERROR_FILE_NOT_FOUND;
+		return NULL;
+	}
+	ShimHandle *h = headless_new_handle(ShimHandle_NamedEvent);
+	h->sem = sem;
+	return h;
+}
+
+SHIM BOOL SetEvent(HANDLE handle) {
+	ShimHandle *h = (ShimHandle*) handle;
+	if (h->kind == ShimHandle_NamedEvent) {
+		int value = 0;
+		if (sem_getvalue(h->sem, &value) == 0 && value > 0) {
+			return TRUE;
+		}
+		return sem_post(h->sem) == 0;
+	}
+	pthread_mutex_lock(&h->mutex);
+	h->signaled = true;
+	pthread_cond_broadcast(&h->cond);
+	pthread_mutex_unlock(&h->mutex);
+	return TRUE;
+}
+
+SHIM HANDLE CreateSemaphore(SECURITY_ATTRIBUTES *sa, LONG initial, LONG maximum, LPCSTR name) {
+	(void) sa;
+	assert(name == NULL && "ERROR: the headless backend has no named semaphores");
+	ShimHandle *h = headless_new_handle(ShimHandle_Semaphore);
+	h->count = initial;
+	h->max_count = maximum;
+	h->signaled = initial > 0;
+	return h;
+}
+
+SHIM BOOL ReleaseSemaphore(HANDLE handle, LONG release, LONG *previous) {
+	ShimHandle *h = (ShimHandle*) handle;
+	pthread_mutex_lock(&h->mutex);
+	if (previous != NULL) {
+		*previous = h->count;
+	}
+	if (release <= 0 || h->count + release > h->max_count) {
+		pthread_mutex_unlock(&h->mutex);
+		return FALSE;
+	}
+	h->count += release;
+	h->signaled = true;
+	pthread_cond_broadcast(&h->cond);
+	pthread_mutex_unlock(&h->mutex);
+	return TRUE;
+}
+
+SHIM BOOL ResetEvent(HANDLE handle) {
+	ShimHandle *h = (ShimHandle*) handle;
+	if (h->kind == ShimHandle_NamedEvent) {
+		while (sem_trywait(h->sem) == 0) {}
+		return TRUE;
+	}
+	pthread_mutex_lock(&h->mutex);
+	h->signaled = false;
+	pthread_mutex_unlock(&h->mutex);
+	return TRUE;
+}
+
+SHIM DWORD WaitForSingleObject(HANDLE handle, DWORD ms) {
+	ShimHandle *h = (ShimHandle*) handle;
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	if (ms != INFINITE) {
+		deadline.tv_sec += ms / 1000;
+		deadline.tv_nsec += (long) (ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+	if (h->kind == ShimHandle_NamedEvent) {
+		int rc = ms == INFINITE ? sem_wait(h->sem) : sem_timedwait(h->sem, &deadline);
+		return rc == 0 ? WAIT_OBJECT_0 : (errno == ETIMEDOUT ? WAIT_TIMEOUT : WAIT_FAILED);
+	}
+	pthread_mutex_lock(&h->mutex);
+	while (!h->signaled) {
+		int rc = ms == INFINITE ? pthread_cond_wait(&h->cond, &h->mutex) : pthread_cond_timedwait(&h->cond, &h->mutex, &deadline);
+		if (rc == ETIMEDOUT) {
+			pthread_mutex_unlock(&h->mutex);
+			return WAIT_TIMEOUT;
+		}
+	}
+	if (h->kind == ShimHandle_Semaphore) {
+		h->signaled = --h->count > 0;
+	}
+	else if (!h->manual_reset) {
+		h->signaled = false;
+	}
+	pthread_mutex_unlock(&h->mutex);
+	if (h->kind == ShimHandle_Thread && !h->joined) {
+		pthread_join(h->thread, NULL);
+		h->joined = true;
+	}
+	return WAIT_OBJECT_0;
+}
+
+SHIM BOOL GetExitCodeThread(HANDLE handle, DWORD *code) {
+	*code = ((ShimHandle*) handle)->exit_code;
+	return TRUE;
+}
+
+SHIM BOOL CloseHandle(HANDLE handle) {
+	if (handle == NULL || handle == INVALID_HANDLE_VALUE) {
+		return FALSE;
+	}
+	ShimHandle *h = (ShimHandle*) handle;
+	if (h->kind == ShimHandle_Thread && !h->joined) {
+		pthread_detach(h->thread);
+	}
+	if (h->sem != NULL) {
+		sem_close(h->sem);
+	}
+	if (h->owner && h->kind == ShimHandle_NamedEvent) {
+		sem_unlink(h->name);
+	}
+	if (h->owner && h->kind == ShimHandle_Mapping) {
+		shm_unlink(h->name);
+	}
+	if (h->fd >= 0) {
+		close(h->fd);
+	}
+	pthread_mutex_destroy(&h->mutex);
+	pthread_cond_destroy(&h->cond);
+	free(h);
+	return TRUE;
+}
+
+SHIM HANDLE CreateFile(LPCSTR path, DWORD access, DWORD share, SECURITY_ATTRIBUTES *sa, DWORD disposition, DWORD attributes, HANDLE template_file) {
+	(void) share; (void) sa; (void) attributes; (void) template_file;
+	int flags = (access & GENERIC_WRITE) ? ((access & GENERIC_READ) ? O_RDWR : O_WRONLY) : O_RDONLY;
+	if (disposition == CREATE_ALWAYS) {
+		flags |= O_CREAT | O_TRUNC;
+	}
+	else if (disposition == OPEN_ALWAYS) {
+		flags |= O_CREAT;
+	}
+	int fd = open(path, flags, 0644);
+	if (fd < 0) {
+		headless.last_error = ERROR_FILE_NOT_FOUND;
+		return INVALID_HANDLE_VALUE;
+	}
+	ShimHandle *h = headless_new_handle(ShimHandle_File);
+	h->fd = fd;
+	return h;
+}
+
+SHIM BOOL ReadFile(HANDLE file, LPVOID buffer, DWORD size, DWORD *read_bytes, LPVOID overlapped) {
+	(void) overlapped;
+	ssize_t n = read(((ShimHandle*) file)->fd, buffer, size);
+	if (read_bytes != NULL) {
+		*read_bytes = n > 0 ? (DWORD) n : 0;
+	}
+	return n >= 0;
+}
+
+SHIM BOOL WriteFile(HANDLE file, LPCVOID buffer, DWORD size, DWORD *written, LPVOID overlapped) {
+	(void) overlapped;
+	ssize_t n = write(((ShimHandle*) file)->fd, buffer, size);
+	if (written != NULL) {
+		*written = n > 0 ? (DWORD) n : 0;
+	}
+	return n == (ssize_t) size;
+}
+
+SHIM BOOL FlushFileBuffers(HANDLE file) {
+	return fsync(((ShimHandle*) file)->fd) == 0;
+}
+
+SHIM DWORD GetFileSize(HANDLE file, DWORD *high) {
+	struct stat st;
+	if (fstat(((ShimHandle*) file)->fd, &st) != 0) {
+		return INVALID_FILE_SIZE;
+	}
+	if (high != NULL) {
+		*high = (DWORD) ((UINT64) st.st_size >> 32);
+	}
+	return (DWORD) (st.st_size & 0xffffffff);
+}
+
+SHIM BOOL MoveFileEx(LPCSTR from, LPCSTR to, DWORD flags) {
+	(void) flags;
+	return rename(from, to) == 0;
+}
+
+SHIM BOOL DeleteFile(LPCSTR path) {
+	return unlink(path) == 0;
+}
+
+/* file mappings: backed by the file, by shm_open for named sections or by memfd */
+SHIM HANDLE CreateFileMapping(HANDLE file, SECURITY_ATTRIBUTES *sa, DWORD protect, DWORD size_high, DWORD size_low, LPCSTR name) {
+	(void) sa; (void) protect;
+	size_t length = ((size_t) size_high << 32) | size_low;
+	char shm_name[MAX_PATH] = "";
+	int fd;
+	headless.last_error = ERROR_SUCCESS;
+	if (file != INVALID_HANDLE_VALUE) {
+		fd = dup(((ShimHandle*) file)->fd);
+		struct stat st;
+		if (length == 0 && fstat(fd, &st) == 0) {
+			length = (size_t) st.st_size;
+		}
+	}
+	else if (name != NULL) {
+		if (!headless_event_name(shm_name, sizeof(shm_name), name)) {
+			return NULL;
+		}
+		fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd < 0 && errno == EEXIST) {
+			fd = shm_open(shm_name, O_RDWR, 0600);
+			headless.last_error = ERROR_ALREADY_EXISTS;
+		}
+	}
+	else {
+		fd = memfd_create("siw-section", 0);
+	}
+	if (fd < 0 || length == 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	if (file == INVALID_HANDLE_VALUE && headless.last_error != ERROR_ALREADY_EXISTS && ftruncate(fd, (off_t) length) != 0) {
+		close(fd);
+		return NULL;
+	}
+	ShimHandle *h = headless_new_handle(ShimHandle_Mapping);
+	h->fd = fd;
+	h->length = length;
+	h->owner = shm_name[0] != '\0' && headless.last_error != ERROR_ALREADY_EXISTS;
+	snprintf(h->name, sizeof(h->name), "%s", shm_name);
+	return h;
+}
+
+SHIM HANDLE OpenFileMapping(DWORD access, BOOL inherit, LPCSTR name) {
+	(void) access; (void) inherit;
+	char shm_name[MAX_PATH];
+	if (!headless_event_name(shm_name, sizeof(shm_name), name)) {
+		return NULL;
+	}
+	int fd = shm_open(shm_name, O_RDWR, 0600);
+	if (fd < 0) {
+		headless.last_error = ERROR_FILE_NOT_FOUND;
+		return NULL;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	ShimHandle *h = headless_new_handle(ShimHandle_Mapping);
+	h->fd = fd;
+	h->length = (size_t) st.st_size;
+	return h;
+}
+
+static void headless_track_mapping(void *base, size_t length) {
+	for (size_t i = 0; i < sizeof(headless.mappings)/sizeof(*headless.mappings); i++) {
+		if (headless.mappings[i] == NULL) {
+			headless.mappings[i] = base;
+			headless.mapping_lengths[i] = length;
+			return;
+		}
+	}
+	assert(false && "ERROR: too many mapped views");
+}
+
+SHIM LPVOID MapViewOfFile(HANDLE mapping, DWORD access, DWORD offset_high, DWORD offset_low, SIZE_T size) {
+	ShimHandle *h = (ShimHandle*) mapping;
+	size_t offset = ((size_t) offset_high << 32) | offset_low;
+	size_t length = size ? size : h->length - offset;
+	int prot = (access & FILE_MAP_WRITE) ? PROT_READ | PROT_WRITE : PROT_READ;
+	void *base = mmap(NULL, length, prot, MAP_SHARED, h->fd, (off_t) offset);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	headless_track_mapping(base, length);
+	return base;
+}
+
+SHIM BOOL UnmapViewOfFile(LPCVOID base) {
+	for (size_t i = 0; i < sizeof(headless.mappings)/sizeof(*headless.mappings); i++) {
+		if (headless.mappings[i] == base) {
+			munmap(headless.mappings[i], headless.mapping_lengths[i]);
+			headless.mappings[i] = NULL;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+SHIM LPVOID VirtualAlloc(LPVOID address, SIZE_T size, DWORD type, DWORD protect) {
+	(void) address; (void) type; (void) protect;
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+	headless_track_mapping(p, size);
+	return p;
+}
+
+SHIM BOOL VirtualFree(LPVOID address, SIZE_T size, DWORD type) {
+	(void) size; (void) type;
+	return UnmapViewOfFile(address);
+}
+
+SHIM BOOL GetProcessMemoryInfo(HANDLE process, PROCESS_MEMORY_COUNTERS *pmc, DWORD cb) {
+	(void) process;
+	memset(pmc, 0, cb);
+	pmc->cb = cb;
+	struct mallinfo2 mi = mallinfo2();
+	pmc->PagefileUsage = mi.uordblks + mi.hblkhd;		/* the allocated bytes stand for the commit charge */
+	long pages = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f != NULL) {
+		long size;
+		if (fscanf(f, "%ld %ld", &size, &pages) != 2) {
+			pages = 0;
+		}
+		fclose(f);
+	}
+	pmc->WorkingSetSize = (SIZE_T) pages * (SIZE_T) sysconf(_SC_PAGESIZE);
+	return TRUE;
+}
+
+/* ------------------------------- gdi32 ------------------------------- */
+
+static ShimGdi *headless_new_gdi(ShimGdiKind kind) {
+	ShimGdi *obj = (ShimGdi*) calloc(1, sizeof(ShimGdi));
+	assert(obj != NULL);
+	obj->kind = kind;
+	headless.gdi_objects++;
+	return obj;
+}
+
+SHIM HGDIOBJ GetStockObject(int index) {
+	(void) index;
+	return &headless_stock_font;
+}
+
+SHIM HPEN CreatePen(int style, int width, COLORREF color) {
+	(void) style;
+	ShimGdi *pen = headless_new_gdi(ShimGdi_Pen);
+	pen->width = width < 1 ? 1 : width;
+	pen->color = color;
+	return pen;
+}
+
+SHIM HBRUSH CreateSolidBrush(COLORREF color) {
+	ShimGdi *brush = headless_new_gdi(ShimGdi_Brush);
+	brush->color = color;
+	return brush;
+}
+
+SHIM HBRUSH GetSysColorBrush(int index) {
+	(void) index;
+	return &headless_stock_brush;
+}
+
+SHIM DWORD GetSysColor(int index) {
+	headless_init();
+	if (headless.high_contrast) {			/* "High Contrast Black" */
+		switch (index) {
+			case COLOR_WINDOW: return 0x000000;
+			case COLOR_WINDOWTEXT: return 0xffffff;
+			case COLOR_HIGHLIGHT: return 0xffff00;
+			case COLOR_HIGHLIGHTTEXT: return 0x000000;
+			case COLOR_GRAYTEXT: return 0x00ff00;
+			case COLOR_ACTIVECAPTION: return 0x800080;
+			case COLOR_INACTIVECAPTION: return 0x008000;
+			case COLOR_CAPTIONTEXT: return 0xffffff;
+			case COLOR_INACTIVECAPTIONTEXT: return 0xffffff;
+			case COLOR_ACTIVEBORDER: return 0x00ffff;
+			default: return 0x000000;
+		}
+	}
+	switch (index) {
+		case COLOR_WINDOW: return 0xffffff;
+		case COLOR_WINDOWTEXT: return 0x000000;
+		case COLOR_HIGHLIGHT: return 0xd77800;
+		case COLOR_HIGHLIGHTTEXT: return 0xffffff;
+		case COLOR_GRAYTEXT: return 0x6d6d6d;
+		case COLOR_ACTIVECAPTION: return 0xd1b499;
+		case COLOR_INACTIVECAPTION: return 0xdbcdbf;
+		case COLOR_CAPTIONTEXT: return 0x000000;
+		case COLOR_INACTIVECAPTIONTEXT: return 0x544e43;
+		case COLOR_ACTIVEBORDER: return 0xb4b4b4;
+		default: return 0xf0f0f0;
+	}
+}
+
+SHIM HFONT CreateFontIndirect(const LOGFONT *lf) {
+	ShimGdi *font = headless_new_gdi(ShimGdi_Font);
+	font->lf = *lf;
+	return font;
+}
+
+SHIM HFONT CreateFont(int height, int width, int escapement, int orientation, int weight, DWORD italic, DWORD underline,
+					DWORD strike_out, DWORD charset, DWORD out_precision, DWORD clip_precision, DWORD quality,
+					DWORD pitch_and_family, LPCSTR face) {
+	LOGFONT lf = {
+		.lfHeight = height, .lfWidth = width, .lfEscapement = escapement, .lfOrientation = orientation,
+		.lfWeight = weight, .lfItalic = (BYTE) italic, .lfUnderline = (BYTE) underline, .lfStrikeOut = (BYTE) strike_out,
+		.lfCharSet = (BYTE) charset, .lfOutPrecision = (BYTE) out_precision, .lfClipPrecision = (BYTE) clip_precision,
+		.lfQuality = (BYTE) quality, .lfPitchAndFamily = (BYTE) pitch_and_family,
+	};
+	if (face != NULL) {
+		snprintf(lf.lfFaceName, LF_FACESIZE, "%s", face);
+	}
+	return CreateFontIndirect(&lf);
+}
+
+SHIM HBITMAP CreateCompatibleBitmap(HDC hdc, int width, int height) {
+	(void) hdc;
+	ShimGdi *bmp = headless_new_gdi(ShimGdi_Bitmap);
+	bmp->bmp_width = width > 0 ? width : 1;
+	bmp->bmp_height = height > 0 ? height : 1;
+	bmp->pixels = (UINT32*) calloc((size_t) bmp->bmp_width * bmp->bmp_height, sizeof(UINT32));
+	assert(bmp->pixels != NULL);
+	bmp->owns_pixels = true;
+	return bmp;
+}
+
+SHIM HBITMAP CreateDIBSection(HDC hdc, const BITMAPINFO *bmi, UINT usage, void **bits, HANDLE section, DWORD offset) {
+	(void) hdc; (void) usage;
+	assert(bmi->bmiHeader.biBitCount == 32 && "ERROR: the headless backend only supports 32bpp DIB sections");
+	int width = bmi->bmiHeader.biWidth;
+	int height = bmi->bmiHeader.biHeight < 0 ? -bmi->bmiHeader.biHeight : bmi->bmiHeader.biHeight;
+	if (width <= 0 || height <= 0) {
+		return NULL;
+	}
+	size_t size = (size_t) width * height * sizeof(UINT32);
+	ShimGdi *bmp = headless_new_gdi(ShimGdi_Bitmap);
+	bmp->bmp_width = width;
+	bmp->bmp_height = height;
+	if (section != NULL) {
+		ShimHandle *h = (ShimHandle*) section;
+		bmp->section_length = h->length;
+		bmp->section_base = mmap(NULL, h->length, PROT_READ | PROT_WRITE, MAP_SHARED, h->fd, 0);
+		if (bmp->section_base == MAP_FAILED || offset + size > h->length) {
+			free(bmp);
+			headless.gdi_objects--;
+			return NULL;
+		}
+		bmp->pixels = (UINT32*) ((char*) bmp->section_base + offset);
+	}
+	else {
+		bmp->pixels = (UINT32*) calloc(1, size);
+		bmp->owns_pixels = true;
+	}
+	assert(bmp->pixels != NULL);
+	if (bits != NULL) {
+		*bits = bmp->pixels;
+	}
+	return bmp;
+}
+
+SHIM int GetObject(HGDIOBJ obj, int size, LPVOID out) {
+	if (obj->kind == ShimGdi_Font && size >= (int) sizeof(LOGFONT)) {
+		*(LOGFONT*) out = obj->lf;
+		return sizeof(LOGFONT);
+	}
+	if (obj->kind == ShimGdi_Bitmap && size >= (int) sizeof(BITMAP)) {
+		*(BITMAP*) out = (BITMAP) { 0, obj->bmp_width, obj->bmp_height, obj->bmp_width*4, 1, 32, obj->pixels };
+		return sizeof(BITMAP);
+	}
+	return 0;
+}
+
+SHIM BOOL DeleteObject(HGDIOBJ obj) {
+	if (obj == NULL) {
+		return FALSE;
+	}
+	if (obj->stock) {
+		return TRUE;
+	}
+	if (obj->owns_pixels) {
+		free(obj->pixels);
+	}
+	if (obj->section_base != NULL) {
+		munmap(obj->section_base, obj->section_length);
+	}
+	free(obj);
+	headless.gdi_objects--;
+	return TRUE;
+}
+
+static void headless_init_dc(ShimDC *dc) {
+	dc->pen = &headless_stock_pen;
+	dc->brush = &headless_stock_brush;
+	dc->font = &headless_stock_font;
+	dc->bk_color = 0xffffff;
+	dc->text_color = 0;
+	dc->bk_mode = OPAQUE;
+}
+
+SHIM HDC CreateCompatibleDC(HDC hdc) {
+	(void) hdc;
+	ShimDC *dc = (ShimDC*) calloc(1, sizeof(ShimDC));
+	assert(dc != NULL);
+	headless_init_dc(dc);
+	dc->is_memory = true;
+	dc->bitmap = &headless_stock_bitmap;
+	headless.gdi_objects++;
+	return dc;
+}
+
+SHIM BOOL DeleteDC(HDC hdc) {
+	if (hdc == NULL || !hdc->is_memory) {
+		return FALSE;
+	}
+	free(hdc);
+	headless.gdi_objects--;
+	return TRUE;
+}
+
+SHIM HGDIOBJ SelectObject(HDC hdc, HGDIOBJ obj) {
+	HGDIOBJ old = NULL;
+	switch (obj->kind) {
+		case ShimGdi_Pen: old = hdc->pen; hdc->pen = obj; break;
+		case ShimGdi_Brush: old = hdc->brush; hdc->brush = obj; break;
+		case ShimGdi_Font: old = hdc->font; hdc->font = obj; break;
+		case ShimGdi_Bitmap:
+			if (!hdc->is_memory) {
+				return NULL;
+			}
+			old = hdc->bitmap; hdc->bitmap = obj;
+			break;
+		default: break;
+	}
+	return old;
+}
+
+static UINT32 *headless_surface(HDC hdc, int *width, int *height) {
+	if (hdc->is_memory) {
+		*width = hdc->bitmap->bmp_width;
+		*height = hdc->bitmap->bmp_height;
+		return hdc->bitmap->pixels;
+	}
+	*width = hdc->window->fb_width;
+	*height = hdc->window->fb_height;
+	return hdc->window->pixels;
+}
+
+static RECT headless_device_clip(HDC hdc) {
+	int width, height;
+	headless_surface(hdc, &width, &height);
+	RECT clip = { 0, 0, width, height };
+	if (hdc->has_clip) {
+		IntersectRect(&clip, &clip, &hdc->clip);
+	}
+	return clip;
+}
+
+/* fill in logical coordinates */
+static void headless_fill(HDC hdc, RECT r, UINT32 value) {
+	int width, height;
+	UINT32 *pixels = headless_surface(hdc, &width, &height);
+	if (pixels == NULL) {
+		return;
+	}
+	OffsetRect(&r, hdc->viewport.x, hdc->viewport.y);
+	RECT clip = headless_device_clip(hdc);
+	if (!IntersectRect(&r, &r, &clip)) {
+		return;
+	}
+	for (int y = r.top; y < r.bottom; y++) {
+		UINT32 *row = pixels + (size_t) y * width;
+		for (int x = r.left; x < r.right; x++) {
+			row[x] = value;
+		}
+	}
+}
+
+SHIM int SetBkMode(HDC hdc, int mode) { int old = hdc->bk_mode; hdc->bk_mode = mode; return old; }
+SHIM COLORREF SetBkColor(HDC hdc, COLORREF color) { COLORREF old = hdc->bk_color; hdc->bk_color = color; return old; }
+SHIM COLORREF SetTextColor(HDC hdc, COLORREF color) { COLORREF old = hdc->text_color; hdc->text_color = color; return old; }
+
+SHIM BOOL SetViewportOrgEx(HDC hdc, int x, int y, POINT *old) {
+	if (old != NULL) {
+		*old = hdc->viewport;
+	}
+	hdc->viewport = (POINT) { x, y };
+	return TRUE;
+}
+
+SHIM BOOL OffsetViewportOrgEx(HDC hdc, int dx, int dy, POINT *old) {
+	if (old != NULL) {
+		*old = hdc->viewport;
+	}
+	hdc->viewport.x += dx;
+	hdc->viewport.y += dy;
+	return TRUE;
+}
+
+SHIM int IntersectClipRect(HDC hdc, int left, int top, int right, int bottom) {
+	RECT r = { left + hdc->viewport.x, top + hdc->viewport.y, right + hdc->viewport.x, bottom + hdc->viewport.y };
+	if (hdc->has_clip) {
+		IntersectRect(&hdc->clip, &hdc->clip, &r);
+	}
+	else {
+		hdc->clip = r;
+		hdc->has_clip = true;
+	}
+	return 2;								/* SIMPLEREGION */
+}
+
+SHIM int SaveDC(HDC hdc) {
+	assert(hdc->saved_count < (int) (sizeof(hdc->saved)/sizeof(hdc->saved[0])));
+	hdc->saved[hdc->saved_count].viewport = hdc->viewport;
+	hdc->saved[hdc->saved_count].clip = hdc->clip;
+	hdc->saved[hdc->saved_count].has_clip = hdc->has_clip;
+	return ++hdc->saved_count;
+}
+
+/* saved is the value SaveDC returned, or negative to go back that many */
+SHIM BOOL RestoreDC(HDC hdc, int saved) {
+	int index = saved < 0 ? hdc->saved_count + saved : saved - 1;
+	if (index < 0 || index >= hdc->saved_count) {
+		return FALSE;
+	}
+	hdc->viewport = hdc->saved[index].viewport;
+	hdc->clip = hdc->saved[index].clip;
+	hdc->has_clip = hdc->saved[index].has_clip;
+	hdc->saved_count = index;
+	return TRUE;
+}
+
+SHIM int GetClipBox(HDC hdc, RECT *rect) {
+	*rect = headless_device_clip(hdc);
+	OffsetRect(rect, -hdc->viewport.x, -hdc->viewport.y);
+	return IsRectEmpty(rect) ? NULLREGION : SIMPLEREGION;
+}
+
+SHIM int SelectClipRgn(HDC hdc, HANDLE rgn) {
+	(void) rgn;
+	hdc->has_clip = false;
+	return 1;
+}
+
+SHIM BOOL MoveToEx(HDC hdc, int x, int y, POINT *old) {
+	if (old != NULL) {
+		*old = hdc->pos;
+	}
+	hdc->pos = (POINT) { x, y };
+	return TRUE;
+}
+
+/* Bresenham with a square pen; like GDI the end point is excluded */
+SHIM BOOL LineTo(HDC hdc, int x, int y) {
+	int x0 = hdc->pos.x, y0 = hdc->pos.y;
+	int dx = abs(x - x0), dy = -abs(y - y0);
+	int sx = x0 < x ? 1 : -1, sy = y0 < y ? 1 : -1;
+	int err = dx + dy;
+	int w = hdc->pen->width;
+	UINT32 value = headless_pixel(hdc->pen->color);
+	while (x0 != x || y0 != y) {
+		headless_fill(hdc, (RECT) { x0 - w/2, y0 - w/2, x0 - w/2 + w, y0 - w/2 + w }, value);
+		int e2 = 2*err;
+		if (e2 >= dy) { err += dy; x0 += sx; }
+		if (e2 <= dx) { err += dx; y0 += sy; }
+	}
+	hdc->pos = (POINT) { x, y };
+	return TRUE;
+}
+
+SHIM int FillRect(HDC hdc, const RECT *r, HBRUSH brush) {
+	headless_fill(hdc, *r, headless_pixel(brush->color));
+	return 1;
+}
+
+static int headless_font_height(HDC hdc) {
+	LONG h = hdc->font->lf.lfHeight;
+	return h == 0 ? 12 : (h < 0 ? -h : h);
+}
+
+static int headless_char_width(HDC hdc, char c) {
+	int h = headless_font_height(hdc);
+	return c == ' ' ? h/3 : h/2 + (c >= 'A' && c <= 'Z');
+}
+
+SHIM BOOL GetTextExtentPoint32(HDC hdc, LPCSTR text, int length, SIZE *size) {
+	size->cx = 0;
+	for (int i = 0; i < length; i++) {
+		size->cx += headless_char_width(hdc, text[i]);
+	}
+	size->cy = headless_font_height(hdc) + headless_font_height(hdc)/3;
+	return TRUE;
+}
+
+/* The bundled rasterizer has no outlines: every printable glyph is a solid
+   stem box inside its cell, which keeps the pixel cost of text realistic. */
+SHIM BOOL ExtTextOut(HDC hdc, int x, int y, UINT options, const RECT *rect, LPCSTR text, UINT length, const INT *dx) {
+	headless.text_calls++;
+	(void) dx;
+	if ((options & ETO_OPAQUE) && rect != NULL) {
+		headless_fill(hdc, *rect, headless_pixel(hdc->bk_color));
+	}
+	if (text == NULL || length == 0) {
+		return TRUE;
+	}
+	SIZE extent;
+	GetTextExtentPoint32(hdc, text, (int) length, &extent);
+	if (hdc->bk_mode == OPAQUE && !(options & ETO_OPAQUE)) {
+		headless_fill(hdc, (RECT) { x, y, x + extent.cx, y + extent.cy }, headless_pixel(hdc->bk_color));
+	}
+	int h = headless_font_height(hdc);
+	UINT32 value = headless_pixel(hdc->text_color);
+	int pen_x = x;
+	for (UINT i = 0; i < length; i++) {
+		int cw = headless_char_width(hdc, text[i]);
+		if (text[i] != ' ') {
+			RECT glyph = { pen_x + 1, y + h/4, pen_x + cw - 1, y + h/4 + h*3/4 };
+			if ((options & ETO_CLIPPED) && rect != NULL) {
+				IntersectRect(&glyph, &glyph, rect);
+			}
+			headless_fill(hdc, glyph, value);
+		}
+		pen_x += cw;
+	}
+	return TRUE;
+}
+
+SHIM BOOL TextOut(HDC hdc, int x, int y, LPCSTR text, int length) {
+	return ExtTextOut(hdc, x, y, 0, NULL, text, (UINT) length, NULL);
+}
+
+SHIM BOOL DrawIconEx(HDC hdc, int x, int y, HICON icon, int cx, int cy, UINT step, HBRUSH background, UINT flags) {
+	(void) step; (void) flags;
+	if (background != NULL) {
+		headless_fill(hdc, (RECT) { x, y, x + cx, y + cy }, headless_pixel(background->color));
+	}
+	headless_fill(hdc, (RECT) { x + cx/8, y + cy/8, x + cx - cx/8, y + cy - cy/8 }, headless_pixel(icon->color));
+	return TRUE;
+}
+
+SHIM BOOL BitBlt(HDC dst, int x, int y, int cx, int cy, HDC src, int sx, int sy, DWORD rop) {
+	(void) rop;
+	int dw, dh, sw, sh;
+	UINT32 *dp = headless_surface(dst, &dw, &dh);
+	UINT32 *sp = headless_surface(src, &sw, &sh);
+	if (dp == NULL || sp == NULL) {
+		return FALSE;
+	}
+	x += dst->viewport.x; y += dst->viewport.y;
+	sx += src->viewport.x; sy += src->viewport.y;
+	RECT r = { x, y, x + cx, y + cy };
+	RECT clip = headless_device_clip(dst);
+	if (!IntersectRect(&r, &r, &clip)) {
+		return TRUE;
+	}
+	for (int row = r.top; row < r.bottom; row++) {
+		int srow = sy + row - y;
+		if (srow < 0 || srow >= sh) {
+			continue;
+		}
+		int from = r.left, to = r.right;
+		if (sx + from - x < 0) from = x - sx;
+		if (sx + to - x > sw) to = x - sx + sw;
+		if (from < to) {
+			memmove(dp + (size_t) row * dw + from, sp + (size_t) srow * sw + sx + from - x, (size_t) (to - from) * sizeof(UINT32));
+		}
+	}
+	return TRUE;
+}
+
+SHIM BOOL GdiFlush(void) {
+	return TRUE;
+}
+
+SHIM int GetDeviceCaps(HDC hdc, int index) {
+	(void) hdc;
+	if (index == LOGPIXELSX || index == LOGPIXELSY) {
+		return headless.dpi ? (int) headless.dpi : 96;
+	}
+	return 0;
+}
+
+/* ------------------------------- user32: monitors ------------------------------- */
+
+SHIM int GetSystemMetrics(int index) {
+	headless_init();
+	switch (index) {
+		case SM_CXSMICON: case SM_CYSMICON: return 16;
+		case SM_CXFRAME: case SM_CYFRAME: return 4;
+		case SM_CXPADDEDBORDER: return 4;
+		case SM_MENUDROPALIGNMENT: return 0;
+		case SM_CXSCREEN: return headless.monitors[0].rc_monitor.right - headless.monitors[0].rc_monitor.left;
+		case SM_CYSCREEN: return headless.monitors[0].rc_monitor.bottom - headless.monitors[0].rc_monitor.top;
+		default: return 0;
+	}
+}
+
+static long headless_distance(const RECT *r, POINT pt) {
+	long dx = pt.x < r->left ? r->left - pt.x : (pt.x >= r->right ? pt.x - r->right + 1 : 0);
+	long dy = pt.y < r->top ? r->top - pt.y : (pt.y >= r->bottom ? pt.y - r->bottom + 1 : 0);
+	return dx*dx + dy*dy;
+}
+
+SHIM HMONITOR MonitorFromPoint(POINT pt, DWORD flags) {
+	headless_init();
+	headless.monitor_calls++;
+	int best = 0;
+	for (int i = 0; i < headless.monitor_count; i++) {
+		if (PtInRect(&headless.monitors[i].rc_monitor, pt)) {
+			return &headless.monitors[i];
+		}
+		if (headless_distance(&headless.monitors[i].rc_monitor, pt) < headless_distance(&headless.monitors[best].rc_monitor, pt)) {
+			best = i;
+		}
+	}
+	if (flags == MONITOR_DEFAULTTONULL) {
+		return NULL;
+	}
+	return flags == MONITOR_DEFAULTTOPRIMARY ? &headless.monitors[0] : &headless.monitors[best];
+}
+
+SHIM HMONITOR MonitorFromRect(const RECT *r, DWORD flags) {
+	headless_init();
+	headless.monitor_calls++;
+	long best_area = 0;
+	HMONITOR best = NULL;
+	for (int i = 0; i < headless.monitor_count; i++) {
+		RECT overlap;
+		if (IntersectRect(&overlap, r, &headless.monitors[i].rc_monitor)) {
+			long area = (overlap.right - overlap.left) * (overlap.bottom - overlap.top);
+			if (area > best_area) {
+				best_area = area;
+				best = &headless.monitors[i];
+			}
+		}
+	}
+	if (best != NULL) {
+		return best;
+	}
+	return MonitorFromPoint((POINT) { (r->left + r->right)/2, (r->top + r->bottom)/2 }, flags);
+}
+
+SHIM HMONITOR MonitorFromWindow(HWND hwnd, DWORD flags) {
+	return MonitorFromRect(&hwnd->rect, flags);
+}
+
+SHIM BOOL GetMonitorInfo(HMONITOR monitor, MONITORINFO *mi) {
+	headless.monitor_calls++;
+	if (monitor == NULL) {
+		return FALSE;
+	}
+	mi->rcMonitor = monitor->rc_monitor;
+	mi->rcWork = monitor->rc_work;
+	mi->dwFlags = monitor == &headless.monitors[0] ? MONITORINFOF_PRIMARY : 0;
+	if (mi->cbSize >= sizeof(MONITORINFOEX)) {
+		memcpy(((MONITORINFOEX*) mi)->szDevice, monitor->device, CCHDEVICENAME);
+	}
+	return TRUE;
+}
+
+SHIM BOOL EnumDisplayMonitors(HDC hdc, const RECT *clip, MONITORENUMPROC proc, LPARAM lparam) {
+	(void) hdc; (void) clip;
+	headless_init();
+	for (int i = 0; i < headless.monitor_count; i++) {
+		if (!proc(&headless.monitors[i], NULL, &headless.monitors[i].rc_monitor, lparam)) {
+			break;
+		}
+	}
+	return TRUE;
+}
+
+SHIM BOOL SystemParametersInfo(UINT action, UINT param, LPVOID pv, UINT ini) {
+	(void) param; (void) ini;
+	headless_init();
+	if (action == SPI_GETWORKAREA) {
+		*(RECT*) pv = headless.monitors[0].rc_work;
+		return TRUE;
+	}
+	if (action == SPI_GETHIGHCONTRAST) {
+		((HIGHCONTRAST*) pv)->dwFlags = headless.high_contrast ? HCF_HIGHCONTRASTON : 0;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* advapi32, only the app mode (light/dark) value exists */
+SHIM LONG RegOpenKeyEx(HKEY key, LPCSTR subkey, DWORD options, DWORD sam, HKEY *result) {
+	(void) options; (void) sam;
+	if (key != HKEY_CURRENT_USER || strcmp(subkey, "Software\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize") != 0) {
+		return ERROR_FILE_NOT_FOUND;
+	}
+	*result = (HKEY) &headless.light_theme;
+	return ERROR_SUCCESS;
+}
+
+SHIM LONG RegQueryValueEx(HKEY key, LPCSTR name, DWORD *reserved, DWORD *type, BYTE *data, DWORD *size) {
+	(void) reserved;
+	headless_init();
+	if (key != (HKEY) &headless.light_theme || name == NULL || strcmp(name, "AppsUseLightTheme") != 0) {
+		return ERROR_FILE_NOT_FOUND;
+	}
+	if (type != NULL) {
+		*type = REG_DWORD;
+	}
+	if (data != NULL && size != NULL && *size >= sizeof(DWORD)) {
+		*(DWORD*) data = headless.light_theme;
+	}
+	if (size != NULL) {
+		*size = sizeof(DWORD);
+	}
+	return ERROR_SUCCESS;
+}
+
+SHIM LONG RegCloseKey(HKEY key) {
+	(void) key;
+	return ERROR_SUCCESS;
+}
+
+/* shell32 */
+SHIM UINT_PTR SHAppBarMessage(DWORD msg, APPBARDATA *abd) {
+	headless_init();
+	headless.appbar_calls++;
+	if ((msg == ABM_GETAUTOHIDEBAR || msg == ABM_GETAUTOHIDEBAREX) && abd->uEdge <= ABE_BOTTOM) {
+		return headless.autohide[abd->uEdge] ? (UINT_PTR) &headless.autohide[abd->uEdge] : 0;
+	}
+	return 0;
+}
+
+/* ------------------------------- user32: windows ------------------------------- */
+
+SHIM BOOL DestroyWindow(HWND hwnd);
+SHIM BOOL ShowWindow(HWND hwnd, int cmd);
+
+static LRESULT headless_call(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+	UINT64 start = headless_now_ns();
+	LRESULT result = hwnd->cls->proc(hwnd, msg, wparam, lparam);
+	HeadlessMessageStat *stat = &headless.stats[msg < HEADLESS_STAT_MESSAGES ? msg : HEADLESS_STAT_MESSAGES];
+	stat->count++;
+	stat->total_ns += headless_now_ns() - start;
+	return result;
+}
+
+SHIM BOOL IsWindow(HWND hwnd) {
+	for (HWND w = headless.windows; w != NULL; w = w->next) {
+		if (w == hwnd) {
+			return !w->destroyed;
+		}
+	}
+	return FALSE;
+}
+
+SHIM LRESULT SendMessage(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+	if (hwnd == NULL || hwnd->destroyed) {
+		return 0;
+	}
+	return headless_call(hwnd, msg, wparam, lparam);
+}
+
+SHIM BOOL PostMessage(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+	pthread_mutex_lock(&headless.queue_mutex);
+	size_t next = (headless.queue_tail + 1) % HEADLESS_QUEUE_SIZE;
+	if (next == headless.queue_head) {
+		pthread_mutex_unlock(&headless.queue_mutex);
+		return FALSE;						/* like the 10000 message quota, the queue is bounded */
+	}
+	headless.queue[headless.queue_tail] = (MSG) { hwnd, msg, wparam, lparam, GetTickCount(), headless.cursor_pos };
+	headless.queue_tail = next;
+	pthread_cond_signal(&headless.queue_cond);
+	pthread_mutex_unlock(&headless.queue_mutex);
+	return TRUE;
+}
+
+SHIM void PostQuitMessage(int code) {
+	pthread_mutex_lock(&headless.queue_mutex);
+	headless.quit = true;
+	headless.quit_code = code;
+	pthread_cond_signal(&headless.queue_cond);
+	pthread_mutex_unlock(&headless.queue_mutex);
+}
+
+static bool headless_take_message(MSG *msg, bool remove) {
+	if (headless.queue_head != headless.queue_tail) {
+		*msg = headless.queue[headless.queue_head];
+		if (remove) {
+			headless.queue_head = (headless.queue_head + 1) % HEADLESS_QUEUE_SIZE;
+		}
+		return true;
+	}
+	if (headless.quit) {
+		*msg = (MSG) { NULL, WM_QUIT, (WPARAM) headless.quit_code, 0, 0, { 0, 0 } };
+		if (remove) {
+			headless.quit = false;
+		}
+		return true;
+	}
+	for (HWND w = headless.windows; w != NULL; w = w->next) {
+		if (w->has_invalid && !w->destroyed) {
+			*msg = (MSG) { w, WM_PAINT, 0, 0, 0, { 0, 0 } };
+			return true;
+		}
+	}
+	return false;
+}
+
+SHIM BOOL PeekMessage(MSG *msg, HWND hwnd, UINT min, UINT max, UINT remove) {
+	(void) hwnd; (void) min; (void) max;
+	pthread_mutex_lock(&headless.queue_mutex);
+	bool found = headless_take_message(msg, remove & PM_REMOVE);
+	pthread_mutex_unlock(&headless.queue_mutex);
+	return found;
+}
+
+SHIM BOOL GetMessage(MSG *msg, HWND hwnd, UINT min, UINT max) {
+	(void) hwnd; (void) min; (void) max;
+	pthread_mutex_lock(&headless.queue_mutex);
+	while (!headless_take_message(msg, true)) {
+		pthread_cond_wait(&headless.queue_cond, &headless.queue_mutex);
+	}
+	pthread_mutex_unlock(&headless.queue_mutex);
+	return msg->message != WM_QUIT;
+}
+
+SHIM DWORD MsgWaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL wait_all, DWORD ms, DWORD wake_mask) {
+	(void) wait_all; (void) wake_mask;
+	UINT64 deadline = headless_now_ns() + (UINT64) ms * 1000000ull;
+	for (;;) {
+		for (DWORD i = 0; i < count; i++) {
+			if (WaitForSingleObject(handles[i], 0) == WAIT_OBJECT_0) {
+				return WAIT_OBJECT_0 + i;
+			}
+		}
+		MSG msg;
+		if (PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE)) {
+			return WAIT_OBJECT_0 + count;
+		}
+		if (ms != INFINITE && headless_now_ns() >= deadline) {
+			return WAIT_TIMEOUT;
+		}
+		Sleep(1);
+	}
+}
+
+SHIM BOOL TranslateMessage(const MSG *msg) {
+	(void) msg;
+	return FALSE;
+}
+
+SHIM LRESULT DispatchMessage(const MSG *msg) {
+	if (msg->hwnd == NULL || !IsWindow(msg->hwnd)) {
+		return 0;
+	}
+	return headless_call(msg->hwnd, msg->message, msg->wParam, msg->lParam);
+}
+
+SHIM ATOM RegisterClassEx(const WNDCLASSEX *wc) {
+	headless_init();
+	int free_slot = -1;
+	for (int i = 0; i < (int) (sizeof(headless.classes)/sizeof(*headless.classes)); i++) {
+		if (headless.classes[i].used && strcmp(headless.classes[i].name, wc->lpszClassName) == 0) {
+			headless.last_error = ERROR_ALREADY_EXISTS;
+			return 0;
+		}
+		if (!headless.classes[i].used && free_slot < 0) {
+			free_slot = i;
+		}
+	}
+	if (free_slot < 0) {
+		return 0;
+	}
+	ShimClass *cls = &headless.classes[free_slot];
+	snprintf(cls->name, sizeof(cls->name), "%s", wc->lpszClassName);
+	cls->proc = wc->lpfnWndProc;
+	cls->style = wc->style;
+	cls->icon = wc->hIconSm;
+	cls->used = true;
+	return (ATOM) (free_slot + 1);
+}
+
+SHIM UINT RegisterWindowMessage(LPCSTR name) {
+	for (int i = 0; i < headless.window_message_count; i++) {
+		if (strcmp(headless.window_messages[i], name) == 0) {
+			return 0xC000 + i;
+		}
+	}
+	if (headless.window_message_count == (int) (sizeof(headless.window_messages)/sizeof(*headless.window_messages))) {
+		return 0;
+	}
+	snprintf(headless.window_messages[headless.window_message_count], sizeof(*headless.window_messages), "%s", name);
+	return 0xC000 + headless.window_message_count++;
+}
+
+SHIM BOOL UnregisterClass(LPCSTR name, HINSTANCE instance) {
+	(void) instance;
+	for (int i = 0; i < (int) (sizeof(headless.classes)/sizeof(*headless.classes)); i++) {
+		if (headless.classes[i].used && strcmp(headless.classes[i].name, name) == 0) {
+			headless.classes[i].used = false;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+SHIM int GetClassName(HWND hwnd, LPSTR buffer, int size) {
+	return snprintf(buffer, (size_t) size, "%s", hwnd->cls->name);
+}
+
+#define GetClassLongPtr GetClassLongPtrA
+SHIM ULONG_PTR GetClassLongPtrA(HWND hwnd, int index) {
+	return index == GCLP_HICONSM ? (ULONG_PTR) hwnd->cls->icon : 0;
+}
+
+SHIM HICON LoadIcon(HINSTANCE instance, LPCSTR name) {
+	(void) instance; (void) name;
+	return &headless_app_icon;
+}
+
+SHIM HCURSOR LoadCursor(HINSTANCE instance, LPCSTR name) {
+	(void) instance; (void) name;
+	return &headless_cursor;
+}
+
+SHIM HCURSOR SetCursor(HCURSOR cursor) {
+	return cursor;
+}
+
+SHIM BOOL GetCursorPos(POINT *pt) {
+	*pt = headless.cursor_pos;
+	return TRUE;
+}
+
+static void headless_resize_framebuffer(HWND hwnd) {
+	int width = hwnd->rect.right - hwnd->rect.left, height = hwnd->rect.bottom - hwnd->rect.top;
+	if (width == hwnd->fb_width && height == hwnd->fb_height) {
+		return;
+	}
+	free(hwnd->pixels);
+	hwnd->fb_width = width > 0 ? width : 0;
+	hwnd->fb_height = height > 0 ? height : 0;
+	hwnd->pixels = (UINT32*) calloc((size_t) hwnd->fb_width * hwnd->fb_height + 1, sizeof(UINT32));
+	assert(hwnd->pixels != NULL);
+}
+
+SHIM BOOL InvalidateRect(HWND hwnd, const RECT *r, BOOL erase) {
+	if (hwnd == NULL || hwnd->destroyed) {
+		return FALSE;
+	}
+	headless.invalidate_calls++;
+	RECT full = { 0, 0, hwnd->rect.right - hwnd->rect.left, hwnd->rect.bottom - hwnd->rect.top };
+	RECT area = full;
+	if (r != NULL && !IntersectRect(&area, r, &full)) {
+		return TRUE;
+	}
+	if (hwnd->has_invalid) {
+		UnionRect(&hwnd->invalid, &hwnd->invalid, &area);
+	}
+	else {
+		hwnd->invalid = area;
+		hwnd->has_invalid = !IsRectEmpty(&area);
+	}
+	hwnd->erase |= erase;
+	return TRUE;
+}
+
+SHIM BOOL ValidateRect(HWND hwnd, const RECT *r) {
+	(void) r;
+	hwnd->has_invalid = false;
+	return TRUE;
+}
+
+SHIM BOOL GetUpdateRect(HWND hwnd, RECT *r, BOOL erase) {
+	(void) erase;
+	if (r != NULL) {
+		*r = hwnd->has_invalid ? hwnd->invalid : (RECT) { 0, 0, 0, 0 };
+	}
+	return hwnd->has_invalid;
+}
+
+SHIM BOOL UpdateWindow(HWND hwnd) {
+	if (hwnd->has_invalid) {
+		SendMessage(hwnd, WM_PAINT, 0, 0);
+	}
+	return TRUE;
+}
+
+SHIM BOOL RedrawWindow(HWND hwnd, const RECT *r, HANDLE rgn, UINT flags) {
+	(void) rgn;
+	if (flags & RDW_INVALIDATE) {
+		InvalidateRect(hwnd, r, !!(flags & RDW_ERASE));
+	}
+	if (flags & RDW_UPDATENOW) {
+		UpdateWindow(hwnd);
+	}
+	return TRUE;
+}
+
+SHIM HDC BeginPaint(HWND hwnd, PAINTSTRUCT *ps) {
+	memset(ps, 0, sizeof(*ps));
+	ps->hdc = &hwnd->dc;
+	ps->rcPaint = hwnd->has_invalid ? hwnd->invalid : (RECT) { 0, 0, 0, 0 };
+	ps->fErase = hwnd->erase;
+	hwnd->has_invalid = false;
+	hwnd->erase = false;
+	hwnd->dc.clip = ps->rcPaint;
+	hwnd->dc.has_clip = true;
+	return ps->hdc;
+}
+
+SHIM BOOL EndPaint(HWND hwnd, const PAINTSTRUCT *ps) {
+	(void) ps;
+	hwnd->dc.has_clip = false;
+	headless.presents++;
+	return TRUE;
+}
+
+SHIM HDC GetDC(HWND hwnd) {
+	static ShimDC screen_dc;
+	if (hwnd == NULL) {
+		headless_init_dc(&screen_dc);
+		return &screen_dc;
+	}
+	return &hwnd->dc;
+}
+
+SHIM int ReleaseDC(HWND hwnd, HDC hdc) {
+	(void) hwnd; (void) hdc;
+	return 1;
+}
+
+SHIM BOOL GetWindowRect(HWND hwnd, RECT *r) {
+	*r = hwnd->rect;
+	return TRUE;
+}
+
+SHIM BOOL GetClientRect(HWND hwnd, RECT *r) {
+	*r = (RECT) { 0, 0, hwnd->client.right - hwnd->client.left, hwnd->client.bottom - hwnd->client.top };
+	return TRUE;
+}
+
+SHIM int MapWindowPoints(HWND from, HWND to, POINT *pts, UINT count) {
+	long dx = 0, dy = 0;
+	if (from != NULL) {
+		dx += from->rect.left + from->client.left;
+		dy += from->rect.top + from->client.top;
+	}
+	if (to != NULL) {
+		dx -= to->rect.left + to->client.left;
+		dy -= to->rect.top + to->client.top;
+	}
+	for (UINT i = 0; i < count; i++) {
+		pts[i].x += dx;
+		pts[i].y += dy;
+	}
+	return (int) MAKELONG(dx, dy);
+}
+
+SHIM BOOL ScreenToClient(HWND hwnd, POINT *pt) {
+	MapWindowPoints(NULL, hwnd, pt, 1);
+	return TRUE;
+}
+
+SHIM BOOL ClientToScreen(HWND hwnd, POINT *pt) {
+	MapWindowPoints(hwnd, NULL, pt, 1);
+	return TRUE;
+}
+
+SHIM BOOL IsZoomed(HWND hwnd) { return !!(hwnd->style & WS_MAXIMIZE); }
+SHIM BOOL IsIconic(HWND hwnd) { return !!(hwnd->style & WS_MINIMIZE); }
+SHIM BOOL IsWindowVisible(HWND hwnd) { return !!(hwnd->style & WS_VISIBLE); }
+SHIM HWND GetFocus(void) { return headless.focus; }
+SHIM HWND GetActiveWindow(void) { return headless.active; }
+SHIM HWND GetForegroundWindow(void) { return headless.active; }
+SHIM HWND GetCapture(void) { return headless.capture; }
+
+SHIM HWND SetCapture(HWND hwnd) {
+	HWND old = headless.capture;
+	headless.capture = hwnd;
+	return old;
+}
+
+SHIM BOOL ReleaseCapture(void) {
+	HWND old = headless.capture;
+	headless.capture = NULL;
+	if (old != NULL) {
+		SendMessage(old, WM_CAPTURECHANGED, 0, 0);
+	}
+	return TRUE;
+}
+
+SHIM HWND SetFocus(HWND hwnd) {
+	HWND old = headless.focus;
+	if (old == hwnd) {
+		return old;
+	}
+	headless.focus = hwnd;
+	if (old != NULL) {
+		SendMessage(old, WM_KILLFOCUS, (WPARAM) hwnd, 0);
+	}
+	if (hwnd != NULL) {
+		SendMessage(hwnd, WM_SETFOCUS, (WPARAM) old, 0);
+	}
+	return old;
+}
+
+SHIM HWND SetActiveWindow(HWND hwnd) {
+	HWND old = headless.active;
+	if (old == hwnd) {
+		return old;
+	}
+	headless.active = hwnd;
+	if (old != NULL && !old->destroyed) {
+		SendMessage(old, WM_NCACTIVATE, FALSE, 0);
+		SendMessage(old, WM_ACTIVATE, WA_INACTIVE, (LPARAM) hwnd);
+	}
+	if (hwnd != NULL) {
+		SendMessage(hwnd, WM_NCACTIVATE, TRUE, 0);
+		SendMessage(hwnd, WM_ACTIVATE, WA_ACTIVE, (LPARAM) old);
+	}
+	SetFocus(hwnd);
+	return old;
+}
+
+SHIM BOOL SetForegroundWindow(HWND hwnd) {
+	SetActiveWindow(hwnd);
+	return TRUE;
+}
+
+SHIM LONG_PTR GetWindowLongPtr(HWND hwnd, int index) {
+	switch (index) {
+		case GWLP_USERDATA: return hwnd->user_data;
+		case GWL_STYLE: return (LONG_PTR) hwnd->style;
+		case GWL_EXSTYLE: return (LONG_PTR) hwnd->ex_style;
+		default: return 0;
+	}
+}
+
+SHIM LONG_PTR SetWindowLongPtr(HWND hwnd, int index, LONG_PTR value) {
+	LONG_PTR old = GetWindowLongPtr(hwnd, index);
+	switch (index) {
+		case GWLP_USERDATA: hwnd->user_data = value; break;
+		case GWL_STYLE: hwnd->style = (DWORD) value; break;
+		case GWL_EXSTYLE: hwnd->ex_style = (DWORD) value; break;
+	}
+	return old;
+}
+
+SHIM int GetWindowTextLength(HWND hwnd) {
+	return (int) SendMessage(hwnd, WM_GETTEXTLENGTH, 0, 0);
+}
+
+SHIM int GetWindowText(HWND hwnd, LPSTR buffer, int size) {
+	return (int) SendMessage(hwnd, WM_GETTEXT, (WPARAM) size, (LPARAM) buffer);
+}
+
+SHIM BOOL SetWindowText(HWND hwnd, LPCSTR text) {
+	return (BOOL) SendMessage(hwnd, WM_SETTEXT, 0, (LPARAM) text);
+}
+
+SHIM BOOL SetWindowPos(HWND hwnd, HWND after, int x, int y, int cx, int cy, UINT flags) {
+	WINDOWPOS wpos = { hwnd, after, x, y, cx, cy, flags };
+	if (flags & SWP_NOMOVE) {
+		wpos.x = hwnd->rect.left;
+		wpos.y = hwnd->rect.top;
+	}
+	if (flags & SWP_NOSIZE) {
+		wpos.cx = hwnd->rect.right - hwnd->rect.left;
+		wpos.cy = hwnd->rect.bottom - hwnd->rect.top;
+	}
+	if (!(flags & SWP_NOSENDCHANGING)) {
+		SendMessage(hwnd, WM_WINDOWPOSCHANGING, 0, (LPARAM) &wpos);
+	}
+	RECT new_rect = { wpos.x, wpos.y, wpos.x + wpos.cx, wpos.y + wpos.cy };
+	bool moved = new_rect.left != hwnd->rect.left || new_rect.top != hwnd->rect.top;
+	bool sized = (new_rect.right - new_rect.left) != (hwnd->rect.right - hwnd->rect.left)
+				|| (new_rect.bottom - new_rect.top) != (hwnd->rect.bottom - hwnd->rect.top);
+	if (!moved) wpos.flags |= SWP_NOMOVE;
+	if (!sized) wpos.flags |= SWP_NOSIZE;
+	if (sized || (wpos.flags & SWP_FRAMECHANGED)) {
+		NCCALCSIZE_PARAMS params = { { new_rect, hwnd->rect, hwnd->rect }, &wpos };
+		OffsetRect(&params.rgrc[2], hwnd->client.left, hwnd->client.top);
+		SendMessage(hwnd, WM_NCCALCSIZE, TRUE, (LPARAM) &params);
+		hwnd->client = params.rgrc[0];
+		OffsetRect(&hwnd->client, -new_rect.left, -new_rect.top);
+	}
+	hwnd->rect = new_rect;
+	if (wpos.flags & SWP_SHOWWINDOW) hwnd->style |= WS_VISIBLE;
+	if (wpos.flags & SWP_HIDEWINDOW) hwnd->style &= ~WS_VISIBLE;
+	if (sized) {
+		headless_resize_framebuffer(hwnd);
+	}
+	if ((sized || (wpos.flags & (SWP_FRAMECHANGED | SWP_SHOWWINDOW))) && !(wpos.flags & SWP_NOREDRAW)) {
+		InvalidateRect(hwnd, NULL, TRUE);
+	}
+	SendMessage(hwnd, WM_WINDOWPOSCHANGED, 0, (LPARAM) &wpos);
+	return TRUE;
+}
+
+SHIM BOOL MoveWindow(HWND hwnd, int x, int y, int cx, int cy, BOOL repaint) {
+	return SetWindowPos(hwnd, NULL, x, y, cx, cy, SWP_NOZORDER | SWP_NOACTIVATE | (repaint ? 0 : SWP_NOREDRAW));
+}
+
+static RECT headless_maximized_rect(HWND hwnd) {
+	MONITORINFO mi = { .cbSize = sizeof(MONITORINFO) };
+	GetMonitorInfo(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST), &mi);
+	RECT r = mi.rcWork;
+	if (hwnd->style & WS_THICKFRAME) {
+		/* like user32, overhang the work area by the sizing frame */
+		InflateRect(&r, GetSystemMetrics(SM_CXFRAME) + GetSystemMetrics(SM_CXPADDEDBORDER),
+					GetSystemMetrics(SM_CYFRAME) + GetSystemMetrics(SM_CXPADDEDBORDER));
+	}
+	return r;
+}
+
+SHIM BOOL ShowWindow(HWND hwnd, int cmd) {
+	bool was_visible = !!(hwnd->style & WS_VISIBLE);
+	switch (cmd) {
+		case SW_HIDE:
+			SetWindowPos(hwnd, NULL, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_HIDEWINDOW);
+			break;
+		case SW_MAXIMIZE: {
+			if (!(hwnd->style & (WS_MAXIMIZE | WS_MINIMIZE))) {
+				hwnd->normal = hwnd->rect;
+			}
+			hwnd->style = (hwnd->style | WS_MAXIMIZE) & ~WS_MINIMIZE;
+			RECT r = headless_maximized_rect(hwnd);
+			SetWindowPos(hwnd, NULL, r.left, r.top, r.right - r.left, r.bottom - r.top,
+						SWP_NOZORDER | SWP_FRAMECHANGED | SWP_SHOWWINDOW | SWP_STATECHANGED);
+			SendMessage(hwnd, WM_SIZE, SIZE_MAXIMIZED, MAKELPARAM(r.right - r.left, r.bottom - r.top));
+			SetActiveWindow(hwnd);
+			break;
+		}
+		case SW_MINIMIZE:
+		case SW_SHOWMINIMIZED:
+		case SW_SHOWMINNOACTIVE:
+			if (!(hwnd->style & (WS_MAXIMIZE | WS_MINIMIZE))) {
+				hwnd->normal = hwnd->rect;
+			}
+			if (!(hwnd->style & WS_MINIMIZE)) {
+				hwnd->is_restore_maximized = !!(hwnd->style & WS_MAXIMIZE);
+			}
+			hwnd->style = (hwnd->style | WS_MINIMIZE) & ~WS_MAXIMIZE;	/* not zoomed while iconic, as user32 */
+			SetWindowPos(hwnd, NULL, -32000, -32000, 160, 28, SWP_NOZORDER | SWP_FRAMECHANGED | SWP_NOACTIVATE | SWP_STATECHANGED);
+			SendMessage(hwnd, WM_SIZE, SIZE_MINIMIZED, 0);
+			if (headless.active == hwnd) {
+				SetActiveWindow(NULL);
+			}
+			break;
+		case SW_RESTORE:
+		case SW_SHOWNORMAL:
+			if ((hwnd->style & WS_MINIMIZE) && hwnd->is_restore_maximized && cmd == SW_RESTORE) {
+				hwnd->is_restore_maximized = false;
+				ShowWindow(hwnd, SW_MAXIMIZE);		/* still iconic, so the normal rect is kept */
+				break;
+			}
+			hwnd->is_restore_maximized = false;
+			if (hwnd->style & (WS_MAXIMIZE | WS_MINIMIZE)) {
+				hwnd->style &= ~(WS_MAXIMIZE | WS_MINIMIZE);
+				RECT r = hwnd->normal;
+				SetWindowPos(hwnd, NULL, r.left, r.top, r.right - r.left, r.bottom - r.top,
+							SWP_NOZORDER | SWP_FRAMECHANGED | SWP_SHOWWINDOW | SWP_STATECHANGED);
+				SendMessage(hwnd, WM_SIZE, SIZE_RESTORED, MAKELPARAM(r.right - r.left, r.bottom - r.top));
+			}
+			else if (!was_visible) {
+				SetWindowPos(hwnd, NULL, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_SHOWWINDOW);
+			}
+			SetActiveWindow(hwnd);
+			break;
+		default:
+			if (!was_visible) {
+				SendMessage(hwnd, WM_SHOWWINDOW, TRUE, 0);
+				SetWindowPos(hwnd, NULL, 0, 0, 0, 0, SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_SHOWWINDOW);
+			}
+			if (cmd != SW_SHOWNA && cmd != SW_SHOWNOACTIVATE && !(hwnd->ex_style & WS_EX_NOACTIVATE)) {
+				SetActiveWindow(hwnd);
+			}
+			break;
+	}
+	return was_visible;
+}
+
+SHIM BOOL GetWindowPlacement(HWND hwnd, WINDOWPLACEMENT *wp) {
+	wp->flags = (hwnd->style & WS_MINIMIZE) && hwnd->is_restore_maximized ? WPF_RESTORETOMAXIMIZED : 0;
+	wp->showCmd = IsZoomed(hwnd) ? SW_SHOWMAXIMIZED : (IsIconic(hwnd) ? SW_SHOWMINIMIZED : SW_SHOWNORMAL);
+	wp->rcNormalPosition = (hwnd->style & (WS_MAXIMIZE | WS_MINIMIZE)) ? hwnd->normal : hwnd->rect;
+	wp->ptMinPosition = (POINT) { -1, -1 };
+	wp->ptMaxPosition = (POINT) { -1, -1 };
+	return TRUE;
+}
+
+SHIM BOOL SetWindowPlacement(HWND hwnd, const WINDOWPLACEMENT *wp) {
+	hwnd->normal = wp->rcNormalPosition;
+	if (!(hwnd->style & (WS_MAXIMIZE | WS_MINIMIZE)) && wp->showCmd != SW_SHOWMAXIMIZED) {
+		RECT r = wp->rcNormalPosition;
+		SetWindowPos(hwnd, NULL, r.left, r.top, r.right - r.left, r.bottom - r.top, SWP_NOZORDER | SWP_NOACTIVATE);
+	}
+	if (wp->showCmd == SW_SHOWMAXIMIZED && !(hwnd->style & WS_MAXIMIZE)) {
+		ShowWindow(hwnd, SW_MAXIMIZE);
+	}
+	return TRUE;
+}
+
+SHIM HMENU GetSystemMenu(HWND hwnd, BOOL revert) {
+	(void) revert;
+	if (hwnd->sysmenu == NULL) {
+		hwnd->sysmenu = (HMENU) calloc(1, sizeof(ShimMenu));
+		assert(hwnd->sysmenu != NULL);
+		UINT ids[] = { SC_RESTORE, SC_MOVE, SC_SIZE, SC_MINIMIZE, SC_MAXIMIZE, SC_CLOSE };
+		const char *text[] = { "&Restore", "&Move", "&Size", "Mi&nimize", "Ma&ximize", "&Close\tAlt+F4" };
+		for (int i = 0; i < 6; i++) {
+			hwnd->sysmenu->ids[i] = ids[i];
+			hwnd->sysmenu->text[i] = text[i];
+		}
+		hwnd->sysmenu->count = 6;
+		headless.user_objects++;
+	}
+	return hwnd->sysmenu;
+}
+
+SHIM BOOL EnableMenuItem(HMENU menu, UINT id, UINT enable) {
+	headless.menu_calls++;
+	for (int i = 0; i < menu->count; i++) {
+		if (menu->ids[i] == id) {
+			UINT old = menu->enabled_state[i];
+			menu->enabled_state[i] = enable;
+			return (BOOL) old;
+		}
+	}
+	return -1;
+}
+
+SHIM int GetMenuItemCount(HMENU menu) {
+	return menu->count;
+}
+
+SHIM UINT GetMenuItemID(HMENU menu, int position) {
+	return position >= 0 && position < menu->count ? menu->ids[position] : (UINT) -1;
+}
+
+static int headless_menu_index(HMENU menu, UINT item, UINT flags) {
+	if (flags & MF_BYPOSITION) {
+		return (int) item < menu->count ? (int) item : -1;
+	}
+	for (int i = 0; i < menu->count; i++) {
+		if (menu->ids[i] == item) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+SHIM int GetMenuString(HMENU menu, UINT item, LPSTR text, int max, UINT flags) {
+	int i = headless_menu_index(menu, item, flags);
+	if (i < 0 || menu->text[i] == NULL) {
+		return 0;
+	}
+	snprintf(text, max, "%s", menu->text[i]);
+	return (int) strlen(text);
+}
+
+SHIM UINT GetMenuState(HMENU menu, UINT item, UINT flags) {
+	int i = headless_menu_index(menu, item, flags);
+	return i < 0 ? (UINT) -1 : menu->enabled_state[i];
+}
+
+SHIM int TrackPopupMenuEx(HMENU menu, UINT flags, int x, int y, HWND hwnd, LPVOID params) {
+	(void) flags; (void) x; (void) y; (void) params;
+	SendMessage(hwnd, WM_INITMENUPOPUP, (WPARAM) menu, MAKELPARAM(0, TRUE));
+	return 0;								/* the popup is dismissed immediately */
+}
+
+SHIM BOOL TrackMouseEvent(TRACKMOUSEEVENT *tme) {
+	tme->hwndTrack->track_leave = !(tme->dwFlags & TME_CANCEL);
+	return TRUE;
+}
+
+SHIM BOOL EnumThreadWindows(DWORD thread, WNDENUMPROC proc, LPARAM lparam) {
+	(void) thread;
+	for (HWND w = headless.windows, next; w != NULL; w = next) {
+		next = w->next;
+		if (!w->destroyed && !proc(w, lparam)) {
+			break;
+		}
+	}
+	return TRUE;
+}
+
+SHIM DWORD GetGuiResources(HANDLE process, DWORD flags) {
+	(void) process;
+	return (DWORD) (flags == GR_GDIOBJECTS ? headless.gdi_objects : headless.user_objects);
+}
+
+static LRESULT headless_def_hittest(HWND hwnd, LPARAM lparam) {
+	POINT pt = { (short) LOWORD(lparam), (short) HIWORD(lparam) };
+	return PtInRect(&hwnd->rect, pt) ? HTCLIENT : HTNOWHERE;
+}
+
+SHIM LRESULT DefWindowProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+	switch (msg) {
+		case WM_NCCREATE: return TRUE;
+		case WM_NCHITTEST: return headless_def_hittest(hwnd, lparam);
+		case WM_NCACTIVATE: return TRUE;
+		case WM_ERASEBKGND: return 1;
+		case WM_CLOSE: DestroyWindow(hwnd); return 0;
+		case WM_GETTEXTLENGTH: return (LRESULT) strlen(hwnd->text);
+		case WM_GETTEXT: {
+			if (wparam == 0) {
+				return 0;
+			}
+			int n = snprintf((char*) lparam, wparam, "%s", hwnd->text);
+			return n < (int) wparam ? n : (int) wparam - 1;
+		}
+		case WM_SETTEXT: {
+			snprintf(hwnd->text, sizeof(hwnd->text), "%s", lparam ? (const char*) lparam : "");
+			return TRUE;
+		}
+		case WM_PAINT: {
+			PAINTSTRUCT ps;
+			BeginPaint(hwnd, &ps);
+			EndPaint(hwnd, &ps);
+			return 0;
+		}
+		case WM_WINDOWPOSCHANGED: {
+			WINDOWPOS *wpos = (WINDOWPOS*) lparam;
+			if (!(wpos->flags & SWP_NOSIZE)) {
+				SendMessage(hwnd, WM_SIZE, IsZoomed(hwnd) ? SIZE_MAXIMIZED : SIZE_RESTORED, MAKELPARAM(wpos->cx, wpos->cy));
+			}
+			if (!(wpos->flags & SWP_NOMOVE)) {
+				SendMessage(hwnd, WM_MOVE, 0, MAKELPARAM(wpos->x, wpos->y));
+			}
+			return 0;
+		}
+		case WM_SYSCOMMAND: {
+			switch (wparam & 0xFFF0) {
+				case SC_CLOSE: SendMessage(hwnd, WM_CLOSE, 0, 0); break;
+				case SC_MAXIMIZE: ShowWindow(hwnd, SW_MAXIMIZE); break;
+				case SC_MINIMIZE: ShowWindow(hwnd, SW_MINIMIZE); break;
+				case SC_RESTORE: ShowWindow(hwnd, SW_RESTORE); break;
+			}
+			return 0;
+		}
+		case WM_NCLBUTTONDOWN: {
+			if (wparam == HTSYSMENU) {
+				SendMessage(hwnd, WM_SYSCOMMAND, SC_MOUSEMENU, lparam);
+			}
+			return 0;
+		}
+		case WM_NCLBUTTONDBLCLK: {
+			if (wparam == HTCAPTION) {
+				SendMessage(hwnd, WM_SYSCOMMAND, IsZoomed(hwnd) ? SC_RESTORE : SC_MAXIMIZE, lparam);
+			}
+			return 0;
+		}
+		case WM_SYSKEYDOWN: {
+			/* as WM_SYSCHAR would */
+			if (wparam == VK_SPACE || (wparam >= '0' && wparam <= '9') || (wparam >= 'A' && wparam <= 'Z')) {
+				SendMessage(hwnd, WM_SYSCOMMAND, SC_KEYMENU, wparam == VK_SPACE ? ' ' : (LPARAM) tolower((int) wparam));
+			}
+			return 0;
+		}
+		case WM_SYSKEYUP: {
+			/* Alt or F10 released alone enters the menu mode */
+			if (wparam == VK_MENU || wparam == VK_F10) {
+				SendMessage(hwnd, WM_SYSCOMMAND, SC_KEYMENU, 0);
+			}
+			return 0;
+		}
+		default: return 0;
+	}
+}
+
+SHIM HWND CreateWindowEx(DWORD ex_style, LPCSTR class_name, LPCSTR title, DWORD style, int x, int y, int cx, int cy,
+						HWND parent, HMENU menu, HINSTANCE instance, LPVOID param) {
+	(void) parent; (void) menu; (void) instance;
+	headless_init();
+	ShimClass *cls = NULL;
+	for (int i = 0; i < (int) (sizeof(headless.classes)/sizeof(*headless.classes)); i++) {
+		if (headless.classes[i].used && strcmp(headless.classes[i].name, class_name) == 0) {
+			cls = &headless.classes[i];
+		}
+	}
+	if (cls == NULL) {
+		headless.last_error = ERROR_FILE_NOT_FOUND;
+		return NULL;
+	}
+	HWND hwnd = (HWND) calloc(1, sizeof(ShimWindow));
+	assert(hwnd != NULL);
+	hwnd->cls = cls;
+	hwnd->style = style & ~WS_VISIBLE;
+	hwnd->ex_style = ex_style;
+	snprintf(hwnd->text, sizeof(hwnd->text), "%s", title ? title : "");
+	RECT work = headless.monitors[0].rc_work;
+	if (x == CW_USEDEFAULT) {
+		int cascade = (headless.window_count % 10) * 26;
+		x = work.left + 26 + cascade;
+		y = work.top + 26 + cascade;
+	}
+	if (cx == CW_USEDEFAULT) {
+		cx = (work.right - work.left)*3/4;
+		cy = (work.bottom - work.top)*3/4;
+	}
+	hwnd->rect = (RECT) { x, y, x + cx, y + cy };
+	hwnd->client = (RECT) { 0, 0, cx, cy };
+	hwnd->normal = hwnd->rect;
+	headless_init_dc(&hwnd->dc);
+	hwnd->dc.window = hwnd;
+	headless_resize_framebuffer(hwnd);
+	hwnd->next = headless.windows;
+	headless.windows = hwnd;
+	headless.window_count++;
+	headless.user_objects++;
+
+	CREATESTRUCT cs = { param, instance, menu, parent, cy, cx, y, x, (LONG) style, title, class_name, ex_style };
+	SendMessage(hwnd, WM_NCCREATE, 0, (LPARAM) &cs);
+	NCCALCSIZE_PARAMS params = { { hwnd->rect, hwnd->rect, hwnd->rect }, NULL };
+	SendMessage(hwnd, WM_NCCALCSIZE, FALSE, (LPARAM) &params.rgrc[0]);
+	if (SendMessage(hwnd, WM_CREATE, 0, (LPARAM) &cs) == -1) {
+		DestroyWindow(hwnd);
+		return NULL;
+	}
+	if (style & WS_VISIBLE) {
+		ShowWindow(hwnd, (style & WS_MAXIMIZE) ? SW_MAXIMIZE : SW_SHOW);
+	}
+	return hwnd;
+}
+
+#define CreateWindow(cls, title, style, x, y, cx, cy, parent, menu, instance, param) \
+	CreateWindowEx(0, cls, title, style, x, y, cx, cy, parent, menu, instance, param)
+
+SHIM BOOL DestroyWindow(HWND hwnd) {
+	if (hwnd == NULL || hwnd->destroyed) {
+		return FALSE;
+	}
+	if (headless.active == hwnd) {
+		SetActiveWindow(NULL);
+	}
+	if (headless.capture == hwnd) {
+		headless.capture = NULL;
+	}
+	SendMessage(hwnd, WM_DESTROY, 0, 0);
+	SendMessage(hwnd, WM_NCDESTROY, 0, 0);
+	hwnd->destroyed = true;
+
+	pthread_mutex_lock(&headless.queue_mutex);
+	for (size_t i = headless.queue_head; i != headless.queue_tail; i = (i + 1) % HEADLESS_QUEUE_SIZE) {
+		if (headless.queue[i].hwnd == hwnd) {
+			headless.queue[i].hwnd = NULL;
+		}
+	}
+	pthread_mutex_unlock(&headless.queue_mutex);
+
+	HWND *link = &headless.windows;
+	while (*link != hwnd) {
+		link = &(*link)->next;
+	}
+	*link = hwnd->next;
+	headless.window_count--;
+	headless.user_objects--;
+	if (hwnd->sysmenu != NULL) {
+		free(hwnd->sysmenu);
+		headless.user_objects--;
+	}
+	free(hwnd->pixels);
+	free(hwnd);
+	return TRUE;
+}
+
+/* ------------------------------- synthetic input ------------------------------- */
+
+/* Route a pointer move at screen coordinates through hit testing into the NC/client
+   message pair user32 would generate, including the tracked WM_NCMOUSELEAVE. */
+SHIM void headless_mouse_move(HWND hwnd, int x, int y) {
+	headless.cursor_pos = (POINT) { x, y };
+	LPARAM screen = MAKELPARAM(x, y);
+	LRESULT hit = SendMessage(hwnd, WM_NCHITTEST, 0, screen);
+	SendMessage(hwnd, WM_SETCURSOR, (WPARAM) hwnd, MAKELPARAM(hit, WM_MOUSEMOVE));
+	if (hit == HTCLIENT || hit == HTNOWHERE) {
+		if (hwnd->track_leave) {
+			hwnd->track_leave = false;
+			PostMessage(hwnd, WM_NCMOUSELEAVE, 0, 0);
+		}
+		POINT pt = { x, y };
+		ScreenToClient(hwnd, &pt);
+		PostMessage(hwnd, WM_MOUSEMOVE, 0, MAKELPARAM(pt.x, pt.y));
+	}
+	else {
+		PostMessage(hwnd, WM_NCMOUSEMOVE, (WPARAM) hit, screen);
+	}
+}
+
+SHIM void headless_click(HWND hwnd, int x, int y) {
+	headless_mouse_move(hwnd, x, y);
+	LPARAM screen = MAKELPARAM(x, y);
+	LRESULT hit = SendMessage(hwnd, WM_NCHITTEST, 0, screen);
+	if (hit == HTCLIENT) {
+		POINT pt = { x, y };
+		ScreenToClient(hwnd, &pt);
+		PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, MAKELPARAM(pt.x, pt.y));
+		PostMessage(hwnd, WM_LBUTTONUP, 0, MAKELPARAM(pt.x, pt.y));
+	}
+	else {
+		PostMessage(hwnd, WM_NCLBUTTONDOWN, (WPARAM) hit, screen);
+		PostMessage(hwnd, WM_NCLBUTTONUP, (WPARAM) hit, screen);
+	}
+}
+
+/* Interactive resize from the bottom-right corner, as the modal sizing loop does it. */
+SHIM void headless_drag_resize(HWND hwnd, int dx, int dy, int steps) {
+	SendMessage(hwnd, WM_ENTERSIZEMOVE, 0, 0);
+	RECT start = hwnd->rect;
+	for (int i = 1; i <= steps; i++) {
+		SetWindowPos(hwnd, NULL, start.left, start.top,
+					start.right - start.left + dx*i/steps, start.bottom - start.top + dy*i/steps,
+					SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOMOVE);
+		UpdateWindow(hwnd);
+	}
+	SendMessage(hwnd, WM_EXITSIZEMOVE, 0, 0);
+}
+
+/* Switch the app mode and high contrast and broadcast the notifications the system sends. */
+SHIM void headless_set_theme(bool light, bool high_contrast) {
+	headless_init();
+	bool contrast_changed = headless.high_contrast != high_contrast;
+	headless.light_theme = light;
+	headless.high_contrast = high_contrast;
+	for (HWND w = headless.windows, next; w != NULL; w = next) {
+		next = w->next;
+		if (w->destroyed) {
+			continue;
+		}
+		if (contrast_changed) {
+			SendMessage(w, WM_SETTINGCHANGE, SPI_SETHIGHCONTRAST, 0);
+			SendMessage(w, WM_SYSCOLORCHANGE, 0, 0);
+		}
+		else {
+			SendMessage(w, WM_SETTINGCHANGE, 0, (LPARAM) "ImmersiveColorSet");
+		}
+	}
+}
+
+SHIM SHORT GetKeyState(int vk) {
+	return headless.keys[vk & 0xff] ? (SHORT) 0x8000 : 0;
+}
+
+SHIM int headless_pump(void) {
+	MSG msg;
+	int n = 0;
+	while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+		if (msg.message == WM_QUIT) {
+			continue;
+		}
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+		n++;
+	}
+	return n;
+}
+
+/* A key press as the keyboard sends it: vk 0 with alt is Alt pressed and released
+   alone, F10 comes as a system key. */
+SHIM void headless_key(HWND hwnd, UINT vk, bool alt, bool shift) {
+	headless.keys[VK_SHIFT] = shift;
+	if (alt && vk == 0) {
+		PostMessage(hwnd, WM_SYSKEYDOWN, VK_MENU, 0);
+		PostMessage(hwnd, WM_SYSKEYUP, VK_MENU, 0);
+	}
+	else if (alt || vk == VK_F10) {
+		PostMessage(hwnd, WM_SYSKEYDOWN, vk, 0);
+		PostMessage(hwnd, WM_SYSKEYUP, vk, 0);
+	}
+	else {
+		PostMessage(hwnd, WM_KEYDOWN, vk, 0);
+		PostMessage(hwnd, WM_KEYUP, vk, 0);
+	}
+	headless_pump();
+	headless.keys[VK_SHIFT] = false;
+}
+
+/* ------------------------------- reporting ------------------------------- */
+
+SHIM void headless_reset_stats(void) {
+	memset(headless.stats, 0, sizeof(headless.stats));
+	headless.invalidate_calls = headless.appbar_calls = headless.monitor_calls = headless.presents = headless.text_calls = 0;
+}
+
+SHIM void headless_report(FILE *out, const char *const *names, size_t names_len) {
+	fprintf(out, "%-24s %12s %12s %14s\n", "message", "count", "ns/msg", "msgs/sec");
+	for (UINT msg = 0; msg <= HEADLESS_STAT_MESSAGES; msg++) {
+		HeadlessMessageStat *stat = &headless.stats[msg];
+		if (stat->count == 0) {
+			continue;
+		}
+		char id[16];
+		const char *name = msg < names_len && names != NULL ? names[msg] : NULL;
+		if (name == NULL) {
+			snprintf(id, sizeof(id), msg == HEADLESS_STAT_MESSAGES ? ">=WM_USER" : "0x%04x", msg);
+			name = id;
+		}
+		double per = (double) stat->total_ns / (double) stat->count;
+		fprintf(out, "%-24s %12llu %12.0f %14.0f\n", name, (unsigned long long) stat->count, per, per > 0 ? 1e9/per : 0);
+	}
+	fprintf(out, "InvalidateRect %llu, presents %llu, ExtTextOut %llu, SHAppBarMessage %llu, monitor queries %llu\n",
+			(unsigned long long) headless.invalidate_calls, (unsigned long long) headless.presents, (unsigned long long) headless.text_calls,
+			(unsigned long long) headless.appbar_calls, (unsigned long long) headless.monitor_calls);
+}
+
+#endif /* HEADLESS_C */
@@ -0,0 +1,75 @@
+/* Invalidation batching
+   The handlers of one message often dirty several small rects (the caption button
+   losing the hover and the one gaining it, the old and the new focused button).
+   They are collected with invalidate_add and win_proc flushes them once, after the
+   message is handled: rects that overlap or touch and lose nothing in a union are
+   merged, and past INVALIDATE_MAX_RECTS everything becomes one bounding rect, so the
+   window manager sees one or two InvalidateRect calls per message. */
+
+#define INVALIDATE_MAX_RECTS 	4
+
+typedef struct InvalidateBatch {
+	int count;								/* first, win_proc checks it after every message */
+	bool all;								/* the whole window, the rects are dropped */
+	bool erase;
+	RECT rects[INVALIDATE_MAX_RECTS];
+} InvalidateBatch;
+
+static LONG invalidate_area(const RECT *rect) {
+	return (rect->right - rect->left)*(rect->bottom - rect->top);
+}
+
+/* whether the union of a and b covers no pixel outside of them */
+static bool invalidate_can_merge(const RECT *a, const RECT *b) {
+	if (a->left > b->right || b->left > a->right || a->top > b->bottom || b->top > a->bottom) {
+		return false;						/* neither overlapping nor touching */
+	}
+	RECT merged, common;
+	UnionRect(&merged, a, b);
+	LONG overlap = IntersectRect(&common, a, b) ? invalidate_area(&common) : 0;
+	return invalidate_area(&merged) <= invalidate_area(a) + invalidate_area(b) - overlap;
+}
+
+/* rect is in window coordinates, NULL is the whole window */
+void invalidate_add(InvalidateBatch *batch, const RECT *rect, bool erase) {
+	batch->erase |= erase;
+	if (batch->all) {
+		return;
+	}
+	if (rect == NULL) {
+		batch->all = true;
+		batch->count = 0;
+		return;
+	}
+	if (IsRectEmpty(rect)) {
+		return;
+	}
+	RECT added = *rect;
+	/* a merge can make the result mergeable with a rect checked before it, so start over */
+	for (int i = 0; i < batch->count; i++) {
+		if (invalidate_can_merge(&batch->rects[i], &added)) {
+			UnionRect(&added, &batch->rects[i], &added);
+			batch->rects[i] = batch->rects[--batch->count];
+			i = -1;
+		}
+	}
+	if (batch->count == INVALIDATE_MAX_RECTS) {
+		for (int i = 0; i < batch->count; i++) {
+			UnionRect(&added, &added, &batch->rects[i]);
+		}
+		batch->count = 0;
+	}
+	batch->rects[batch->count++] = added;
+}
+
+void invalidate_flush(InvalidateBatch *batch, HWND hwnd) {
+	if (batch->all) {
+		InvalidateRect(hwnd, NULL, batch->erase);
+	}
+	for (int i = 0; i < batch->count; i++) {
+		InvalidateRect(hwnd, &batch->rects[i], batch->erase);
+	}
+	batch->count = 0;
+	batch->all = false;
+	batch->erase = false;
+}
@@ -0,0 +1,321 @@
+/* Input latency benchmark (LATENCY only)
+   Injects pointer input into one window (SendInput from a second thread on Windows,
+   the synthetic input of headless.c on Linux) and measures pointer-to-photon for the
+   caption hover, the pointer leaving the caption and the drag move. The time of an
+   input is taken just before it is injected; it is followed through the handler,
+   which either invalidates something (a sample is pending) or changes nothing, to
+   the WM_PAINT that presents it, after GdiFlush. A press on the caption is answered
+   by the modal move loop of the system, at WM_ENTERSIZEMOVE, and a drag move is
+   presented when the window position is committed. With DWM the photon time is the
+   vblank after the composition picking the present up, from DwmGetCompositionTimingInfo;
+   otherwise it is the present itself. An input counts from its own injection: older
+   injections no message was handled for (coalesced or dropped by the system) are
+   dropped, not charged to it.
+   Prints the percentiles per kind of input and fails when SIW_LATENCY_P99_US is set
+   and a p99 is above it. */
+
+#define LATENCY_DEFAULT_ROUNDS 		20
+#define LATENCY_INJECT_INTERVAL 	20		/* ms between injected inputs, so each one is presented alone */
+#define LATENCY_MAX_INJECTED 		64		/* injected inputs not handled yet */
+#define LATENCY_DRAG_STEPS 			8
+
+typedef enum LatencyKind {
+	LatencyKind_Hover,						/* WM_NCMOUSEMOVE */
+	LatencyKind_Leave,						/* WM_MOUSEMOVE */
+	LatencyKind_Press,						/* WM_NCLBUTTONDOWN */
+	LatencyKind_Drag,						/* a move committed during a drag */
+	LatencyKind_Count,
+} LatencyKind;
+
+static const char *const latency_kind_names[LatencyKind_Count] = { "caption hover", "caption leave", "button press", "drag move" };
+
+typedef struct LatencySamples {
+	double *us;
+	int count;
+	int capacity;
+	UINT64 inputs;
+	UINT64 unchanged;						/* inputs that invalidated nothing */
+} LatencySamples;
+
+static struct {
+	WNDPROC proc;
+	double ticks_per_us;
+	UINT64 injected[LATENCY_MAX_INJECTED];	/* written by the injecting thread */
+	volatile LONG injected_count;
+	LONG consumed_count;
+	bool is_pending;
+	LatencyKind pending_kind;
+	UINT64 pending_since;
+	bool is_press_pending;					/* a press on the caption, until the move loop starts */
+	UINT64 press_since;
+	bool is_dragging;
+	LatencySamples samples[LatencyKind_Count];
+} latency;
+
+static int latency_env(const char *name, int fallback) {
+	const char *value = getenv(name);
+	int n = value != NULL ? atoi(value) : 0;
+	return n > 0 ? n : fallback;
+}
+
+static UINT64 latency_now(void) {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (UINT64) counter.QuadPart;
+}
+
+/* call right before injecting an input */
+static void latency_inject(void) {
+	LONG count = InterlockedCompareExchange(&latency.injected_count, 0, 0);
+	latency.injected[count % LATENCY_MAX_INJECTED] = latency_now();
+	InterlockedIncrement(&latency.injected_count);
+}
+
+/* the newest injected input not handled yet, the older ones are dropped; now for input from a real pointer */
+static UINT64 latency_input_time(UINT64 now) {
+	LONG count = InterlockedCompareExchange(&latency.injected_count, 0, 0);
+	if (latency.consumed_count == count) {
+		return now;
+	}
+	UINT64 time = latency.injected[(count - 1) % LATENCY_MAX_INJECTED];
+	latency.consumed_count = count;
+	return time;
+}
+
+static UINT64 latency_photon(UINT64 present) {
+	UINT64 vblank, period;
+	if (dwm_is_composited() && dwm_timing(&vblank, &period)) {
+		if (vblank < present) {
+			vblank += ((present - vblank)/period + 1)*period;
+		}
+		return vblank + period;	/* composed until this vblank, scanned out from the next */
+	}
+	return present;
+}
+
+static void latency_sample(LatencyKind kind, UINT64 since) {
+	LatencySamples *samples = &latency.samples[kind];
+	if (samples->count == samples->capacity) {
+		samples->capacity = samples->capacity ? samples->capacity*2 : 256;
+		samples->us = (double*) realloc(samples->us, samples->capacity*sizeof(double));
+		assert(samples->us != NULL);
+	}
+	samples->us[samples->count++] = (latency_photon(latency_now()) - since)/latency.ticks_per_us;
+}
+
+static LRESULT latency_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+	UINT64 now = latency_now();
+	LatencyKind kind = LatencyKind_Count;
+	if (msg == WM_NCMOUSEMOVE) {
+		kind = LatencyKind_Hover;
+	}
+	else if (msg == WM_MOUSEMOVE) {
+		kind = LatencyKind_Leave;
+	}
+	else if (msg == WM_NCLBUTTONDOWN) {
+		kind = LatencyKind_Press;
+	}
+	else if (msg == WM_ENTERSIZEMOVE) {
+		latency.is_dragging = true;
+		if (latency.is_press_pending) {
+			latency.is_press_pending = false;
+			latency_sample(LatencyKind_Press, latency.press_since);
+		}
+	}
+	UINT64 since = kind != LatencyKind_Count ? latency_input_time(now) : now;
+	bool is_caption_press = kind == LatencyKind_Press && wparam == HTCAPTION;
+	if (kind != LatencyKind_Count) {
+		/* on Windows the default processing runs the whole move loop, a caption press ends
+		   where it starts; one no move loop followed before the next input is dropped */
+		latency.is_press_pending = is_caption_press;
+		latency.press_since = since;
+	}
+
+	LRESULT result = latency.proc(hwnd, msg, wparam, lparam);
+
+	if (is_caption_press) {
+		latency.samples[kind].inputs++;
+	}
+	else if (kind != LatencyKind_Count) {
+		latency.samples[kind].inputs++;
+		if (!GetUpdateRect(hwnd, NULL, false)) {
+			latency.samples[kind].unchanged++;
+		}
+		else if (!latency.is_pending) {
+			latency.is_pending = true;
+			latency.pending_kind = kind;
+			latency.pending_since = since;
+		}
+	}
+	else if (msg == WM_PAINT && latency.is_pending) {
+		GdiFlush();
+		latency.is_pending = false;
+		latency_sample(latency.pending_kind, latency.pending_since);
+	}
+	else if (msg == WM_WINDOWPOSCHANGED && latency.is_dragging && !(((WINDOWPOS*) lparam)->flags & SWP_NOMOVE)) {
+		latency.samples[LatencyKind_Drag].inputs++;
+		latency_sample(LatencyKind_Drag, latency_input_time(now));
+	}
+	else if (msg == WM_EXITSIZEMOVE) {
+		latency.is_dragging = false;
+		latency.consumed_count = InterlockedCompareExchange(&latency.injected_count, 0, 0);	/* moves the loop dropped */
+	}
+	return result;
+}
+
+/* ------------------------------- injection ------------------------------- */
+
+#ifdef HEADLESS
+static void latency_move(HWND hwnd, int x, int y) {
+	latency_inject();
+	headless_mouse_move(hwnd, x, y);
+	headless_pump();
+}
+
+/* the modal move loop of the system, in fast forward */
+static void latency_drag(HWND hwnd, int x, int y, int dx, int dy) {
+	latency_move(hwnd, x, y);
+	latency_inject();
+	PostMessage(hwnd, WM_NCLBUTTONDOWN, HTCAPTION, MAKELPARAM(x, y));
+	headless_pump();
+	SendMessage(hwnd, WM_ENTERSIZEMOVE, 0, 0);
+	RECT start;
+	GetWindowRect(hwnd, &start);
+	for (int i = 1; i <= LATENCY_DRAG_STEPS; i++) {
+		latency_inject();
+		SetWindowPos(hwnd, NULL, start.left + dx*i/LATENCY_DRAG_STEPS, start.top + dy*i/LATENCY_DRAG_STEPS, 0, 0,
+					SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOSIZE);
+		headless_pump();
+	}
+	SendMessage(hwnd, WM_EXITSIZEMOVE, 0, 0);
+	headless_pump();
+}
+#else
+static void latency_send_mouse(int x, int y, DWORD flags) {
+	int left = GetSystemMetrics(SM_XVIRTUALSCREEN), top = GetSystemMetrics(SM_YVIRTUALSCREEN);
+	int width = GetSystemMetrics(SM_CXVIRTUALSCREEN), height = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+	INPUT input = { .type = INPUT_MOUSE };
+	input.mi.dx = (LONG) ((x - left)*65535LL/(width > 1 ? width - 1 : 1));
+	input.mi.dy = (LONG) ((y - top)*65535LL/(height > 1 ? height - 1 : 1));
+	input.mi.dwFlags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_VIRTUALDESK | flags;
+	SendInput(1, &input, sizeof(INPUT));
+	Sleep(LATENCY_INJECT_INTERVAL);
+}
+
+static void latency_move(HWND hwnd, int x, int y) {
+	(void) hwnd;
+	latency_inject();
+	latency_send_mouse(x, y, 0);
+}
+
+/* the press enters the modal move loop of the system, the moves go to it */
+static void latency_drag(HWND hwnd, int x, int y, int dx, int dy) {
+	latency_move(hwnd, x, y);
+	latency_inject();
+	latency_send_mouse(x, y, MOUSEEVENTF_LEFTDOWN);
+	for (int i = 1; i <= LATENCY_DRAG_STEPS; i++) {
+		latency_move(hwnd, x + dx*i/LATENCY_DRAG_STEPS, y + dy*i/LATENCY_DRAG_STEPS);
+	}
+	latency_send_mouse(x + dx, y + dy, MOUSEEVENTF_LEFTUP);
+}
+#endif
+
+static void latency_script(HWND hwnd, int rounds) {
+	for (int round = 0; round < rounds; round++) {
+		RECT rect;
+		GetWindowRect(hwnd, &rect);
+		int caption_y = rect.top + FRAME_TITLEBAR_HEIGHT/2;
+		/* across the caption buttons from the title, then down into the client area */
+		for (int x = rect.right - FRAME_CAPTION_MENU_WIDTH*4; x < rect.right; x += FRAME_CAPTION_MENU_WIDTH/2) {
+			latency_move(hwnd, x, caption_y);
+		}
+		latency_move(hwnd, rect.right - FRAME_CAPTION_MENU_WIDTH/2, (rect.top + rect.bottom)/2);
+		int delta = (round & 1) ? -64 : 64;
+		latency_drag(hwnd, (rect.left + rect.right)/2, caption_y, delta, delta/2);
+	}
+}
+
+#ifndef HEADLESS
+static DWORD WINAPI latency_inject_thread(LPVOID param) {
+	HWND hwnd = (HWND) param;
+	Sleep(500);								/* let the window come up */
+	latency_script(hwnd, latency_env("SIW_LATENCY_ROUNDS", LATENCY_DEFAULT_ROUNDS));
+	PostMessage(hwnd, WM_CLOSE, 0, 0);
+	return 0;
+}
+#endif
+
+static int latency_compare(const void *a, const void *b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+/* nearest rank */
+static double latency_percentile(const LatencySamples *samples, int percent) {
+	int rank = (samples->count*percent + 99)/100;
+	return samples->us[rank > 0 ? rank - 1 : 0];
+}
+
+int latency_run(HMODULE hmodule) {
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	latency.ticks_per_us = frequency.QuadPart/1e6;
+	latency.proc = (WNDPROC) win_proc;
+	if (!register_window_class("LatencyWindow", (WNDPROC) latency_proc)) {
+		fprintf(stderr, "ERROR: could not register class: %ld\n", GetLastError());
+		return 1;
+	}
+	HWND hwnd = CreateWindowEx(0, "LatencyWindow", "Latency Window",
+		WS_POPUP | WS_THICKFRAME | WS_MAXIMIZEBOX | WS_MINIMIZEBOX | WS_SYSMENU | WS_VISIBLE,
+		100, 100, 700, 500, NULL, NULL, hmodule, NULL);
+	if (hwnd == NULL) {
+		fprintf(stderr, "ERROR: could not create window: %ld\n", GetLastError());
+		return 1;
+	}
+
+#ifdef HEADLESS
+	headless_pump();
+	latency_script(hwnd, latency_env("SIW_LATENCY_ROUNDS", LATENCY_DEFAULT_ROUNDS));
+	DestroyWindow(hwnd);
+	headless_pump();
+#else
+	SetForegroundWindow(hwnd);
+	HANDLE injector = CreateThread(NULL, 0, latency_inject_thread, hwnd, 0, NULL);
+	if (injector == NULL) {
+		fprintf(stderr, "ERROR: could not create the input thread: %ld\n", GetLastError());
+		DestroyWindow(hwnd);
+		return 1;
+	}
+	MSG msg;
+	while (GetMessage(&msg, NULL, 0, 0)) {
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+	WaitForSingleObject(injector, INFINITE);
+	CloseHandle(injector);
+#endif
+
+	int budget = latency_env("SIW_LATENCY_P99_US", 0);
+	bool failed = false;
+	printf("%-14s %8s %8s %10s %10s %10s %10s %10s\n", "input", "inputs", "no paint", "samples", "p50 us", "p90 us", "p99 us", "max us");
+	for (int kind = 0; kind < LatencyKind_Count; kind++) {
+		LatencySamples *samples = &latency.samples[kind];
+		printf("%-14s %8llu %8llu %10d", latency_kind_names[kind],
+				(unsigned long long) samples->inputs, (unsigned long long) samples->unchanged, samples->count);
+		if (samples->count > 0) {
+			qsort(samples->us, samples->count, sizeof(double), latency_compare);
+			double p99 = latency_percentile(samples, 99);
+			printf(" %10.1f %10.1f %10.1f %10.1f", latency_percentile(samples, 50), latency_percentile(samples, 90),
+					p99, samples->us[samples->count - 1]);
+			if (budget > 0 && p99 > budget) {
+				failed = true;
+			}
+		}
+		printf("\n");
+		free(samples->us);
+	}
+	if (failed) {
+		fprintf(stderr, "ERROR: a p99 latency is above SIW_LATENCY_P99_US (%d us)\n", budget);
+	}
+	return failed ? 1 : 0;
+}
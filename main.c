@@ -2,13 +2,19 @@
 	#define _WIN32_WINNT 	0x0500	/* _WIN32_WINNT_WIN2K (Windows 2000) */
 #endif
 #define WIN32_LEAN_AND_MEAN
+#ifdef HEADLESS
+#include "headless.c"					/* Linux, see headless.c */
+#else
 #include <windows.h>
 #include <shellapi.h>
+#endif
 #include <assert.h>
+#include <ctype.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
-#ifdef DEBUG
+#if defined(DEBUG) || defined(HEADLESS)
 #include "message.c"
 #endif
 
@@ -44,22 +50,32 @@
 #define GET_Y_LPARAM(lp) ((int)(short)HIWORD(lp))
 #endif
 
-#define TITLEBAR_HEIGHT 32
-#define TITLE_POS_X 16
-#define CAPTION_MENU_WIDTH 46
-#define CAPTION_ICON_SIZE 10
-#define LEFT_PADDING 8
-#define SYSMENU_HIGHLIGHT_SIZE 4
-#define SYSMENU_HIGHLIGHT_BORDER_WIDTH 1
-#define BORDER_WIDTH 1
+#include "placement.c"
+#include "monitor.c"
+#include "snap.c"
+#include "composition.c"
+#include "render.c"
+#include "text.c"
+#include "framering.c"
+#include "theme.c"
+#include "resize.c"
+#include "invalidate.c"
+#include "pool.c"
+#include "snapshot.c"
+#include "metrics.h"
 
-typedef struct UserData {
-	LONG_PTR flags;
-	RECT normal_pos;
-} UserData;
+/* The title bar with no hovered or focused button, kept for both activation states
+   so an activation change repaints the title bar with a single blit. */
+typedef struct CaptionCache {
+	HDC hdc;
+	HBITMAP bitmaps[2];						/* indexed by has_focus, top-down 32bpp */
+	UINT32 *pixels[2];
+	bool valid[2];
+	int width, height;
+	bool is_maximized;
+	UINT theme_generation;					/* the theme the bitmaps were drawn with */
+} CaptionCache;
 
-#define CAPTION_BUTTON_BIT 				0
-#define CAPTION_BUTTON_BIT_LENGTH 		3
 typedef enum CaptionButton {
 	CaptionButton_None,
 	CaptionButton_Close,
@@ -68,74 +84,73 @@ typedef enum CaptionButton {
 	CaptionButton_Sysmenu,
 } CaptionButton;
 
-#define IS_MOUSE_LEAVE_BIT 				(CAPTION_BUTTON_BIT + CAPTION_BUTTON_BIT_LENGTH)
-#define IS_MOUSE_LEAVE_BIT_LENGTH 		1
-#define MAXIMIZE_SNAPPING_BIT 			(IS_MOUSE_LEAVE_BIT + IS_MOUSE_LEAVE_BIT_LENGTH)
-#define MAXIMIZE_SNAPPING_BIT_LENGTH 	1
-#define IS_TASKBAR_HIDDEN_BIT 			(MAXIMIZE_SNAPPING_BIT + MAXIMIZE_SNAPPING_BIT_LENGTH)
-#define IS_TASKBAR_HIDDEN_BIT_LENGTH 	1
-
-LONG_PTR get_nbits_from_ith(LONG_PTR num, unsigned char start, unsigned char count) {
-	assert(start + count <= 8*sizeof(LONG_PTR));
-	return (num >> start) & ((1 << count) - 1);
-}
+/* Per-window state, fetched once per message in win_proc and accessed directly.
+   Fields other threads read (render thread, animations) are volatile LONGs
+   accessed only through Interlocked*; the bitfields belong to the UI thread.
+   The slots come from user_data_pool and start on a cache line; what almost every
+   message reads (the hover and focus state, the flags, the metrics the layout is
+   computed from and the count of the invalidation batch) is in that first line. */
+typedef struct UserData {
+	volatile LONG hovered_button;			/* CaptionButton */
+	CaptionButton focused_button;			/* keyboard navigation of the caption, None outside of it */
+	bool is_mouse_leave : 1;
+	bool is_taskbar_hidden : 1;
+	bool is_menu_valid : 1;					/* the system menu enable state matches is_menu_maximized */
+	bool is_menu_maximized : 1;
+	bool is_sizing : 1;						/* between WM_ENTERSIZEMOVE and WM_EXITSIZEMOVE */
+	bool is_restore_maximized : 1;			/* the placement was saved maximized, see get_show_command */
+	bool is_destroyed : 1;					/* after WM_DESTROY, freed when the outermost win_proc returns */
+	WORD call_depth;						/* of the win_proc calls for the window on the stack */
+#ifndef FIXED_METRICS
+	FrameMetrics metrics;					/* see set_frame_metrics */
+#endif
+	InvalidateBatch invalidate;				/* flushed when win_proc returns, see invalidate_window */
+	/* the rest is only touched by painting, resizing and placement */
+	RECT normal_pos;
+	UINT32 placement_key;
+	UINT appbars_generation;				/* the last appbar change seen, see monitor_cache_invalidate_appbars */
+	Snap snap;
+	CaptionCache caption_cache;
+	Renderer renderer;						/* the client area below the title bar, see set_client_draw */
+	FrameRing *frame_ring;					/* or frames from another process, see set_client_frame_ring */
+	SnapshotFrame snapshot_frame;			/* what the window shows, once it is captured, see snapshot_window */
+#ifdef SYNC_RESIZE
+	ResizeBuffer resize_buffer;				/* the frame for the size being committed, see resize.c */
+#endif
+#ifdef RESIZE_STATS
+	ResizeStats resize_stats;				/* of the current drag */
+	ResizeCommit resize_commit;
+#endif
+} UserData;
 
-void set_nbits_from_ith(LONG_PTR *num, unsigned char start, unsigned char count, LONG_PTR value) {
-	assert(start + count <= 8*sizeof(LONG_PTR));
-	assert((value >> count) == 0);
-	assert(num != NULL);
-	*num = (*num & ~(((1 << count) - 1) << start)) | (value << start);
-}
+static Pool user_data_pool = { .slot_size = POOL_SLOT_SIZE(sizeof(UserData)) };
 
-LONG_PTR get_flag(HWND hwnd, unsigned char start, unsigned char count) {
-	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
-	if (user_data == NULL) {
-		return 0;
-	}
-	LONG_PTR prop = get_nbits_from_ith(user_data->flags, start, count);
-	return prop;
-}
+#ifdef RESIZE_STATS
+static ResizeStats resize_stats_total;		/* of every drag */
+#endif
 
-void set_flag(HWND hwnd, unsigned char start, unsigned char count, LONG_PTR value) {
-	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
-	if (user_data == NULL) {
-		return;
-	}
-	set_nbits_from_ith(&user_data->flags, start, count, value);
-	SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR) user_data);
+#ifdef FIXED_METRICS
+	#define frame_metrics(user_data) 	((void) (user_data), &frame_metrics_default)
+#else
+const FrameMetrics* frame_metrics(UserData *user_data) {
+	return user_data != NULL ? &user_data->metrics : &frame_metrics_default;	/* the default until WM_CREATE */
 }
+#endif
 
-RECT* get_normal_pos(HWND hwnd) {
-	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+CaptionButton get_hovered_button(UserData *user_data) {
 	if (user_data == NULL) {
-		return NULL;
+		return CaptionButton_None;
 	}
-	return &user_data->normal_pos;
+	return (CaptionButton) InterlockedCompareExchange(&user_data->hovered_button, 0, 0);
 }
 
-void set_normal_pos(HWND hwnd, RECT *pos) {
-	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+void set_hovered_button(UserData *user_data, CaptionButton button) {
 	if (user_data == NULL) {
 		return;
 	}
-	user_data->normal_pos.left = pos->left;
-	user_data->normal_pos.top = pos->top;
-	user_data->normal_pos.right = pos->right;
-	user_data->normal_pos.bottom = pos->bottom;
-	SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR) user_data);
-}
-
-/* NOTE: Both bg and fg are in rgb */
-unsigned long blend_color(unsigned long bg, unsigned long fg, unsigned char alpha) {
-	int blue = ((bg & 0xff) * (255 - alpha) + (fg & 0xff) * alpha) / 255;
-	bg >>= 8; fg >>= 8;
-	int green = ((bg & 0xff) * (255 - alpha) + (fg & 0xff) * alpha) / 255;
-	bg >>= 8; fg >>= 8;
-	int red = ((bg & 0xff) * (255 - alpha) + (fg & 0xff) * alpha) / 255;
-	return (blue << 16) | (green << 8) | red;						/* the winapi use bgr */
+	InterlockedExchange(&user_data->hovered_button, button);
 }
 
-
 void dr_line(HDC hdc, int x1, int y1, int x2, int y2, int border_width, unsigned long color) {
 	if (border_width == 0) {
 		return;
@@ -174,19 +189,51 @@ void dr_rect_line(HDC hdc, int x, int y, int w, int h, int border_width, unsigne
 }
 
 /* https://learn.microsoft.com/en-us/windows/apps/design/style/xaml-theme-resources#the-xaml-type-ramp
-   font style: (12px, normal)
-   align: left(x), center(y) */
-int dr_caption(HDC hdc, const char *text, int length, RECT bounds, unsigned long color) {
-	static int font_size = 12;
-	const char *font_family = "Segoe UI";
-	HFONT hfont = CreateFont(-font_size, 0, 0, 0, FW_NORMAL, 0, 0, 0,
+   font style: (12px, normal) */
+#define CAPTION_FONT_FAMILY 	"Segoe UI"
+#define CAPTION_FONT_SIZE 		12
+
+static TextFont* caption_font(void) {
+	return text_font(CAPTION_FONT_FAMILY, CAPTION_FONT_SIZE, FW_NORMAL);
+}
+
+/* align: left(x), center(y)
+   with pixels, the top-down 32bpp bits of hdc stride pixels wide, the glyphs are
+   blended from the atlas; otherwise, or without the atlas, GDI draws them */
+int dr_caption(HDC hdc, UINT32 *pixels, int stride, const char *text, int length, RECT bounds, unsigned long color) {
+	TextFont *font = caption_font();
+	if (font != NULL) {
+		TextRun run = text_fit(font, text, length, bounds.right - bounds.left);
+		int y = (bounds.top + bounds.bottom)/2 - font->height/2;
+		if (pixels != NULL) {
+			GdiFlush();
+			UINT32 *origin = pixels + bounds.top*stride + bounds.left;
+			int x = bounds.left + text_draw(font, origin, stride, &bounds, bounds.left, y, text, run.fit_length, color);
+			if (run.has_ellipsis) {
+				text_draw(font, origin, stride, &bounds, x, y, TEXT_ELLIPSIS, 3, color);
+			}
+			return run.width;
+		}
+		HGDIOBJ oldfont = SelectObject(hdc, font->hfont);
+		SetTextColor(hdc, color);
+		int old_mode = SetBkMode(hdc, TRANSPARENT);
+		ExtTextOut(hdc, bounds.left, y, ETO_CLIPPED, &bounds, text, run.fit_length, NULL);
+		if (run.has_ellipsis) {
+			ExtTextOut(hdc, bounds.left + run.width - text_width(font, TEXT_ELLIPSIS, 3), y, ETO_CLIPPED, &bounds, TEXT_ELLIPSIS, 3, NULL);
+		}
+		SetBkMode(hdc, old_mode);
+		SelectObject(hdc, oldfont);
+		return run.width;
+	}
+
+	HFONT hfont = CreateFont(-CAPTION_FONT_SIZE, 0, 0, 0, FW_NORMAL, 0, 0, 0,
 							DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
-							DEFAULT_QUALITY, DEFAULT_PITCH, font_family);
+							DEFAULT_QUALITY, DEFAULT_PITCH, CAPTION_FONT_FAMILY);
 	if (hfont == NULL) {
 		HFONT def_font = GetStockObject(DEFAULT_GUI_FONT);
 		LOGFONT lf;
 		GetObject(def_font, sizeof(LOGFONT), &lf);
-		lf.lfHeight = -font_size;
+		lf.lfHeight = -CAPTION_FONT_SIZE;
 		hfont = CreateFontIndirect(&lf);
 	}
 	assert(hfont != NULL && "ERROR: could not create font");
@@ -199,7 +246,6 @@ int dr_caption(HDC hdc, const char *text, int length, RECT bounds, unsigned long
 		SIZE ellipsis_size_px;
 		GetTextExtentPoint32(hdc, "...", 3, &ellipsis_size_px);
 		ellipsis_width_px = ellipsis_size_px.cx;
-		/* TODO: use binary search concept to find the length faster */
 		while (text_size_px.cx + ellipsis_width_px > bounds.right - bounds.left && length > 1) {
 			length--;
 			GetTextExtentPoint32(hdc, text, length, &text_size_px);
@@ -226,85 +272,70 @@ int dr_caption(HDC hdc, const char *text, int length, RECT bounds, unsigned long
 }
 
 bool is_taskbar_hidden(HWND hwnd) {
-	MONITORINFO mi;
-	mi.cbSize = sizeof(MONITORINFO);
-	if (GetMonitorInfo(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST), &mi)) {
-		return EqualRect(&mi.rcWork, &mi.rcMonitor);
+	const MonitorEntry *monitor = monitor_cache_lookup(hwnd);
+	if (monitor != NULL) {
+		return EqualRect(&monitor->rc_work, &monitor->rc_monitor);
 	}
 	return false;
 }
 
-bool set_maximize_window(HWND hwnd) {
-	MONITORINFO mi;
-	mi.cbSize = sizeof(MONITORINFO);
-	if (GetMonitorInfo(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST), &mi)) {
-		/* to not overlap the autohide taskbar (fullscreen)
-		   this will affect to the snapping behaviour on Windows 10
-		   The solution is handle WM_WINDOWPOSCHANGING (see below) */
-		if (get_flag(hwnd, IS_TASKBAR_HIDDEN_BIT, IS_TASKBAR_HIDDEN_BIT_LENGTH)) {
-			APPBARDATA abd;
-			abd.cbSize = sizeof(APPBARDATA);
-			abd.uEdge = ABE_BOTTOM;
-			if ((HWND) SHAppBarMessage(ABM_GETAUTOHIDEBAR, &abd) != NULL) {
-				mi.rcWork.bottom -= 1;
-			}
-			abd.uEdge = ABE_RIGHT;
-			if ((HWND) SHAppBarMessage(ABM_GETAUTOHIDEBAR, &abd) != NULL) {
-				mi.rcWork.right -= 1;
-			}
-			abd.uEdge = ABE_TOP;
-			if ((HWND) SHAppBarMessage(ABM_GETAUTOHIDEBAR, &abd) != NULL) {
-				mi.rcWork.top += 1;
-			}
-			abd.uEdge = ABE_LEFT;
-			if ((HWND) SHAppBarMessage(ABM_GETAUTOHIDEBAR, &abd) != NULL) {
-				mi.rcWork.left += 1;
-			}
+/* the work area of the monitor nearest to near (or to the window when near is NULL) */
+bool get_maximized_rect(HWND hwnd, const RECT *near, RECT *work) {
+	const MonitorEntry *monitor = near != NULL ? monitor_cache_lookup_rect(near) : monitor_cache_lookup(hwnd);
+	if (monitor == NULL) {
+		return false;
+	}
+	*work = monitor->rc_work;
+	/* to not overlap the autohide taskbar (fullscreen) */
+	if (EqualRect(&monitor->rc_work, &monitor->rc_monitor)) {
+		if (monitor->autohide_edges & (1 << ABE_BOTTOM)) {
+			work->bottom -= 1;
+		}
+		if (monitor->autohide_edges & (1 << ABE_RIGHT)) {
+			work->right -= 1;
 		}
+		if (monitor->autohide_edges & (1 << ABE_TOP)) {
+			work->top += 1;
+		}
+		if (monitor->autohide_edges & (1 << ABE_LEFT)) {
+			work->left += 1;
+		}
+	}
+	return true;
+}
+
+bool set_maximize_window(HWND hwnd) {
+	RECT work;
+	if (get_maximized_rect(hwnd, NULL, &work)) {
 		return SetWindowPos(hwnd, NULL,
-						mi.rcWork.left, mi.rcWork.top,
-						mi.rcWork.right - mi.rcWork.left,
-						mi.rcWork.bottom - mi.rcWork.top,
+						work.left, work.top,
+						work.right - work.left,
+						work.bottom - work.top,
 						SWP_NOZORDER | SWP_FRAMECHANGED | SWP_NOACTIVATE | SWP_NOCOPYBITS);
 	}
 
 	return false;
 }
 
-/* https://devblogs.microsoft.com/oldnewthing/20110520-00/?p=10613 */
-static void on_draw(HWND hwnd, HDC hdc) {
-	bool has_focus = !!GetFocus();
-	CaptionButton cur_hovered_button = (CaptionButton) get_flag(hwnd, CAPTION_BUTTON_BIT, CAPTION_BUTTON_BIT_LENGTH);
-	bool is_maximized = IsZoomed(hwnd);
-
-	RECT rect;
-	GetWindowRect(hwnd, &rect);
-	SIZE window_size = { rect.right - rect.left, rect.bottom - rect.top };
-
-	int border_width = is_maximized ? 0 : BORDER_WIDTH;
-	unsigned long title_bar_color = has_focus ? 0 : 0x2f2f2f; /* bgr 0x4f4f4f 0x2f2f2f 0xb16300 */
-	static unsigned long border_color = 0x4f4f4f;
-	static unsigned long background_color = 0x1e1e1e;				/* 0x0c0c0c */
-	unsigned long foreground_color = has_focus ? 0xffffff : 0x7f7f7f;
-
-	{
-		dr_rect(hdc, border_width, TITLEBAR_HEIGHT, window_size.cx - border_width*2, window_size.cy - TITLEBAR_HEIGHT - border_width, background_color);
-		dr_line(hdc, 0, window_size.cy - border_width/2 - (border_width&1), window_size.cx, window_size.cy - border_width/2-(border_width&1), border_width, border_color);
-		dr_line(hdc, 0, TITLEBAR_HEIGHT, 0, window_size.cy, border_width*2, border_color);
-		dr_line(hdc, window_size.cx - border_width/2-(border_width&1), TITLEBAR_HEIGHT, window_size.cx - border_width/2-(border_width&1), window_size.cy, border_width, border_color);
-	}
-	{
-		dr_rect(hdc, border_width, border_width, window_size.cx - border_width*2 - CAPTION_MENU_WIDTH*3, TITLEBAR_HEIGHT - border_width, title_bar_color);
-		dr_line(hdc, 0, 0, window_size.cx, 0, border_width*2, border_color);
-		dr_line(hdc, 0, 0, 0, TITLEBAR_HEIGHT, border_width*2, border_color);
-		dr_line(hdc, window_size.cx - border_width/2-(border_width&1), 0, window_size.cx - border_width/2-(border_width&1), TITLEBAR_HEIGHT, border_width, border_color);
+/* the part of the title bar repainted for a caption button, the sysmenu is its highlight */
+RECT caption_button_rect(const FrameLayout *layout, CaptionButton button) {
+	switch (button) {
+		case CaptionButton_Close: return layout->close;
+		case CaptionButton_Maximize: return layout->maximize;
+		case CaptionButton_Minimize: return layout->minimize;
+		case CaptionButton_Sysmenu: return layout->sysmenu;
+		default: return (RECT) { 0, 0, 0, 0 };
 	}
+}
 
-	int left_padding = (LEFT_PADDING > (border_width*2 + SYSMENU_HIGHLIGHT_SIZE) ? LEFT_PADDING : border_width*2 + SYSMENU_HIGHLIGHT_SIZE);
-	{
-		SIZE sysmenu_size = { GetSystemMetrics(SM_CXSMICON), GetSystemMetrics(SM_CYSMICON) };
-		unsigned long sysmenu_color = cur_hovered_button == CaptionButton_Sysmenu ?
-											blend_color(title_bar_color, foreground_color, 20) : title_bar_color;
+/* One caption button, drawn over the title bar; the keyboard focus is a ring inside it. */
+static void on_draw_caption_button(HWND hwnd, HDC hdc, const FrameLayout *layout, bool has_focus, CaptionButton button, bool is_hovered, bool is_focused) {
+	const FrameMetrics *metrics = layout->metrics;
+	const ThemeColors *colors = theme_colors(has_focus);
+	RECT rect = caption_button_rect(layout, button);
+	SIZE button_size = { rect.right - rect.left, rect.bottom - rect.top };
+	if (button == CaptionButton_Sysmenu) {
+		unsigned long sysmenu_color = is_hovered ? colors->sysmenu_hover : colors->caption;
 		HICON sysmenu_icon = NULL;
 #ifdef GetClassLongPtr
 		if (sysmenu_icon == NULL) {
@@ -316,62 +347,356 @@ static void on_draw(HWND hwnd, HDC hdc) {
 		}
 		assert(sysmenu_icon != NULL && "ERROR: could not load sysmenu icon");
 		/* https://devblogs.microsoft.com/oldnewthing/20101020-00/?p=12493 */
-		dr_rect(hdc, left_padding-SYSMENU_HIGHLIGHT_SIZE, border_width + (TITLEBAR_HEIGHT-border_width)/2 - (sysmenu_size.cy + SYSMENU_HIGHLIGHT_SIZE*2)/2,
-				sysmenu_size.cx + SYSMENU_HIGHLIGHT_SIZE*2, sysmenu_size.cy + SYSMENU_HIGHLIGHT_SIZE*2, sysmenu_color);
+		dr_rect(hdc, rect.left, rect.top, button_size.cx, button_size.cy, sysmenu_color);
 		HBRUSH hbr = CreateSolidBrush(sysmenu_color); 	/* GetSysColorBrush(COLOR_MENU) */
-		DrawIconEx(hdc, left_padding, border_width + (TITLEBAR_HEIGHT-border_width)/2 - sysmenu_size.cy/2, sysmenu_icon,
-				sysmenu_size.cx, sysmenu_size.cy, 0, hbr, DI_NORMAL | DI_COMPAT);
+		DrawIconEx(hdc, rect.left + metrics->sysmenu_highlight_size, rect.top + metrics->sysmenu_highlight_size, sysmenu_icon,
+				layout->sysmenu_icon.cx, layout->sysmenu_icon.cy, 0, hbr, DI_NORMAL | DI_COMPAT);
 		DeleteObject(hbr);
-		if (cur_hovered_button == CaptionButton_Sysmenu) {
-			dr_rect_line(hdc, left_padding-SYSMENU_HIGHLIGHT_SIZE, border_width + (TITLEBAR_HEIGHT-border_width)/2 - (sysmenu_size.cy + SYSMENU_HIGHLIGHT_SIZE*2)/2,
-					sysmenu_size.cx + SYSMENU_HIGHLIGHT_SIZE*2, sysmenu_size.cy + SYSMENU_HIGHLIGHT_SIZE*2, SYSMENU_HIGHLIGHT_BORDER_WIDTH, blend_color(sysmenu_color, foreground_color, 20));
+		if (is_hovered || is_focused) {
+			dr_rect_line(hdc, rect.left, rect.top, button_size.cx, button_size.cy, metrics->sysmenu_highlight_border_width,
+						is_focused ? colors->caption_text : colors->sysmenu_hover_border);
+		}
+		return;
+	}
+
+	unsigned long background_color = !is_hovered ? colors->caption : button == CaptionButton_Close ? colors->close_hover : colors->button_hover;
+	unsigned long foreground_color = !is_hovered ? colors->caption_text : button == CaptionButton_Close ? colors->close_hover_text : colors->button_hover_text;
+	POINT button_center = { rect.left + button_size.cx/2, rect.top + button_size.cy/2 };
+	int caption_icon_size = metrics->caption_icon_size;
+	dr_rect(hdc, rect.left, rect.top, button_size.cx, button_size.cy, background_color);
+	if (button == CaptionButton_Close) {
+		dr_line(hdc, button_center.x - caption_icon_size/2, button_center.y - caption_icon_size/2, button_center.x + caption_icon_size/2 + 1, button_center.y + caption_icon_size/2 + 1, 1, foreground_color);
+		dr_line(hdc, button_center.x - caption_icon_size/2, button_center.y + caption_icon_size/2, button_center.x + caption_icon_size/2 + 1, button_center.y - caption_icon_size/2 - 1, 1, foreground_color);
+	}
+	else if (button == CaptionButton_Maximize) {
+		if (layout->is_maximized) {
+			int offset = 2;
+			dr_rect_line(hdc, button_center.x - caption_icon_size/2 + offset, button_center.y - caption_icon_size/2 - offset,
+						caption_icon_size, caption_icon_size, 1, foreground_color);
+			dr_rect(hdc, button_center.x - caption_icon_size/2, button_center.y - caption_icon_size/2,
+					caption_icon_size, caption_icon_size, background_color);
 		}
-		left_padding += sysmenu_size.cx + SYSMENU_HIGHLIGHT_SIZE + /* padding */ 1;
+		dr_rect_line(hdc, button_center.x - caption_icon_size/2, button_center.y - caption_icon_size/2,
+						caption_icon_size, caption_icon_size, 1, foreground_color);
 	}
+	else if (button == CaptionButton_Minimize) {
+		dr_line(hdc, button_center.x - caption_icon_size/2, button_center.y, button_center.x + caption_icon_size/2, button_center.y, 1, foreground_color);
+	}
+	if (is_focused) {
+		int inset = metrics->caption_focus_inset;
+		dr_rect_line(hdc, rect.left + inset, rect.top + inset, button_size.cx - inset*2, button_size.cy - inset*2, 1, foreground_color);
+	}
+}
+
+/* the title bar with every button in its normal state; pixels, when not NULL, are the bits of hdc (see dr_caption) */
+static void on_draw_title_bar(HWND hwnd, HDC hdc, UINT32 *pixels, const FrameLayout *layout, bool has_focus) {
+	SIZE window_size = layout->window_size;
+	int border_width = layout->border_width;
+	int titlebar_height = layout->metrics->titlebar_height;
+	const ThemeColors *colors = theme_colors(has_focus);
+	unsigned long border_color = colors->border;
+
+	{
+		dr_rect(hdc, border_width, border_width, layout->minimize.left - border_width, titlebar_height - border_width, colors->caption);
+		dr_line(hdc, 0, 0, window_size.cx, 0, border_width*2, border_color);
+		dr_line(hdc, 0, 0, 0, titlebar_height, border_width*2, border_color);
+		dr_line(hdc, window_size.cx - border_width/2-(border_width&1), 0, window_size.cx - border_width/2-(border_width&1), titlebar_height, border_width, border_color);
+	}
+
+	on_draw_caption_button(hwnd, hdc, layout, has_focus, CaptionButton_Sysmenu, false, false);
 	{
 		int length = GetWindowTextLength(hwnd);
 		char text[MAX_PATH];
 		GetWindowText(hwnd, text, length + 1);
-		left_padding += dr_caption(hdc, text, length, (RECT) { left_padding, border_width, window_size.cx - CAPTION_MENU_WIDTH*3 - border_width, TITLEBAR_HEIGHT }, foreground_color);
+		dr_caption(hdc, pixels, window_size.cx, text, length, layout->text, colors->caption_text);
 	}
 
-	SIZE button_size = { CAPTION_MENU_WIDTH, TITLEBAR_HEIGHT - border_width };
-	int right_padding = window_size.cx - border_width - button_size.cx;
-	POINT button_center = { right_padding + button_size.cx/2, border_width + button_size.cy/2 };
-	int caption_icon_size = CAPTION_ICON_SIZE;
-	{
-		unsigned long close_button_color = cur_hovered_button == CaptionButton_Close ? 0xffffff : foreground_color;
-		dr_rect(hdc, right_padding, border_width, button_size.cx, button_size.cy, cur_hovered_button == CaptionButton_Close ? 0x2311e8 : title_bar_color);
-		dr_line(hdc, button_center.x - caption_icon_size/2, button_center.y - caption_icon_size/2, button_center.x + caption_icon_size/2 + 1, button_center.y + caption_icon_size/2 + 1, 1, close_button_color);
-		dr_line(hdc, button_center.x - caption_icon_size/2, button_center.y + caption_icon_size/2, button_center.x + caption_icon_size/2 + 1, button_center.y - caption_icon_size/2 - 1, 1, close_button_color);
-		right_padding -= button_size.cx;
-		button_center.x -= button_size.cx;
+	on_draw_caption_button(hwnd, hdc, layout, has_focus, CaptionButton_Close, false, false);
+	on_draw_caption_button(hwnd, hdc, layout, has_focus, CaptionButton_Maximize, false, false);
+	on_draw_caption_button(hwnd, hdc, layout, has_focus, CaptionButton_Minimize, false, false);
+}
+
+void caption_cache_invalidate(CaptionCache *cache) {
+	cache->valid[0] = cache->valid[1] = false;
+}
+
+void caption_cache_free(CaptionCache *cache) {
+	for (int i = 0; i < 2; i++) {
+		if (cache->bitmaps[i] != NULL) {
+			DeleteObject(cache->bitmaps[i]);
+			cache->bitmaps[i] = NULL;
+			cache->pixels[i] = NULL;
+		}
+	}
+	if (cache->hdc != NULL) {
+		DeleteDC(cache->hdc);
+		cache->hdc = NULL;
+	}
+	caption_cache_invalidate(cache);
+}
+
+static bool draw_cached_title_bar(HWND hwnd, UserData *user_data, HDC hdc, const FrameLayout *layout, bool has_focus) {
+	if (user_data == NULL) {
+		return false;
+	}
+	CaptionCache *cache = &user_data->caption_cache;
+	SIZE size = { layout->window_size.cx, layout->metrics->titlebar_height };
+	if (cache->width != size.cx || cache->height != size.cy || cache->is_maximized != layout->is_maximized) {
+		caption_cache_free(cache);
+		cache->width = size.cx;
+		cache->height = size.cy;
+		cache->is_maximized = layout->is_maximized;
+	}
+	if (cache->theme_generation != theme_generation()) {
+		caption_cache_invalidate(cache);
+		cache->theme_generation = theme_generation();
 	}
+	if (cache->hdc == NULL) {
+		cache->hdc = CreateCompatibleDC(hdc);
+	}
+	if (cache->bitmaps[has_focus] == NULL) {
+		BITMAPINFO bmi = { 0 };
+		bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		bmi.bmiHeader.biWidth = size.cx;
+		bmi.bmiHeader.biHeight = -size.cy;	/* top-down, the caption text is blended into it */
+		bmi.bmiHeader.biPlanes = 1;
+		bmi.bmiHeader.biBitCount = 32;
+		bmi.bmiHeader.biCompression = BI_RGB;
+		void *bits = NULL;
+		cache->bitmaps[has_focus] = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+		cache->pixels[has_focus] = (UINT32*) bits;
+	}
+	if (cache->hdc == NULL || cache->bitmaps[has_focus] == NULL) {
+		return false;
+	}
+	HGDIOBJ oldbmp = SelectObject(cache->hdc, cache->bitmaps[has_focus]);
+	if (!cache->valid[has_focus]) {
+		on_draw_title_bar(hwnd, cache->hdc, cache->pixels[has_focus], layout, has_focus);
+		cache->valid[has_focus] = true;
+	}
+	BitBlt(hdc, 0, 0, size.cx, size.cy, cache->hdc, 0, 0, SRCCOPY);
+	SelectObject(cache->hdc, oldbmp);
+	return true;
+}
+
+/* https://devblogs.microsoft.com/oldnewthing/20110520-00/?p=10613 */
+static void on_draw(HWND hwnd, UserData *user_data, HDC hdc, const FrameLayout *layout) {
+	bool has_focus = !!GetFocus();
+	CaptionButton cur_hovered_button = get_hovered_button(user_data);
+	const ThemeColors *colors = theme_colors(has_focus);
+
+	SIZE window_size = layout->window_size;
+	int border_width = layout->border_width;
+	int titlebar_height = layout->metrics->titlebar_height;
 	{
-		unsigned long maximize_button_color = cur_hovered_button == CaptionButton_Maximize ? 0xffffff : foreground_color;
-		dr_rect(hdc, right_padding, border_width, button_size.cx, button_size.cy, cur_hovered_button == CaptionButton_Maximize ? 0x1a1a1a : title_bar_color);
-		if (is_maximized) {
-			int offset = 2;
-			dr_rect_line(hdc, button_center.x - caption_icon_size/2 + offset, button_center.y - caption_icon_size/2 - offset,
-						caption_icon_size, caption_icon_size, 1, maximize_button_color);
-			dr_rect(hdc, button_center.x - caption_icon_size/2, button_center.y - caption_icon_size/2,
-					caption_icon_size, caption_icon_size, cur_hovered_button == CaptionButton_Maximize ? 0x1a1a1a : title_bar_color);
+		SIZE client_size = { layout->client.right - layout->client.left, layout->client.bottom - layout->client.top };
+		if (user_data != NULL && user_data->frame_ring != NULL) {
+			SIZE covered;
+			frame_ring_set_client_size(user_data->frame_ring, client_size.cx, client_size.cy);
+			frame_ring_present(user_data->frame_ring, hdc, layout->client.left, layout->client.top, &covered);
+			/* what the frame does not cover yet (first frame, the producer has not seen the resize) */
+			dr_rect(hdc, layout->client.left + covered.cx, layout->client.top, client_size.cx - covered.cx, client_size.cy, colors->background);
+			dr_rect(hdc, layout->client.left, layout->client.top + covered.cy, covered.cx, client_size.cy - covered.cy, colors->background);
 		}
-		dr_rect_line(hdc, button_center.x - caption_icon_size/2, button_center.y - caption_icon_size/2,
-						caption_icon_size, caption_icon_size, 1, maximize_button_color);
+		/* the plain background is filled directly, the framebuffer only pays off for client content */
+		else if (user_data != NULL && user_data->renderer.draw != NULL
+			&& renderer_resize(&user_data->renderer, hdc, client_size.cx, client_size.cy)) {
+			renderer_render(&user_data->renderer);
+			renderer_present(&user_data->renderer, hdc, layout->client.left, layout->client.top);
+		}
+		else {
+			dr_rect(hdc, layout->client.left, layout->client.top, client_size.cx, client_size.cy, colors->background);
+		}
+		dr_line(hdc, 0, window_size.cy - border_width/2 - (border_width&1), window_size.cx, window_size.cy - border_width/2-(border_width&1), border_width, colors->border);
+		dr_line(hdc, 0, titlebar_height, 0, window_size.cy, border_width*2, colors->border);
+		dr_line(hdc, window_size.cx - border_width/2-(border_width&1), titlebar_height, window_size.cx - border_width/2-(border_width&1), window_size.cy, border_width, colors->border);
+	}
+	if (!draw_cached_title_bar(hwnd, user_data, hdc, layout, has_focus)) {
+		on_draw_title_bar(hwnd, hdc, NULL, layout, has_focus);
+	}
+	/* the hovered and the keyboard focused buttons over the cached title bar */
+	CaptionButton focused_button = user_data != NULL ? user_data->focused_button : CaptionButton_None;
+	if (cur_hovered_button != CaptionButton_None) {
+		on_draw_caption_button(hwnd, hdc, layout, has_focus, cur_hovered_button, true, cur_hovered_button == focused_button);
+	}
+	if (focused_button != CaptionButton_None && focused_button != cur_hovered_button) {
+		on_draw_caption_button(hwnd, hdc, layout, has_focus, focused_button, false, true);
+	}
+}
 
-		right_padding -= button_size.cx;
-		button_center.x -= button_size.cx;
+/* draw is called for every dirty tile of the client area, on the render threads; NULL is the plain background */
+void set_client_draw(HWND hwnd, RenderTileProc draw, void *context) {
+	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (user_data != NULL) {
+		renderer_set_draw(&user_data->renderer, draw, context);
+		if (draw == NULL) {
+			renderer_free(&user_data->renderer);		/* back to the plain background */
+		}
+		InvalidateRect(hwnd, NULL, false);
 	}
-	{
-		unsigned long minimize_button_color = cur_hovered_button == CaptionButton_Minimize ? 0xffffff : foreground_color;
-		dr_rect(hdc, right_padding, border_width, button_size.cx, button_size.cy, cur_hovered_button == CaptionButton_Minimize ? 0x1a1a1a : title_bar_color);
-		dr_line(hdc, button_center.x - caption_icon_size/2, button_center.y, button_center.x + caption_icon_size/2, button_center.y, 1, minimize_button_color);
-		right_padding -= button_size.cx;
-		button_center.x -= button_size.cx;
+}
+
+/* rect is relative to the client area below the title bar, NULL is all of it */
+void invalidate_client(HWND hwnd, const RECT *rect) {
+	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (user_data == NULL) {
+		return;
+	}
+	renderer_invalidate(&user_data->renderer, rect);
+	const FrameMetrics *metrics = frame_metrics(user_data);
+	int border_width = IsZoomed(hwnd) ? 0 : metrics->border_width;
+	RECT window_rect = { 0, 0, user_data->renderer.width, user_data->renderer.height };
+	if (rect != NULL) {
+		window_rect = *rect;
+	}
+	OffsetRect(&window_rect, border_width, metrics->titlebar_height);
+	InvalidateRect(hwnd, &window_rect, false);
+}
+
+/* Show the frames another process renders into the shared memory ring called name,
+   see framering.c; the frames are as large as the monitor. NULL goes back to on_draw. */
+bool set_client_frame_ring(HWND hwnd, const char *name) {
+	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (user_data == NULL) {
+		return false;
+	}
+	frame_ring_close(user_data->frame_ring);
+	user_data->frame_ring = NULL;
+	InvalidateRect(hwnd, NULL, false);
+	if (name == NULL) {
+		return true;
+	}
+	const MonitorEntry *monitor = monitor_cache_lookup(hwnd);
+	if (monitor == NULL) {
+		return false;
+	}
+	user_data->frame_ring = frame_ring_create(hwnd, name, 3,
+								monitor->rc_monitor.right - monitor->rc_monitor.left,
+								monitor->rc_monitor.bottom - monitor->rc_monitor.top);
+	return user_data->frame_ring != NULL;
+}
+
+/* bring the frame of hwnd up to date, it is created and drawn by the first capture */
+static bool snapshot_frame_update(HWND hwnd, UserData *user_data, const FrameLayout *layout) {
+	SnapshotFrame *frame = &user_data->snapshot_frame;
+	HDC hdc = GetDC(hwnd);
+	HDC framedc = snapshot_frame_begin(frame, hdc, layout->window_size);
+	ReleaseDC(hwnd, hdc);
+	if (framedc == NULL) {
+		return false;
+	}
+	if (!frame->is_valid) {
+		on_draw(hwnd, user_data, framedc, layout);
+		frame->is_valid = true;
+	}
+	GdiFlush();
+	return true;
+}
+
+/* WM_PRINT and WM_PRINTCLIENT: the client is layout->client, the title bar and the borders
+   around it are the non-client part; each part is copied from the snapshot frame, or drawn
+   clipped to it before the frame exists */
+static void print_window(HWND hwnd, UserData *user_data, HDC hdc, const FrameLayout *layout, bool is_client, bool is_nonclient) {
+	SIZE window_size = layout->window_size;
+	RECT client = layout->client;
+	RECT parts[5];
+	int count = 0;
+	if (is_nonclient) {
+		parts[count++] = (RECT) { 0, 0, window_size.cx, client.top };
+		parts[count++] = (RECT) { 0, client.top, client.left, client.bottom };
+		parts[count++] = (RECT) { client.right, client.top, window_size.cx, client.bottom };
+		parts[count++] = (RECT) { 0, client.bottom, window_size.cx, window_size.cy };
+	}
+	if (is_client) {
+		parts[count++] = client;
+	}
+	bool has_frame = user_data != NULL && snapshot_frame_update(hwnd, user_data, layout);
+	for (int i = 0; i < count; i++) {
+		RECT part = parts[i];
+		if (IsRectEmpty(&part)) {
+			continue;
+		}
+		if (has_frame) {
+			BitBlt(hdc, part.left, part.top, part.right - part.left, part.bottom - part.top,
+					user_data->snapshot_frame.hdc, part.left, part.top, SRCCOPY);
+		}
+		else {
+			int saved = SaveDC(hdc);
+			IntersectClipRect(hdc, part.left, part.top, part.right, part.bottom);
+			on_draw(hwnd, user_data, hdc, layout);
+			RestoreDC(hdc, saved);
+		}
+	}
+}
+
+/* for the appbar broadcasts, user_data is NULL before WM_CREATE */
+static void monitor_cache_invalidate_appbars_for(UserData *user_data) {
+	UINT seen_generation = user_data != NULL ? user_data->appbars_generation : monitor_cache_appbars_generation();
+	UINT generation = monitor_cache_invalidate_appbars(seen_generation);
+	if (user_data != NULL) {
+		user_data->appbars_generation = generation;
 	}
 }
 
+/* the layout of hwnd as it is now, the one every message is handled with; rect, when not NULL, gets the window rect */
+static FrameLayout get_frame_layout(HWND hwnd, UserData *user_data, RECT *rect) {
+	RECT window_rect;
+	GetWindowRect(hwnd, &window_rect);
+	if (rect != NULL) {
+		*rect = window_rect;
+	}
+	SIZE window_size = { window_rect.right - window_rect.left, window_rect.bottom - window_rect.top };
+	return frame_layout(frame_metrics(user_data), window_size, IsZoomed(hwnd));
+}
+
+/* Copy what hwnd shows into snapshot, reduced factor times (see snapshot_copy). Only the
+   first capture of a window draws it, the later ones copy the frame WM_PAINT keeps. */
+bool snapshot_window(HWND hwnd, int factor, Snapshot *snapshot) {
+	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (user_data == NULL) {
+		return false;
+	}
+	FrameLayout layout = get_frame_layout(hwnd, user_data, NULL);
+	if (!snapshot_frame_update(hwnd, user_data, &layout)) {
+		return false;
+	}
+	const SnapshotFrame *frame = &user_data->snapshot_frame;
+	return snapshot_copy(snapshot, frame->pixels, frame->stride, frame->size.cx, frame->size.cy, factor);
+}
+
+/* capture hwnd as the next file of stream */
+bool snapshot_stream_frame(SnapshotStream *stream, HWND hwnd) {
+	return snapshot_window(hwnd, stream->factor > 0 ? stream->factor : 1, &stream->snapshot)
+		&& snapshot_stream_write(stream);
+}
+
+/* The command for the first ShowWindow of hwnd: WM_CREATE restored the saved normal
+   rect, show_command (SW_SHOWNORMAL, SW_SHOW) becomes SW_SHOWMAXIMIZED when the
+   window was saved maximized. */
+int get_show_command(HWND hwnd, int show_command) {
+	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (user_data == NULL || !user_data->is_restore_maximized) {
+		return show_command;
+	}
+	user_data->is_restore_maximized = false;
+	return show_command == SW_SHOWNORMAL || show_command == SW_SHOW ? SW_SHOWMAXIMIZED : show_command;
+}
+
+#ifndef FIXED_METRICS
+/* the geometry of the frame of hwnd, NULL is the compile-time default of metrics.h */
+bool set_frame_metrics(HWND hwnd, const FrameMetrics *metrics) {
+	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (user_data == NULL) {
+		return false;
+	}
+	user_data->metrics = metrics != NULL ? *metrics : frame_metrics_default;
+	caption_cache_free(&user_data->caption_cache);
+	SetWindowPos(hwnd, NULL, 0, 0, 0, 0, SWP_FRAMECHANGED | SWP_NOMOVE | SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE);
+	InvalidateRect(hwnd, NULL, false);
+	return true;
+}
+#endif
+
 static bool register_window_class(const char *class, WNDPROC proc) {
 	return RegisterClassEx(&(WNDCLASSEX) {
 		.cbSize = sizeof(WNDCLASSEX),
@@ -391,32 +716,83 @@ bool track_mouse_leave(HWND hwnd) {
 	});
 }
 
-static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+/* inside win_proc: the rect is only collected and invalidated once the message is handled */
+void invalidate_window(HWND hwnd, UserData *user_data, const RECT *rect, bool erase) {
+	if (user_data != NULL) {
+		invalidate_add(&user_data->invalidate, rect, erase);
+	}
+	else {
+		InvalidateRect(hwnd, rect, erase);
+	}
+}
+
+void invalidate_caption_button(HWND hwnd, UserData *user_data, CaptionButton button, const FrameLayout *layout) {
+	if (button != CaptionButton_None) {
+		RECT rect = caption_button_rect(layout, button);
+		invalidate_window(hwnd, user_data, &rect, false);
+	}
+}
+
+/* Keyboard navigation of the caption buttons (Alt or F10, then the arrows or tab),
+   only the buttons losing and gaining the focus are repainted. */
+void set_focused_button(HWND hwnd, UserData *user_data, CaptionButton button, const FrameLayout *layout) {
+	if (user_data == NULL || user_data->focused_button == button) {
+		return;
+	}
+	invalidate_caption_button(hwnd, user_data, user_data->focused_button, layout);
+	invalidate_caption_button(hwnd, user_data, button, layout);
+	user_data->focused_button = button;
+}
+
+/* The enable state of the system menu only depends on the maximized state,
+   so the items are only updated when that changes. */
+void update_system_menu(HWND hwnd, UserData *user_data, bool is_maximized) {
+	if (user_data == NULL || (user_data->is_menu_valid && user_data->is_menu_maximized == is_maximized)) {
+		return;
+	}
+	HMENU hmenu = GetSystemMenu(hwnd, false);
+	if (hmenu == NULL) {
+		return;
+	}
+	EnableMenuItem(hmenu, SC_MAXIMIZE, is_maximized ? MF_GRAYED : MF_ENABLED);
+	EnableMenuItem(hmenu, SC_RESTORE, !is_maximized ? MF_GRAYED : MF_ENABLED);
+	EnableMenuItem(hmenu, SC_SIZE, is_maximized ? MF_GRAYED : MF_ENABLED);
+	EnableMenuItem(hmenu, SC_MOVE, is_maximized ? MF_GRAYED : MF_ENABLED);
+	user_data->is_menu_valid = true;
+	user_data->is_menu_maximized = is_maximized;
+}
+
+/* the enabled system menu command whose mnemonic is key ("Mi&nimize"), 0 for none */
+UINT find_system_menu_mnemonic(HWND hwnd, char key) {
+	HMENU hmenu = GetSystemMenu(hwnd, false);
+	int count = hmenu != NULL ? GetMenuItemCount(hmenu) : 0;
+	for (int i = 0; i < count; i++) {
+		char text[64];
+		if (GetMenuString(hmenu, i, text, sizeof(text), MF_BYPOSITION) <= 0) {
+			continue;
+		}
+		const char *mnemonic = strchr(text, '&');
+		if (mnemonic != NULL && tolower((unsigned char) mnemonic[1]) == tolower((unsigned char) key)) {
+			UINT command = GetMenuItemID(hmenu, i);
+			return (GetMenuState(hmenu, command, MF_BYCOMMAND) & (MF_GRAYED | MF_DISABLED)) ? 0 : command;
+		}
+	}
+	return 0;
+}
+
+/* *user_data_ref is the window data win_proc fetched, WM_CREATE sets it */
+static LRESULT handle_message(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam, UserData **user_data_ref) {
+	UserData *user_data = *user_data_ref;
 	RECT rect;
-	GetWindowRect(hwnd, &rect);
-	bool is_mouse_leave = (bool) get_flag(hwnd, IS_MOUSE_LEAVE_BIT, IS_MOUSE_LEAVE_BIT_LENGTH);
-	bool is_maximized = IsZoomed(hwnd);
-	SIZE window_size = { rect.right - rect.left, rect.bottom - rect.top };
-	CaptionButton cur_hovered_button = (CaptionButton) get_flag(hwnd, CAPTION_BUTTON_BIT, CAPTION_BUTTON_BIT_LENGTH);
-	int border_width = is_maximized ? 0 : BORDER_WIDTH;
-	SIZE sysmenu_size = { GetSystemMetrics(SM_CXSMICON), GetSystemMetrics(SM_CYSMICON) };
-	int left_padding = (LEFT_PADDING > (border_width*2 + SYSMENU_HIGHLIGHT_SIZE) ? LEFT_PADDING : border_width*2 + SYSMENU_HIGHLIGHT_SIZE);
-	RECT sysmenu_paint_rect = {
-		.left = left_padding-SYSMENU_HIGHLIGHT_SIZE,
-		.top = border_width + (TITLEBAR_HEIGHT-border_width)/2 - (sysmenu_size.cy + SYSMENU_HIGHLIGHT_SIZE*2)/2,
-	};
-	sysmenu_paint_rect.right = sysmenu_paint_rect.left + sysmenu_size.cx + SYSMENU_HIGHLIGHT_SIZE*2;
-	sysmenu_paint_rect.bottom = sysmenu_paint_rect.top + sysmenu_size.cy + SYSMENU_HIGHLIGHT_SIZE*2;
-	RECT client_rect = { border_width, TITLEBAR_HEIGHT, window_size.cx - border_width, window_size.cy - border_width };
-	RECT title_bar_rect = { border_width, border_width, window_size.cx - border_width, TITLEBAR_HEIGHT };
-	RECT close_button_paint_rect = { window_size.cx - border_width - CAPTION_MENU_WIDTH, border_width,
-											window_size.cx - border_width, TITLEBAR_HEIGHT };
-	RECT maximize_button_paint_rect = close_button_paint_rect;
-	OffsetRect(&maximize_button_paint_rect, -CAPTION_MENU_WIDTH, 0);
-	RECT minimize_button_paint_rect = close_button_paint_rect;
-	OffsetRect(&minimize_button_paint_rect, -CAPTION_MENU_WIDTH*2, 0);
-
-#ifdef DEBUG
+	FrameLayout layout = get_frame_layout(hwnd, user_data, &rect);
+	bool is_mouse_leave = user_data != NULL && user_data->is_mouse_leave;
+	bool is_maximized = layout.is_maximized;
+	SIZE window_size = layout.window_size;
+	CaptionButton cur_hovered_button = get_hovered_button(user_data);
+	int border_width = layout.border_width;
+	int titlebar_height = layout.metrics->titlebar_height;
+
+#if defined(DEBUG) || defined(HEADLESS)
 	if (print_message) {
 		if (msg < messages_len && messages[msg] != NULL) {
 			printf("%s\n", messages[msg]);
@@ -452,30 +828,65 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			if (rect.top <= 0) {
 				rect.top = dummy_rect.top;
 			}
-			if (window_size.cx < CAPTION_MENU_WIDTH*3 + border_width*2 + GetSystemMetrics(SM_CXSMICON) + LEFT_PADDING) {
+			if (window_size.cx < layout.min_track.cx) {
 				window_size.cx = dummy_rect.right - dummy_rect.left;
 			}
-			if (window_size.cy < TITLEBAR_HEIGHT) {
+			if (window_size.cy < titlebar_height) {
 				window_size.cy = dummy_rect.bottom - dummy_rect.top;
 			}
+			/* restore the saved placement while the window is still hidden, so it appears in place */
+			UINT32 key = placement_key(hwnd);
+			RECT saved_pos;
+			bool restore_maximized = false;
+			if (placement_restore(key, &saved_pos, &restore_maximized)) {
+				rect = saved_pos;
+				window_size = (SIZE) { saved_pos.right - saved_pos.left, saved_pos.bottom - saved_pos.top };
+			}
 
 			SetWindowPos(hwnd, NULL, rect.left, rect.top, window_size.cx, window_size.cy,
 						SWP_NOZORDER | SWP_FRAMECHANGED | SWP_NOREDRAW | SWP_NOCOPYBITS);
 			/* trigger the program create system menu */
 			(void) GetSystemMenu(hwnd, false);
-			UserData *user_data = (UserData*) calloc(1, sizeof(UserData));
+			user_data = (UserData*) pool_alloc(&user_data_pool);
 			assert(user_data != NULL);
+#ifndef FIXED_METRICS
+			user_data->metrics = frame_metrics_default;
+#endif
+			user_data->placement_key = key;
+			user_data->appbars_generation = monitor_cache_appbars_generation();
+			user_data->is_restore_maximized = restore_maximized;
+			user_data->is_mouse_leave = true;
+			user_data->is_taskbar_hidden = is_taskbar_hidden(hwnd);
+			user_data->normal_pos = rect;
+			user_data->call_depth = 1;				/* this call */
 			SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR) user_data);
-			set_flag(hwnd, IS_MOUSE_LEAVE_BIT, IS_MOUSE_LEAVE_BIT_LENGTH, true);
-			set_flag(hwnd, IS_TASKBAR_HIDDEN_BIT, IS_TASKBAR_HIDDEN_BIT_LENGTH, is_taskbar_hidden(hwnd));
-			set_normal_pos(hwnd, &rect);
+			*user_data_ref = user_data;
+			update_system_menu(hwnd, user_data, false);
+			theme_register(hwnd);
+			dwm_extend_frame(hwnd);
 			break;
 		}
 		case WM_DESTROY: {
-			UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);
-			free(user_data);
-			/* TODO: save window's position and size when close by hold ctrl then click X button */
-			/* https://learn.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-writeprivateprofilestringa */
+			if (user_data != NULL) {
+				bool is_iconic = IsIconic(hwnd);
+				bool is_restore_maximized = is_maximized;
+				if (is_iconic) {
+					/* a window minimized from maximized is not zoomed, it comes back maximized */
+					WINDOWPLACEMENT wp = { .length = sizeof(WINDOWPLACEMENT) };
+					is_restore_maximized = GetWindowPlacement(hwnd, &wp) && (wp.flags & WPF_RESTORETOMAXIMIZED);
+				}
+				placement_store(user_data->placement_key, (is_maximized || is_iconic) ? &user_data->normal_pos : &rect, is_restore_maximized);
+				caption_cache_free(&user_data->caption_cache);
+				renderer_free(&user_data->renderer);
+#ifdef SYNC_RESIZE
+				resize_buffer_free(&user_data->resize_buffer);
+#endif
+				frame_ring_close(user_data->frame_ring);
+				snapshot_frame_free(&user_data->snapshot_frame);
+				theme_unregister(hwnd);
+				user_data->is_destroyed = true;		/* a win_proc further up the stack may still hold it */
+			}
+			SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);		/* messages still arrive until WM_NCDESTROY */
 			PostQuitMessage(0);
 			break;
 		}
@@ -483,49 +894,98 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		case WM_ACTIVATE: {
 			if (LOWORD(wparam) == WA_INACTIVE) {
 				if (cur_hovered_button != CaptionButton_None) {
-					set_flag(hwnd, CAPTION_BUTTON_BIT, CAPTION_BUTTON_BIT_LENGTH, CaptionButton_None);
+					set_hovered_button(user_data, CaptionButton_None);
+				}
+				if (user_data != NULL) {
+					user_data->focused_button = CaptionButton_None;		/* the whole title bar is repainted below */
 				}
 			}
-			InvalidateRect(hwnd, &title_bar_rect, false);
+			invalidate_window(hwnd, user_data, &layout.title_bar, false);
 			return 0;
 		}
 		case WM_NCACTIVATE: {
 			/* redraw take too long when hold inactive titlebar */
 			lparam = -1;
+			if (dwm_is_composited()) {
+				break;							/* let DWM update the shadow, the -1 skips the nonclient repaint */
+			}
 			return true;
 		}
 		case WM_NCPAINT: {
+			if (dwm_is_composited()) {
+				break;							/* DWM draws the extended frame */
+			}
 			return true;
 		}
 		case WM_PAINT: {
 			PAINTSTRUCT ps;
 			BeginPaint(hwnd, &ps);
+			HDC framedc = user_data != NULL && user_data->snapshot_frame.hdc != NULL
+						? snapshot_frame_begin(&user_data->snapshot_frame, ps.hdc, window_size) : NULL;
+			if (framedc != NULL) {
+				/* a captured window paints into its frame and shows it, see snapshot.c */
+				SnapshotFrame *frame = &user_data->snapshot_frame;
+				if (frame->is_valid) {
+					IntersectClipRect(framedc, ps.rcPaint.left, ps.rcPaint.top, ps.rcPaint.right, ps.rcPaint.bottom);
+				}
+				on_draw(hwnd, user_data, framedc, &layout);
+				SelectClipRgn(framedc, NULL);
+				frame->is_valid = true;
+				BitBlt(ps.hdc, ps.rcPaint.left, ps.rcPaint.top, ps.rcPaint.right - ps.rcPaint.left, ps.rcPaint.bottom - ps.rcPaint.top,
+						framedc, ps.rcPaint.left, ps.rcPaint.top, SRCCOPY);
+			}
+			else {
 #ifndef DOUBLE_BUFFERING
-			on_draw(hwnd, ps.hdc);
+				on_draw(hwnd, user_data, ps.hdc, &layout);
 #else
-			/* https://www.codeproject.com/articles/617212/custom-controls-in-win-api-the-painting */
-			int cx = ps.rcPaint.right - ps.rcPaint.left, cy = ps.rcPaint.bottom - ps.rcPaint.top;
-			HDC memdc = CreateCompatibleDC(ps.hdc);
-			HBITMAP membmp = CreateCompatibleBitmap(ps.hdc, cx, cy);
-			assert(memdc != NULL && "ERROR: could not create the memory device context");
-			assert(membmp != NULL && "ERROR: could not create the memory bitmap");
-
-			HGDIOBJ oldbmp = SelectObject(memdc, membmp);
-			POINT old_point;
-			OffsetViewportOrgEx(memdc, -ps.rcPaint.left, -ps.rcPaint.top, &old_point);
-			on_draw(hwnd, memdc);
-			SetViewportOrgEx(memdc, old_point.x, old_point.y, NULL);
-			BitBlt(ps.hdc, ps.rcPaint.left, ps.rcPaint.top,
-					cx, cy, memdc, 0, 0, SRCCOPY);
-
-			SelectObject(memdc, oldbmp);
-			DeleteObject(membmp);
-			DeleteObject(memdc);
+				/* https://www.codeproject.com/articles/617212/custom-controls-in-win-api-the-painting */
+				int cx = ps.rcPaint.right - ps.rcPaint.left, cy = ps.rcPaint.bottom - ps.rcPaint.top;
+				HDC memdc = CreateCompatibleDC(ps.hdc);
+				HBITMAP membmp = CreateCompatibleBitmap(ps.hdc, cx, cy);
+				assert(memdc != NULL && "ERROR: could not create the memory device context");
+				assert(membmp != NULL && "ERROR: could not create the memory bitmap");
+
+				HGDIOBJ oldbmp = SelectObject(memdc, membmp);
+				POINT old_point;
+				OffsetViewportOrgEx(memdc, -ps.rcPaint.left, -ps.rcPaint.top, &old_point);
+				on_draw(hwnd, user_data, memdc, &layout);
+				SetViewportOrgEx(memdc, old_point.x, old_point.y, NULL);
+				BitBlt(ps.hdc, ps.rcPaint.left, ps.rcPaint.top,
+						cx, cy, memdc, 0, 0, SRCCOPY);
+
+				SelectObject(memdc, oldbmp);
+				DeleteObject(membmp);
+				DeleteDC(memdc);
 #endif
+			}
 			EndPaint(hwnd, &ps);
+#ifdef RESIZE_STATS
+			if (user_data != NULL) {
+				resize_stats_present(&user_data->resize_stats, &user_data->resize_commit, window_size);
+			}
+#endif
+			return 0;
+		}
+		case WM_PRINT:
+		case WM_PRINTCLIENT: {
+			/* WM_PRINTCLIENT is the client area alone, whatever the flags */
+			HDC hdc = (HDC) wparam;
+			bool is_client = msg == WM_PRINTCLIENT || (lparam & PRF_CLIENT);
+			bool is_nonclient = msg == WM_PRINT && (lparam & PRF_NONCLIENT);
+			if ((lparam & PRF_CHECKVISIBLE) && !IsWindowVisible(hwnd)) {
+				return 0;
+			}
+			if (is_client && (lparam & PRF_ERASEBKGND)) {
+				SendMessage(hwnd, WM_ERASEBKGND, (WPARAM) hdc, 0);
+			}
+			print_window(hwnd, user_data, hdc, &layout, is_client, is_nonclient);
 			return 0;
 		}
 		case WM_NCHITTEST: {
+			LRESULT dwm_hit_test;
+			if (dwm_def_window_proc(hwnd, msg, wparam, lparam, &dwm_hit_test)) {
+				return dwm_hit_test;
+			}
 			int border_check_sensitivity = is_maximized ? 0 : 4;
 			POINT mouse = { GET_X_LPARAM(lparam), GET_Y_LPARAM(lparam) };
 			MapWindowPoints(NULL, hwnd, &mouse, 1 /*number of points*/);
@@ -557,15 +1017,15 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 					return HTRIGHT;
 				}
 			}
-			if (mouse.y < TITLEBAR_HEIGHT) {
-				RECT close_button_border_check = close_button_paint_rect;
+			if (mouse.y < titlebar_height) {
+				RECT close_button_border_check = layout.close;
 				close_button_border_check.top += border_check_sensitivity;
 				close_button_border_check.right -= border_check_sensitivity;
-				RECT maximize_button_border_check = maximize_button_paint_rect;
+				RECT maximize_button_border_check = layout.maximize;
 				maximize_button_border_check.top += border_check_sensitivity;
-				RECT minimize_button_border_check = minimize_button_paint_rect;
+				RECT minimize_button_border_check = layout.minimize;
 				minimize_button_border_check.top += border_check_sensitivity;
-				if (PtInRect(&sysmenu_paint_rect, mouse)) {
+				if (PtInRect(&layout.sysmenu, mouse)) {
 					return HTSYSMENU;
 				}
 				else if (PtInRect(&close_button_border_check, mouse)) {
@@ -582,7 +1042,7 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 				}												/* there will be a delay in repaint titlebar */
 				return HTCLIENT;								/* so we must return HTCLIENT */
 			}
-			else if (PtInRect(&client_rect, mouse)) {
+			else if (PtInRect(&layout.client, mouse)) {
 				return HTCLIENT;
 			}
 
@@ -593,9 +1053,17 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		case WM_NCCALCSIZE: {
 			if (wparam == true) {
 				NCCALCSIZE_PARAMS *params = (NCCALCSIZE_PARAMS*) lparam;
-				if (!is_maximized || get_flag(hwnd, IS_TASKBAR_HIDDEN_BIT, IS_TASKBAR_HIDDEN_BIT_LENGTH)) {
+				if (!is_maximized || (user_data != NULL && user_data->is_taskbar_hidden)) {
 					params->rgrc[0].bottom += border_width;
 				}
+#ifdef SYNC_RESIZE
+				if (user_data != NULL && user_data->is_sizing) {
+					/* one pixel copied onto itself: the system keeps none of the old bits
+					   at the wrong edge, the prepared frame is blitted in WM_WINDOWPOSCHANGED */
+					params->rgrc[1] = (RECT) { params->rgrc[0].left, params->rgrc[0].top, params->rgrc[0].left + 1, params->rgrc[0].top + 1 };
+					params->rgrc[2] = params->rgrc[1];
+				}
+#endif
 				return WVR_VALIDRECTS;			/* make the resize smoothly */
 			}
 			return 0;							/* disable default behaviour
@@ -604,32 +1072,29 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		}
 		case WM_GETMINMAXINFO: {
 			MINMAXINFO *mmi = (MINMAXINFO*) lparam;
-			mmi->ptMinTrackSize.x = CAPTION_MENU_WIDTH*3 + border_width*2 + sysmenu_paint_rect.right;
-			mmi->ptMinTrackSize.y = TITLEBAR_HEIGHT + border_width*2;
+			mmi->ptMinTrackSize.x = layout.min_track.cx;
+			mmi->ptMinTrackSize.y = layout.min_track.cy;
 			break;
 		}
 		case WM_MOUSEMOVE: {
 			if (GetCapture()) {
 				PostMessage(hwnd, WM_NCLBUTTONDOWN, HTCAPTION, lparam);
 				/* force redraw */
-				RedrawWindow(hwnd, &title_bar_rect, NULL, RDW_INVALIDATE | RDW_NOERASE | RDW_NOFRAME | RDW_UPDATENOW);
+				RedrawWindow(hwnd, &layout.title_bar, NULL, RDW_INVALIDATE | RDW_NOERASE | RDW_NOFRAME | RDW_UPDATENOW);
 				ReleaseCapture();
 			}
 			if (cur_hovered_button != CaptionButton_None) {
-				InvalidateRect(hwnd, &title_bar_rect, false);
-				set_flag(hwnd, CAPTION_BUTTON_BIT, CAPTION_BUTTON_BIT_LENGTH, CaptionButton_None);
+				invalidate_caption_button(hwnd, user_data, cur_hovered_button, &layout);
+				set_hovered_button(user_data, CaptionButton_None);
 			}
 			break;
 		}
 		case WM_NCMOUSELEAVE: {
-			if (!is_mouse_leave) {
-				set_flag(hwnd, IS_MOUSE_LEAVE_BIT, IS_MOUSE_LEAVE_BIT_LENGTH, true);
+			if (user_data != NULL && !is_mouse_leave) {
+				user_data->is_mouse_leave = true;
 				if (cur_hovered_button != CaptionButton_None) {
-					InvalidateRect(hwnd, &close_button_paint_rect, false);
-					InvalidateRect(hwnd, &minimize_button_paint_rect, false);
-					InvalidateRect(hwnd, &maximize_button_paint_rect, false);
-					InvalidateRect(hwnd, &sysmenu_paint_rect, false);
-					set_flag(hwnd, CAPTION_BUTTON_BIT, CAPTION_BUTTON_BIT_LENGTH, CaptionButton_None);
+					invalidate_caption_button(hwnd, user_data, cur_hovered_button, &layout);
+					set_hovered_button(user_data, CaptionButton_None);
 				}
 			}
 			break;
@@ -637,7 +1102,7 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		case WM_NCMOUSEMOVE: {
 			if (is_mouse_leave) {
 				track_mouse_leave(hwnd);
-				set_flag(hwnd, IS_MOUSE_LEAVE_BIT, IS_MOUSE_LEAVE_BIT_LENGTH, false);
+				user_data->is_mouse_leave = false;
 			}
 			int hit_test = wparam;
 			CaptionButton new_hovered_button = CaptionButton_None;
@@ -655,15 +1120,14 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			}
 
 			if (new_hovered_button != cur_hovered_button) {
-				InvalidateRect(hwnd, &close_button_paint_rect, false);
-				InvalidateRect(hwnd, &minimize_button_paint_rect, false);
-				InvalidateRect(hwnd, &maximize_button_paint_rect, false);
-				InvalidateRect(hwnd, &sysmenu_paint_rect, false);
-				set_flag(hwnd, CAPTION_BUTTON_BIT, CAPTION_BUTTON_BIT_LENGTH, new_hovered_button);
+				invalidate_caption_button(hwnd, user_data, cur_hovered_button, &layout);
+				invalidate_caption_button(hwnd, user_data, new_hovered_button, &layout);
+				set_hovered_button(user_data, new_hovered_button);
 			}
 			break;
 		}
 		case WM_NCLBUTTONDOWN: {
+			set_focused_button(hwnd, user_data, CaptionButton_None, &layout);
 			int hit_test = wparam;
 			CaptionButton clicked_button = CaptionButton_None;
 			if (hit_test == HTCLOSE) {
@@ -679,7 +1143,7 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 				clicked_button = CaptionButton_Sysmenu;
 			}
 			if (clicked_button != CaptionButton_None) {
-				set_flag(hwnd, CAPTION_BUTTON_BIT, CAPTION_BUTTON_BIT_LENGTH, clicked_button);
+				set_hovered_button(user_data, clicked_button);
 				if (clicked_button != CaptionButton_Sysmenu) {
 					return 0;		/* skip default behaviour of caption buttons except sysmenu */
 				}
@@ -719,7 +1183,8 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			return 0;
 		}
 		case WM_LBUTTONDOWN: {
-			if (GET_Y_LPARAM(lparam) <= TITLEBAR_HEIGHT) {
+			set_focused_button(hwnd, user_data, CaptionButton_None, &layout);
+			if (GET_Y_LPARAM(lparam) <= titlebar_height) {
 				SetCapture(hwnd);
 			}
 			break;
@@ -736,17 +1201,34 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 				if (key_stroke == ' ') {
 					display_menu = true;
 				}
+				else if (key_stroke == 0) {
+					/* Alt or F10 alone, there is no menu bar: toggle the keyboard navigation of the caption */
+					CaptionButton focused_button = user_data != NULL ? user_data->focused_button : CaptionButton_None;
+					set_focused_button(hwnd, user_data, focused_button == CaptionButton_None ? CaptionButton_Sysmenu : CaptionButton_None, &layout);
+					return 0;
+				}
+				else {
+					/* Alt+mnemonic runs the system menu command directly */
+					update_system_menu(hwnd, user_data, is_maximized);
+					UINT command = find_system_menu_mnemonic(hwnd, key_stroke);
+					if (command != 0) {
+						set_focused_button(hwnd, user_data, CaptionButton_None, &layout);
+						PostMessage(hwnd, WM_SYSCOMMAND, command, 0);
+						return 0;
+					}
+				}
 			}
 			else if (request == SC_MOUSEMENU) {
 				display_menu = true;
 			}
 
 			if (display_menu) {
+				set_focused_button(hwnd, user_data, CaptionButton_None, &layout);
 				HMENU hmenu = GetSystemMenu(hwnd, false);
 				if (hmenu != NULL) {
 					int cmd = TrackPopupMenuEx(hmenu,
 							TPM_RIGHTBUTTON | TPM_RETURNCMD | (GetSystemMetrics(SM_MENUDROPALIGNMENT) == 0 ? TPM_LEFTALIGN : TPM_RIGHTALIGN),
-							rect.left, rect.top+TITLEBAR_HEIGHT, hwnd, NULL);
+							rect.left, rect.top+titlebar_height, hwnd, NULL);
 					if (cmd != 0) {
 						PostMessage(hwnd, WM_SYSCOMMAND, cmd, 0);
 					}
@@ -759,14 +1241,52 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			bool is_system_menu = HIWORD(lparam);
 			HMENU hmenu = (HMENU) wparam;
 			if (is_system_menu || GetSystemMenu(hwnd, false) == hmenu) {
-				EnableMenuItem(hmenu, SC_MAXIMIZE, is_maximized ? MF_GRAYED : MF_ENABLED);
-				EnableMenuItem(hmenu, SC_RESTORE, !is_maximized ? MF_GRAYED : MF_ENABLED);
-				EnableMenuItem(hmenu, SC_SIZE, is_maximized ? MF_GRAYED : MF_ENABLED);
-				EnableMenuItem(hmenu, SC_MOVE, is_maximized ? MF_GRAYED : MF_ENABLED);
+				update_system_menu(hwnd, user_data, is_maximized);		/* up to date unless the menu was reverted */
 				return 0;
 			}
 			break;
 		}
+		case WM_KEYDOWN: {
+			if (user_data == NULL || user_data->focused_button == CaptionButton_None) {
+				break;
+			}
+			/* left to right */
+			static const CaptionButton order[] = { CaptionButton_Sysmenu, CaptionButton_Minimize, CaptionButton_Maximize, CaptionButton_Close };
+			int count = sizeof(order)/sizeof(*order), index = 0;
+			while (index < count - 1 && order[index] != user_data->focused_button) {
+				index++;
+			}
+			if (wparam == VK_LEFT || wparam == VK_RIGHT || wparam == VK_TAB) {
+				bool is_backward = wparam == VK_LEFT || (wparam == VK_TAB && GetKeyState(VK_SHIFT) < 0);
+				set_focused_button(hwnd, user_data, order[(index + (is_backward ? count - 1 : 1)) % count], &layout);
+				return 0;
+			}
+			CaptionButton pressed_button = user_data->focused_button;
+			set_focused_button(hwnd, user_data, CaptionButton_None, &layout);
+			if (wparam == VK_RETURN || wparam == VK_SPACE || (wparam == VK_DOWN && pressed_button == CaptionButton_Sysmenu)) {
+				if (pressed_button == CaptionButton_Sysmenu) {
+					PostMessage(hwnd, WM_SYSCOMMAND, SC_KEYMENU, ' ');
+				}
+				else if (pressed_button == CaptionButton_Minimize) {
+					PostMessage(hwnd, WM_SYSCOMMAND, SC_MINIMIZE, 0);
+				}
+				else if (pressed_button == CaptionButton_Maximize) {
+					PostMessage(hwnd, WM_SYSCOMMAND, is_maximized ? SC_RESTORE : SC_MAXIMIZE, 0);
+				}
+				else if (pressed_button == CaptionButton_Close) {
+					PostMessage(hwnd, WM_SYSCOMMAND, SC_CLOSE, 0);
+				}
+				return 0;
+			}
+			if (wparam == VK_ESCAPE) {
+				return 0;
+			}
+			break;								/* any other key leaves the navigation and goes on */
+		}
+		case WM_KILLFOCUS: {
+			set_focused_button(hwnd, user_data, CaptionButton_None, &layout);
+			break;
+		}
 		case WM_SETCURSOR: {
 			int hit_test = LOWORD(lparam);
 			if (hit_test == HTSYSMENU) {
@@ -778,20 +1298,28 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 		}
 		case WM_WINDOWPOSCHANGING: {
 			WINDOWPOS* wpos = (WINDOWPOS*) lparam;
-			if (wpos->flags == 0x308020) {
-				set_flag(hwnd, MAXIMIZE_SNAPPING_BIT, MAXIMIZE_SNAPPING_BIT_LENGTH, true);
+			if (user_data != NULL) {
+				RECT proposed = { wpos->x, wpos->y, wpos->x + wpos->cx, wpos->y + wpos->cy };
+				RECT work;
+				bool has_work = is_maximized && get_maximized_rect(hwnd, (wpos->flags & SWP_NOMOVE) ? NULL : &proposed, &work);
+				snap_feed(&user_data->snap, msg, wpos, is_maximized, has_work ? &work : NULL);
 			}
-			else if (wpos->flags == 0x300204) {
-				if (get_flag(hwnd, MAXIMIZE_SNAPPING_BIT, MAXIMIZE_SNAPPING_BIT_LENGTH)) {
-					if (get_flag(hwnd, IS_TASKBAR_HIDDEN_BIT, IS_TASKBAR_HIDDEN_BIT_LENGTH)) {
-						wpos->cy *= 2;
-					}
-					int system_border_width = GetSystemMetrics(SM_CYFRAME);
-					wpos->cy += 2*system_border_width;
-					wpos->y -= system_border_width;
-					set_flag(hwnd, MAXIMIZE_SNAPPING_BIT, MAXIMIZE_SNAPPING_BIT_LENGTH, false);
+#ifdef SYNC_RESIZE
+			if (user_data != NULL && user_data->is_sizing && !(wpos->flags & SWP_NOSIZE)
+				&& (wpos->cx != window_size.cx || wpos->cy != window_size.cy)) {
+				/* the default processing applies the min/max track size, draw what it leaves */
+				DefWindowProc(hwnd, msg, wparam, lparam);
+				SIZE new_size = { wpos->cx, wpos->cy };
+				HDC hdc = GetDC(hwnd);
+				HDC memdc = resize_buffer_begin(&user_data->resize_buffer, hdc, new_size, is_maximized);
+				ReleaseDC(hwnd, hdc);
+				if (memdc != NULL) {
+					FrameLayout new_layout = frame_layout(layout.metrics, new_size, is_maximized);
+					on_draw(hwnd, user_data, memdc, &new_layout);
 				}
+				return 0;
 			}
+#endif
 			break;
 		}
 		/* https://github.com/atauzki/notepad2/blob/5984878391ebbd649eaf566a0982a1a26be5deea/src/Notepad2.c#L1117 */
@@ -800,11 +1328,45 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			WINDOWPOS* wpos = (WINDOWPOS*) lparam;
 			/* wpos->flags |= SWP_NOCOPYBITS;					cause unnecessary redraw when moving */
 			if (!(wpos->flags & SWP_NOSIZE)) {
-				/* https://devblogs.microsoft.com/oldnewthing/20100412-00/?p=14353 */
-				if (is_maximized) {
+				update_system_menu(hwnd, user_data, is_maximized);
+				/* https://devblogs.microsoft.com/oldnewthing/20100412-00/?p=14353
+				   the rect is pinned in WM_WINDOWPOSCHANGING, so this only runs when the work area changed */
+				RECT work;
+				if (is_maximized && get_maximized_rect(hwnd, NULL, &work) && !EqualRect(&work, &rect)) {
 					set_maximize_window(hwnd);
 				}
-				InvalidateRect(hwnd, NULL, true);
+#ifdef RESIZE_STATS
+				if (user_data != NULL && user_data->is_sizing) {
+					resize_stats_commit(&user_data->resize_stats, &user_data->resize_commit, window_size);
+				}
+#endif
+				bool is_painted = false;
+#ifdef SYNC_RESIZE
+				if (user_data != NULL && user_data->is_sizing) {
+					bool is_presented = resize_buffer_present(&user_data->resize_buffer, hwnd, window_size, is_maximized);
+					if (!is_presented) {
+						/* the rect changed after WM_WINDOWPOSCHANGING, still paint before returning */
+						RedrawWindow(hwnd, NULL, NULL, RDW_INVALIDATE | RDW_UPDATENOW);
+					}
+					else {
+						user_data->snapshot_frame.is_valid = false;		/* shown without WM_PAINT */
+					}
+	#ifdef RESIZE_STATS
+					if (is_presented) {
+						user_data->resize_stats.presented++;
+						resize_stats_present(&user_data->resize_stats, &user_data->resize_commit, window_size);
+					}
+					else {
+						user_data->resize_stats.mismatched++;
+					}
+	#endif
+					dwm_flush();					/* one size per refresh, see resize.c */
+					is_painted = true;
+				}
+#endif
+				if (!is_painted) {
+					invalidate_window(hwnd, user_data, NULL, true);
+				}
 				return 0;
 			}
 			if ((wpos->flags & SWP_NOSIZE) && !(wpos->flags & SWP_NOMOVE) && (wpos->flags & SWP_NOZORDER)) {
@@ -812,23 +1374,92 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			}
 			break;
 		}
+		case WM_ENTERSIZEMOVE: {
+			if (user_data != NULL) {
+				snap_feed(&user_data->snap, msg, NULL, is_maximized, NULL);
+				user_data->is_sizing = true;
+#ifdef RESIZE_STATS
+				user_data->resize_stats = (ResizeStats) { 0 };
+				user_data->resize_commit = (ResizeCommit) { 0 };
+#endif
+			}
+			break;
+		}
 		case WM_EXITSIZEMOVE: {
-			if (!IsIconic(hwnd)) {
-				set_normal_pos(hwnd, &rect);
+			/* a snap to maximized must not become the normal position */
+			if (user_data != NULL && snap_feed(&user_data->snap, msg, NULL, is_maximized, NULL) == SnapAction_SaveNormal
+				&& !IsIconic(hwnd)) {
+				user_data->normal_pos = rect;
+				placement_store(user_data->placement_key, &rect, false);
+			}
+			if (user_data != NULL) {
+				user_data->is_sizing = false;
+#ifdef SYNC_RESIZE
+				resize_buffer_free(&user_data->resize_buffer);
+#endif
+#ifdef RESIZE_STATS
+				resize_stats_end(&user_data->resize_stats, &user_data->resize_commit);
+				resize_stats_add(&resize_stats_total, &user_data->resize_stats);
+	#ifndef HEADLESS
+				resize_stats_print(stdout, &user_data->resize_stats);
+	#endif
+#endif
 			}
 			break;
 		}
+		case WM_DWMCOMPOSITIONCHANGED: {
+			dwm_update_composition();
+			dwm_extend_frame(hwnd);
+			SetWindowPos(hwnd, NULL, 0, 0, 0, 0, SWP_NOZORDER | SWP_NOMOVE | SWP_NOSIZE | SWP_NOACTIVATE | SWP_FRAMECHANGED);
+			break;
+		}
+		case WM_SETTEXT:
+		case WM_SETICON: {
+			if (user_data != NULL) {
+				caption_cache_invalidate(&user_data->caption_cache);
+			}
+			invalidate_window(hwnd, user_data, &layout.title_bar, false);
+			break;
+		}
+		case WM_FRAME_READY: {
+			if (user_data != NULL && user_data->frame_ring != NULL) {
+				frame_ring_acknowledge(user_data->frame_ring);
+				invalidate_window(hwnd, user_data, &layout.client, false);
+			}
+			return 0;
+		}
+		case WM_DISPLAYCHANGE: {
+			monitor_cache_invalidate();
+			if (user_data != NULL) {
+				user_data->is_taskbar_hidden = is_taskbar_hidden(hwnd);
+			}
+			if (is_maximized) {
+				set_maximize_window(hwnd);
+			}
+			break;
+		}
+		case WM_SYSCOLORCHANGE: {
+			theme_invalidate(hwnd);
+			break;
+		}
+		case WM_THEME_CHANGED: {
+			theme_reload();
+			return 0;
+		}
 		case WM_SETTINGCHANGE: {
+			if (theme_is_setting(wparam, lparam)) {
+				theme_invalidate(hwnd);
+			}
 			if (wparam == SPI_SETWORKAREA) {
+				monitor_cache_invalidate_appbars_for(user_data);
 				WINDOWPLACEMENT wp = { .length = sizeof(WINDOWPLACEMENT) };
-				if (GetWindowPlacement(hwnd, &wp)) {
-					RECT *normal_pos = get_normal_pos(hwnd);
-					if (normal_pos != NULL) {
-						wp.rcNormalPosition = *normal_pos;
-						SetWindowPlacement(hwnd, &wp);
-					}
+				if (user_data != NULL && GetWindowPlacement(hwnd, &wp)) {
+					wp.rcNormalPosition = user_data->normal_pos;
+					SetWindowPlacement(hwnd, &wp);
+				}
+				if (user_data != NULL) {
+					user_data->is_taskbar_hidden = is_taskbar_hidden(hwnd);
 				}
-				set_flag(hwnd, IS_TASKBAR_HIDDEN_BIT, IS_TASKBAR_HIDDEN_BIT_LENGTH, is_taskbar_hidden(hwnd));
 				if (is_maximized) {
 					set_maximize_window(hwnd);
 				}
@@ -836,10 +1467,44 @@ static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 			break;
 		}
 	}
+	if (msg == monitor_taskbar_created_message() && msg != 0) {
+		monitor_cache_invalidate_appbars_for(user_data);
+		if (is_maximized) {
+			set_maximize_window(hwnd);
+		}
+	}
 
 	return DefWindowProc(hwnd, msg, wparam, lparam);
 }
 
+/* the handlers only collect what they invalidate, it is flushed once here */
+static LRESULT win_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+	UserData *user_data = (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA);		/* NULL until WM_CREATE and after WM_DESTROY */
+	if (user_data != NULL) {
+		user_data->call_depth++;
+	}
+	LRESULT result = handle_message(hwnd, msg, wparam, lparam, &user_data);
+	if (user_data != NULL) {
+		if (!user_data->is_destroyed) {
+			invalidate_flush(&user_data->invalidate, hwnd);
+		}
+		if (--user_data->call_depth == 0 && user_data->is_destroyed) {
+			pool_free(&user_data_pool, user_data);
+		}
+	}
+	return result;
+}
+
+#ifdef HEADLESS
+#include "storm.c"
+#endif
+#ifdef SOAK
+#include "soak.c"
+#endif
+#ifdef LATENCY
+#include "latency.c"
+#endif
+
 int main(void)
 {
 	HMODULE g_hmodule = GetModuleHandle(NULL);
@@ -853,14 +1518,42 @@ int main(void)
 		return 1;
 	}
 
+#if defined(SOAK) || defined(LATENCY) || defined(HEADLESS)
+	placement_set_persistent(false);		/* every run starts from the same placement */
+#endif
+#if defined(SOAK)
+	int result = soak_run(g_hmodule);
+	render_pool_shutdown();
+	text_shutdown();
+	placement_shutdown();
+	pool_release(&user_data_pool);
+	return result;
+#elif defined(LATENCY)
+	int result = latency_run(g_hmodule);
+	render_pool_shutdown();
+	text_shutdown();
+	placement_shutdown();
+	pool_release(&user_data_pool);
+	return result;
+#elif defined(HEADLESS)
+	/* there is no one to click on a headless window, drive a message storm instead */
+	int result = storm_run(g_hmodule);
+	render_pool_shutdown();
+	text_shutdown();
+	placement_shutdown();
+	pool_release(&user_data_pool);
+	return result;
+#endif
+
 	HWND window = CreateWindowEx(0 /*| WS_EX_TOOLWINDOW*/, "SWindow", "Simple Window",
-		WS_POPUP | WS_THICKFRAME | WS_MAXIMIZEBOX | WS_MINIMIZEBOX | WS_SYSMENU | WS_VISIBLE,
+		WS_POPUP | WS_THICKFRAME | WS_MAXIMIZEBOX | WS_MINIMIZEBOX | WS_SYSMENU,
 		CW_USEDEFAULT, CW_USEDEFAULT, 700, 500, NULL, NULL, g_hmodule, NULL);
 	if (window == NULL) {
 		fprintf(stderr, "ERROR: could not create window: %ld\n", GetLastError());
 		UnregisterClass("SWindow", g_hmodule);
 		return 1;
 	}
+	ShowWindow(window, get_show_command(window, SW_SHOWNORMAL));
 
 	/* https://devblogs.microsoft.com/oldnewthing/20060126-00/?p=32513 */
 	MSG msg;
@@ -868,6 +1561,10 @@ int main(void)
 		TranslateMessage(&msg);
 		DispatchMessage(&msg);
 	}
+	render_pool_shutdown();
+	text_shutdown();
+	placement_shutdown();
+	pool_release(&user_data_pool);
 
 	/* UnregisterClass("SWindow", g_hmodule); */
 	return 0;
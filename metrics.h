@@ -0,0 +1,115 @@
+/* Frame metrics
+   The geometry of the frame and the one function laying it out. The defaults can be
+   changed at compile time (cc -DFRAME_TITLEBAR_HEIGHT=40 ...) and every window can
+   get its own metrics at run time, see set_frame_metrics. Built with FIXED_METRICS
+   every window uses the compile-time metrics, so frame_layout folds to constants. */
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifndef FRAME_TITLEBAR_HEIGHT
+	#define FRAME_TITLEBAR_HEIGHT 				32
+#endif
+#ifndef FRAME_CAPTION_MENU_WIDTH
+	#define FRAME_CAPTION_MENU_WIDTH 			46
+#endif
+#ifndef FRAME_CAPTION_ICON_SIZE
+	#define FRAME_CAPTION_ICON_SIZE 			10
+#endif
+#ifndef FRAME_LEFT_PADDING
+	#define FRAME_LEFT_PADDING 					8
+#endif
+#ifndef FRAME_SYSMENU_ICON_SIZE
+	#ifdef FIXED_METRICS
+		#define FRAME_SYSMENU_ICON_SIZE 		16		/* SM_CXSMICON at 96 dpi, fixed metrics are not queried */
+	#else
+		#define FRAME_SYSMENU_ICON_SIZE 		0		/* SM_CXSMICON x SM_CYSMICON */
+	#endif
+#endif
+#ifndef FRAME_SYSMENU_HIGHLIGHT_SIZE
+	#define FRAME_SYSMENU_HIGHLIGHT_SIZE 		4
+#endif
+#ifndef FRAME_SYSMENU_HIGHLIGHT_BORDER_WIDTH
+	#define FRAME_SYSMENU_HIGHLIGHT_BORDER_WIDTH 1
+#endif
+#ifndef FRAME_BORDER_WIDTH
+	#define FRAME_BORDER_WIDTH 					1
+#endif
+#ifndef FRAME_CAPTION_FOCUS_INSET
+	#define FRAME_CAPTION_FOCUS_INSET 			3
+#endif
+
+typedef struct FrameMetrics {
+	int titlebar_height;
+	int caption_menu_width;					/* of one caption button */
+	int caption_icon_size;					/* the glyph in a caption button */
+	int left_padding;
+	int sysmenu_icon_size;					/* 0 is the small icon size of the system */
+	int sysmenu_highlight_size;
+	int sysmenu_highlight_border_width;
+	int border_width;						/* 0 when maximized */
+	int caption_focus_inset;
+} FrameMetrics;
+
+static const FrameMetrics frame_metrics_default = {
+	.titlebar_height = FRAME_TITLEBAR_HEIGHT,
+	.caption_menu_width = FRAME_CAPTION_MENU_WIDTH,
+	.caption_icon_size = FRAME_CAPTION_ICON_SIZE,
+	.left_padding = FRAME_LEFT_PADDING,
+	.sysmenu_icon_size = FRAME_SYSMENU_ICON_SIZE,
+	.sysmenu_highlight_size = FRAME_SYSMENU_HIGHLIGHT_SIZE,
+	.sysmenu_highlight_border_width = FRAME_SYSMENU_HIGHLIGHT_BORDER_WIDTH,
+	.border_width = FRAME_BORDER_WIDTH,
+	.caption_focus_inset = FRAME_CAPTION_FOCUS_INSET,
+};
+
+/* Everything painting and hit testing need, in window coordinates. */
+typedef struct FrameLayout {
+	const FrameMetrics *metrics;
+	SIZE window_size;
+	bool is_maximized;
+	int border_width;
+	SIZE sysmenu_icon;
+	RECT title_bar;
+	RECT client;
+	RECT sysmenu;							/* the highlight around the icon */
+	RECT text;								/* the room for the title */
+	RECT close, maximize, minimize;
+	SIZE min_track;
+} FrameLayout;
+
+static inline FrameLayout frame_layout(const FrameMetrics *metrics, SIZE window_size, bool is_maximized) {
+	FrameLayout layout;
+	int border_width = is_maximized ? 0 : metrics->border_width;
+	int titlebar_height = metrics->titlebar_height;
+	int button_width = metrics->caption_menu_width;
+	int highlight_size = metrics->sysmenu_highlight_size;
+	layout.metrics = metrics;
+	layout.window_size = window_size;
+	layout.is_maximized = is_maximized;
+	layout.border_width = border_width;
+	if (metrics->sysmenu_icon_size > 0) {
+		layout.sysmenu_icon = (SIZE) { metrics->sysmenu_icon_size, metrics->sysmenu_icon_size };
+	}
+	else {
+		layout.sysmenu_icon = (SIZE) { GetSystemMetrics(SM_CXSMICON), GetSystemMetrics(SM_CYSMICON) };
+	}
+	layout.title_bar = (RECT) { border_width, border_width, window_size.cx - border_width, titlebar_height };
+	layout.client = (RECT) { border_width, titlebar_height, window_size.cx - border_width, window_size.cy - border_width };
+
+	int left_padding = (metrics->left_padding > (border_width*2 + highlight_size) ? metrics->left_padding : border_width*2 + highlight_size);
+	layout.sysmenu.left = left_padding - highlight_size;
+	layout.sysmenu.top = border_width + (titlebar_height - border_width)/2 - (layout.sysmenu_icon.cy + highlight_size*2)/2;
+	layout.sysmenu.right = layout.sysmenu.left + layout.sysmenu_icon.cx + highlight_size*2;
+	layout.sysmenu.bottom = layout.sysmenu.top + layout.sysmenu_icon.cy + highlight_size*2;
+
+	layout.close = (RECT) { window_size.cx - border_width - button_width, border_width, window_size.cx - border_width, titlebar_height };
+	layout.maximize = layout.close;
+	OffsetRect(&layout.maximize, -button_width, 0);
+	layout.minimize = layout.close;
+	OffsetRect(&layout.minimize, -button_width*2, 0);
+	layout.text = (RECT) { layout.sysmenu.right + /* padding */ 1, border_width, layout.minimize.left, titlebar_height };
+	layout.min_track = (SIZE) { button_width*3 + border_width*2 + layout.sysmenu.right, titlebar_height + border_width*2 };
+	return layout;
+}
+
+#endif
@@ -0,0 +1,193 @@
+/* Monitor topology cache
+   Monitor rects, work areas and auto-hide appbars are shared by all windows of the
+   process. SHAppBarMessage is a round trip to the shell, so the appbars are only
+   queried again when a WM_DISPLAYCHANGE has actually changed the monitor geometry, or
+   on WM_SETTINGCHANGE(SPI_SETWORKAREA) and a taskbar restart, which is also how an
+   auto-hide taskbar moving to another edge (the work area stays the same) is seen. Those
+   two are broadcast to every window, the appbars are queried once per broadcast.
+   Past MONITOR_CACHE_MAX monitors, the ones left out are queried on every lookup. */
+
+#ifndef ABM_GETAUTOHIDEBAREX
+	#define ABM_GETAUTOHIDEBAREX 	0x0000000b
+#endif
+
+#define MONITOR_CACHE_MAX 16
+
+typedef struct MonitorEntry {
+	HMONITOR handle;
+	RECT rc_monitor;
+	RECT rc_work;
+	bool is_primary;
+	unsigned char autohide_edges;			/* 1 << ABE_LEFT, ABE_TOP, ABE_RIGHT, ABE_BOTTOM */
+} MonitorEntry;
+
+typedef enum AutohideEx {
+	AutohideEx_Unknown,
+	AutohideEx_Supported,
+	AutohideEx_Unsupported
+} AutohideEx;
+
+static struct {
+	bool valid;
+	bool stale;
+	bool appbars_stale;						/* query the appbars even for unchanged monitors */
+	bool is_full;							/* more monitors than MONITOR_CACHE_MAX */
+	AutohideEx autohide_ex;
+	UINT appbars_generation;				/* of the last work area change, see monitor_cache_invalidate_appbars */
+	int count;
+	MonitorEntry entries[MONITOR_CACHE_MAX];
+	MonitorEntry uncached;					/* the last one looked up past the cache */
+} monitor_cache;
+
+static bool monitor_get_info(HMONITOR monitor, MonitorEntry *entry) {
+	MONITORINFO mi;
+	mi.cbSize = sizeof(MONITORINFO);
+	if (!GetMonitorInfo(monitor, &mi)) {
+		return false;
+	}
+	*entry = (MonitorEntry) {
+		.handle = monitor,
+		.rc_monitor = mi.rcMonitor,
+		.rc_work = mi.rcWork,
+		.is_primary = mi.dwFlags & MONITORINFOF_PRIMARY,
+	};
+	return true;
+}
+
+static BOOL CALLBACK monitor_cache_add(HMONITOR monitor, HDC hdc, LPRECT rect, LPARAM lparam) {
+	(void) hdc; (void) rect;
+	int *count = (int*) lparam;
+	if (*count >= MONITOR_CACHE_MAX) {
+		monitor_cache.is_full = true;
+		return false;
+	}
+	if (monitor_get_info(monitor, &monitor_cache.entries[*count])) {
+		(*count)++;
+	}
+	return true;
+}
+
+/* ABM_GETAUTOHIDEBAREX is not answered before Windows 8, where only the primary monitor's
+   bars can be asked for; the two are compared on the primary monitor until a bar tells */
+static unsigned char monitor_query_autohide_edges(const MonitorEntry *entry) {
+	unsigned char edges = 0;
+	unsigned char legacy_edges = 0;
+	for (UINT edge = ABE_LEFT; edge <= ABE_BOTTOM; edge++) {
+		APPBARDATA abd;
+		abd.cbSize = sizeof(APPBARDATA);
+		abd.uEdge = edge;
+		abd.rc = entry->rc_monitor;
+		if (monitor_cache.autohide_ex != AutohideEx_Unsupported
+			&& (HWND) SHAppBarMessage(ABM_GETAUTOHIDEBAREX, &abd) != NULL) {
+			edges |= 1 << edge;
+		}
+		if (entry->is_primary && monitor_cache.autohide_ex != AutohideEx_Supported
+			&& (HWND) SHAppBarMessage(ABM_GETAUTOHIDEBAR, &abd) != NULL) {
+			legacy_edges |= 1 << edge;
+		}
+	}
+	if (legacy_edges & ~edges) {
+		monitor_cache.autohide_ex = AutohideEx_Unsupported;
+	}
+	else if (edges) {
+		monitor_cache.autohide_ex = AutohideEx_Supported;
+	}
+	return edges | legacy_edges;
+}
+
+static void monitor_cache_refresh(void) {
+	MonitorEntry old_entries[MONITOR_CACHE_MAX];
+	int old_count = monitor_cache.count;
+	memcpy(old_entries, monitor_cache.entries, sizeof(old_entries));
+
+	int count = 0;
+	monitor_cache.is_full = false;
+	EnumDisplayMonitors(NULL, NULL, monitor_cache_add, (LPARAM) &count);
+	monitor_cache.count = count;
+	for (int i = 0; i < count; i++) {
+		MonitorEntry *entry = &monitor_cache.entries[i];
+		bool unchanged = false;
+		for (int j = 0; j < old_count && monitor_cache.valid && !monitor_cache.appbars_stale; j++) {
+			if (old_entries[j].handle == entry->handle
+				&& EqualRect(&old_entries[j].rc_monitor, &entry->rc_monitor)
+				&& EqualRect(&old_entries[j].rc_work, &entry->rc_work)) {
+				entry->autohide_edges = old_entries[j].autohide_edges;
+				unchanged = true;
+				break;
+			}
+		}
+		if (!unchanged) {
+			entry->autohide_edges = monitor_query_autohide_edges(entry);
+		}
+	}
+	monitor_cache.valid = true;
+	monitor_cache.stale = false;
+	monitor_cache.appbars_stale = false;
+}
+
+/* call on WM_DISPLAYCHANGE */
+void monitor_cache_invalidate(void) {
+	monitor_cache.stale = true;
+}
+
+/* call on WM_SETTINGCHANGE(SPI_SETWORKAREA) and when the taskbar is created again, with the
+   generation the window has seen, and keep the one returned. The shell sends both to every
+   top-level window, so a window that has already seen the last change is the first to get
+   a new one, and the others getting the same broadcast leave the refreshed cache alone */
+UINT monitor_cache_invalidate_appbars(UINT seen_generation) {
+	if (seen_generation == monitor_cache.appbars_generation) {
+		monitor_cache.appbars_generation++;
+		monitor_cache.stale = true;
+		monitor_cache.appbars_stale = true;
+	}
+	return monitor_cache.appbars_generation;
+}
+
+/* for a new window, which has not missed any change */
+UINT monitor_cache_appbars_generation(void) {
+	return monitor_cache.appbars_generation;
+}
+
+/* the message the shell broadcasts when the taskbar is created again, the appbars may have moved */
+UINT monitor_taskbar_created_message(void) {
+	static UINT message;
+	if (message == 0) {
+		message = RegisterWindowMessage("TaskbarCreated");
+	}
+	return message;
+}
+
+static const MonitorEntry* monitor_query(HMONITOR monitor) {
+	if (!monitor_get_info(monitor, &monitor_cache.uncached)) {
+		return NULL;
+	}
+	monitor_cache.uncached.autohide_edges = monitor_query_autohide_edges(&monitor_cache.uncached);
+	return &monitor_cache.uncached;
+}
+
+static const MonitorEntry* monitor_cache_find(HMONITOR monitor) {
+	if (!monitor_cache.valid || monitor_cache.stale) {
+		monitor_cache_refresh();
+	}
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < monitor_cache.count; i++) {
+			if (monitor_cache.entries[i].handle == monitor) {
+				return &monitor_cache.entries[i];
+			}
+		}
+		if (monitor_cache.is_full) {
+			return monitor_query(monitor);	/* left out of the cache, a refresh would not add it */
+		}
+		/* a monitor we have not seen yet, the notification is still on its way */
+		monitor_cache_refresh();
+	}
+	return NULL;
+}
+
+const MonitorEntry* monitor_cache_lookup(HWND hwnd) {
+	return monitor_cache_find(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST));
+}
+
+const MonitorEntry* monitor_cache_lookup_rect(const RECT *rect) {
+	return monitor_cache_find(MonitorFromRect(rect, MONITOR_DEFAULTTONEAREST));
+}
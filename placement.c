@@ -0,0 +1,317 @@
+/* Window placement store
+   The placement (normal rect, maximized state, monitor and dpi) of every window is kept
+   in a compact binary file next to the executable. The file is read once through a
+   file mapping, and written by a background thread to a temporary file which then
+   replaces the old one, so a crash never leaves a half written state file.
+   placement_set_persistent(false), before the first window, keeps the records in
+   memory only: the benchmarks must not depend on what the previous run left. */
+
+#define PLACEMENT_MAGIC 		0x50574953	/* "SIWP" */
+#define PLACEMENT_VERSION 		1
+#define PLACEMENT_MAX_RECORDS 	128
+#define PLACEMENT_MAXIMIZED 	0x1
+
+typedef struct PlacementHeader {
+	UINT32 magic;
+	UINT32 version;
+	UINT32 count;
+	UINT32 checksum;
+} PlacementHeader;
+
+/* the windows created so far with one class name and title */
+typedef struct PlacementOrdinal {
+	UINT32 hash;
+	UINT32 count;
+} PlacementOrdinal;
+
+typedef struct PlacementRecord {
+	UINT32 key;
+	UINT32 flags;
+	INT32 normal[4];						/* left, top, right, bottom */
+	INT32 monitor[4];
+	UINT32 dpi;
+	char device[32];
+} PlacementRecord;
+
+static struct {
+	bool loaded;
+	bool is_memory_only;
+	PlacementOrdinal ordinals[PLACEMENT_MAX_RECORDS];
+	UINT32 ordinal_count;
+	CRITICAL_SECTION lock;
+	PlacementRecord records[PLACEMENT_MAX_RECORDS];
+	UINT32 count;
+	char path[MAX_PATH];
+	HANDLE writer;
+	HANDLE wake;
+	volatile LONG dirty;
+	volatile LONG quit;
+} placement;
+
+/* FNV-1a */
+UINT32 placement_hash(UINT32 hash, const void *data, size_t size) {
+	const unsigned char *bytes = (const unsigned char*) data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/* Windows are identified by their class name, their title at creation and how many
+   windows with both were created before them in the process, so the second "Editor"
+   window gets its own record and gets it back on the next start. UI thread only. */
+UINT32 placement_key(HWND hwnd) {
+	char name[MAX_PATH];
+	UINT32 hash = 2166136261u;
+	int length = GetClassName(hwnd, name, sizeof(name));
+	hash = placement_hash(hash, name, length + 1);
+	length = GetWindowText(hwnd, name, sizeof(name));
+	hash = placement_hash(hash, name, length);
+	UINT32 i = 0;
+	while (i < placement.ordinal_count && placement.ordinals[i].hash != hash) {
+		i++;
+	}
+	if (i == placement.ordinal_count) {
+		if (i == PLACEMENT_MAX_RECORDS) {
+			return hash;					/* more names than records, they share */
+		}
+		placement.ordinals[placement.ordinal_count++] = (PlacementOrdinal) { hash, 0 };
+	}
+	UINT32 ordinal = placement.ordinals[i].count++;
+	return placement_hash(hash, &ordinal, sizeof(ordinal));
+}
+
+/* false: no state file is read or written, call it before the first window */
+void placement_set_persistent(bool is_persistent) {
+	placement.is_memory_only = !is_persistent;
+}
+
+static UINT32 placement_system_dpi(void) {
+	HDC hdc = GetDC(NULL);
+	int dpi = GetDeviceCaps(hdc, LOGPIXELSX);
+	ReleaseDC(NULL, hdc);
+	return dpi > 0 ? dpi : 96;
+}
+
+static bool placement_write_file(const PlacementRecord *records, UINT32 count) {
+	char temp_path[MAX_PATH + 4];
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp", placement.path);
+	HANDLE file = CreateFile(temp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	PlacementHeader header = {
+		.magic = PLACEMENT_MAGIC,
+		.version = PLACEMENT_VERSION,
+		.count = count,
+		.checksum = placement_hash(2166136261u, records, count*sizeof(PlacementRecord)),
+	};
+	DWORD written;
+	bool ok = WriteFile(file, &header, sizeof(header), &written, NULL)
+			&& WriteFile(file, records, count*sizeof(PlacementRecord), &written, NULL)
+			&& FlushFileBuffers(file);
+	CloseHandle(file);
+	if (!ok || !MoveFileEx(temp_path, placement.path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		DeleteFile(temp_path);
+		return false;
+	}
+	return true;
+}
+
+static void placement_flush(void) {
+	if (InterlockedExchange(&placement.dirty, 0) == 0 || placement.is_memory_only) {
+		return;
+	}
+	PlacementRecord records[PLACEMENT_MAX_RECORDS];
+	EnterCriticalSection(&placement.lock);
+	UINT32 count = placement.count;
+	memcpy(records, placement.records, count*sizeof(PlacementRecord));
+	LeaveCriticalSection(&placement.lock);
+	placement_write_file(records, count);
+}
+
+static DWORD WINAPI placement_writer(LPVOID param) {
+	(void) param;
+	while (WaitForSingleObject(placement.wake, INFINITE) == WAIT_OBJECT_0) {
+		placement_flush();
+		if (placement.quit) {
+			break;
+		}
+	}
+	return 0;
+}
+
+void placement_load(void) {
+	if (placement.loaded) {
+		return;
+	}
+	placement.loaded = true;
+	InitializeCriticalSection(&placement.lock);
+	if (placement.is_memory_only) {
+		return;
+	}
+
+	DWORD length = GetModuleFileName(NULL, placement.path, MAX_PATH - 8);
+	if (length == 0) {
+		return;
+	}
+	char *ext = strrchr(placement.path, '.');
+	if (ext == NULL || strchr(ext, '\\') != NULL || strchr(ext, '/') != NULL) {
+		ext = placement.path + length;
+	}
+	strcpy(ext, ".state");
+
+	HANDLE file = CreateFile(placement.path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file != INVALID_HANDLE_VALUE) {
+		DWORD size = GetFileSize(file, NULL);
+		HANDLE mapping = size >= sizeof(PlacementHeader) && size != INVALID_FILE_SIZE ?
+							CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+		const PlacementHeader *header = mapping != NULL ?
+							(const PlacementHeader*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if (header != NULL) {
+			const PlacementRecord *records = (const PlacementRecord*) (header + 1);
+			if (header->magic == PLACEMENT_MAGIC && header->version == PLACEMENT_VERSION
+				&& header->count <= PLACEMENT_MAX_RECORDS
+				&& sizeof(PlacementHeader) + header->count*sizeof(PlacementRecord) <= size
+				&& header->checksum == placement_hash(2166136261u, records, header->count*sizeof(PlacementRecord))) {
+				memcpy(placement.records, records, header->count*sizeof(PlacementRecord));
+				placement.count = header->count;
+			}
+			UnmapViewOfFile(header);
+		}
+		if (mapping != NULL) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+	}
+
+	placement.wake = CreateEvent(NULL, false, false, NULL);
+	if (placement.wake != NULL) {
+		placement.writer = CreateThread(NULL, 0, placement_writer, NULL, 0, NULL);
+	}
+}
+
+/* wait for the pending write, call it once after the message loop */
+void placement_shutdown(void) {
+	if (placement.writer != NULL) {
+		InterlockedExchange(&placement.quit, 1);
+		SetEvent(placement.wake);
+		WaitForSingleObject(placement.writer, INFINITE);
+		CloseHandle(placement.writer);
+		placement.writer = NULL;
+	}
+	else if (placement.loaded) {
+		placement_flush();
+	}
+	if (placement.wake != NULL) {
+		CloseHandle(placement.wake);
+		placement.wake = NULL;
+	}
+}
+
+static BOOL CALLBACK placement_find_monitor(HMONITOR monitor, HDC hdc, LPRECT rect, LPARAM lparam) {
+	(void) hdc; (void) rect;
+	MONITORINFOEX mi;
+	mi.cbSize = sizeof(MONITORINFOEX);
+	MONITORINFOEX *target = (MONITORINFOEX*) lparam;
+	if (GetMonitorInfo(monitor, (MONITORINFO*) &mi) && strncmp(mi.szDevice, target->szDevice, sizeof(mi.szDevice)) == 0) {
+		*target = mi;
+		return false;
+	}
+	return true;
+}
+
+/* Look up the saved placement for key, fitted to the current monitors and dpi. */
+bool placement_restore(UINT32 key, RECT *normal_pos, bool *is_maximized) {
+	placement_load();
+	PlacementRecord record;
+	bool found = false;
+	EnterCriticalSection(&placement.lock);
+	for (UINT32 i = 0; i < placement.count; i++) {
+		if (placement.records[i].key == key) {
+			record = placement.records[i];
+			found = true;
+			break;
+		}
+	}
+	LeaveCriticalSection(&placement.lock);
+	if (!found) {
+		return false;
+	}
+
+	RECT rect = { record.normal[0], record.normal[1], record.normal[2], record.normal[3] };
+	UINT32 dpi = placement_system_dpi();
+	if (record.dpi != 0 && record.dpi != dpi) {
+		rect.right = rect.left + MulDiv(rect.right - rect.left, dpi, record.dpi);
+		rect.bottom = rect.top + MulDiv(rect.bottom - rect.top, dpi, record.dpi);
+	}
+
+	/* follow the monitor if it moved in the virtual screen, otherwise keep the rect on screen */
+	MONITORINFOEX mi;
+	mi.cbSize = sizeof(MONITORINFOEX);
+	memcpy(mi.szDevice, record.device, sizeof(mi.szDevice));
+	mi.szDevice[sizeof(mi.szDevice) - 1] = '\0';
+	SetRectEmpty(&mi.rcMonitor);
+	EnumDisplayMonitors(NULL, NULL, placement_find_monitor, (LPARAM) &mi);
+	if (!IsRectEmpty(&mi.rcMonitor)) {
+		OffsetRect(&rect, mi.rcMonitor.left - record.monitor[0], mi.rcMonitor.top - record.monitor[1]);
+	}
+	if (MonitorFromRect(&rect, MONITOR_DEFAULTTONULL) == NULL) {
+		mi.cbSize = sizeof(MONITORINFO);
+		if (!GetMonitorInfo(MonitorFromRect(&rect, MONITOR_DEFAULTTONEAREST), (MONITORINFO*) &mi)) {
+			return false;
+		}
+		OffsetRect(&rect, mi.rcWork.left - rect.left, mi.rcWork.top - rect.top);
+	}
+
+	*normal_pos = rect;
+	*is_maximized = record.flags & PLACEMENT_MAXIMIZED;
+	return true;
+}
+
+/* Update the record for key and wake the writer; the file is written off the UI thread. */
+void placement_store(UINT32 key, const RECT *normal_pos, bool is_maximized) {
+	placement_load();
+	PlacementRecord record = {
+		.key = key,
+		.flags = is_maximized ? PLACEMENT_MAXIMIZED : 0,
+		.normal = { normal_pos->left, normal_pos->top, normal_pos->right, normal_pos->bottom },
+		.dpi = placement_system_dpi(),
+	};
+	MONITORINFOEX mi;
+	mi.cbSize = sizeof(MONITORINFOEX);
+	if (GetMonitorInfo(MonitorFromRect(normal_pos, MONITOR_DEFAULTTONEAREST), (MONITORINFO*) &mi)) {
+		record.monitor[0] = mi.rcMonitor.left;
+		record.monitor[1] = mi.rcMonitor.top;
+		record.monitor[2] = mi.rcMonitor.right;
+		record.monitor[3] = mi.rcMonitor.bottom;
+		memcpy(record.device, mi.szDevice, sizeof(record.device));
+	}
+
+	EnterCriticalSection(&placement.lock);
+	UINT32 i = 0;
+	while (i < placement.count && placement.records[i].key != key) {
+		i++;
+	}
+	/* the records are kept in the order they were last stored, a full table drops the first */
+	bool changed = true;
+	if (i < placement.count) {
+		changed = i != placement.count - 1 || memcmp(&placement.records[i], &record, sizeof(record)) != 0;
+		memmove(placement.records + i, placement.records + i + 1, (placement.count - 1 - i)*sizeof(PlacementRecord));
+	}
+	else if (placement.count == PLACEMENT_MAX_RECORDS) {
+		memmove(placement.records, placement.records + 1, (PLACEMENT_MAX_RECORDS - 1)*sizeof(PlacementRecord));
+	}
+	else {
+		placement.count++;
+	}
+	placement.records[placement.count - 1] = record;
+	LeaveCriticalSection(&placement.lock);
+
+	if (changed) {
+		InterlockedExchange(&placement.dirty, 1);
+		if (placement.writer != NULL) {
+			SetEvent(placement.wake);
+		}
+	}
+}
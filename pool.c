@@ -0,0 +1,82 @@
+/* Slot pool
+   Fixed size slots, rounded up to a cache line, carved out of 64KB slabs from
+   VirtualAlloc, so the state of all the windows lives in a few contiguous pages and
+   every slot starts on its own cache line. A freed slot goes on a free list and is
+   handed out again before a new one, warm in the cache; the slabs stay until
+   pool_release, so creating and destroying windows does not go back to the heap or
+   to the system. For the UI thread only. */
+
+#define POOL_CACHE_LINE 		64
+#define POOL_SLAB_SIZE 			65536		/* the allocation granularity of VirtualAlloc */
+#define POOL_SLOT_SIZE(size) 	(((size) + POOL_CACHE_LINE - 1)/POOL_CACHE_LINE*POOL_CACHE_LINE)
+
+typedef struct PoolSlot {
+	struct PoolSlot *next;
+} PoolSlot;
+
+typedef struct Pool {
+	size_t slot_size;						/* POOL_SLOT_SIZE of the type */
+	PoolSlot *free;
+	void **slabs;
+	int slab_count;
+	int slab_capacity;
+	int used;
+} Pool;
+
+static bool pool_grow(Pool *pool) {
+	assert(pool->slot_size % POOL_CACHE_LINE == 0 && pool->slot_size <= POOL_SLAB_SIZE);
+	char *slab = (char*) VirtualAlloc(NULL, POOL_SLAB_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (slab == NULL) {
+		return false;
+	}
+	if (pool->slab_count == pool->slab_capacity) {
+		pool->slab_capacity = pool->slab_capacity ? pool->slab_capacity*2 : 4;
+		pool->slabs = (void**) realloc(pool->slabs, pool->slab_capacity*sizeof(void*));
+		assert(pool->slabs != NULL);
+	}
+	pool->slabs[pool->slab_count++] = slab;
+	/* pushed from the end, so the slots are handed out in address order */
+	size_t slot_count = POOL_SLAB_SIZE/pool->slot_size;
+	for (size_t i = slot_count; i-- > 0;) {
+		PoolSlot *slot = (PoolSlot*) (slab + i*pool->slot_size);
+		slot->next = pool->free;
+		pool->free = slot;
+	}
+	return true;
+}
+
+/* a zeroed slot, NULL when the system is out of memory */
+void* pool_alloc(Pool *pool) {
+	if (pool->free == NULL && !pool_grow(pool)) {
+		return NULL;
+	}
+	PoolSlot *slot = pool->free;
+	pool->free = slot->next;
+	pool->used++;
+	memset(slot, 0, pool->slot_size);
+	return slot;
+}
+
+void pool_free(Pool *pool, void *memory) {
+	if (memory == NULL) {
+		return;
+	}
+	PoolSlot *slot = (PoolSlot*) memory;
+	slot->next = pool->free;
+	pool->free = slot;
+	pool->used--;
+}
+
+/* give the slabs back to the system once every slot is freed */
+void pool_release(Pool *pool) {
+	if (pool->used > 0) {
+		return;								/* still in use, the process exit takes them */
+	}
+	for (int i = 0; i < pool->slab_count; i++) {
+		VirtualFree(pool->slabs[i], 0, MEM_RELEASE);
+	}
+	free(pool->slabs);
+	size_t slot_size = pool->slot_size;
+	memset(pool, 0, sizeof(Pool));
+	pool->slot_size = slot_size;
+}
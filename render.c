@@ -0,0 +1,273 @@
+/* Client area renderer
+   The client area is retained in a 32bpp top-down DIB section split into
+   RENDER_TILE_SIZE tiles (16KB each, they stay in the cache while being drawn).
+   Only dirty tiles are rasterized, in parallel on a small thread pool, by calling
+   the client draw proc once per tile; the result is presented with one BitBlt.
+   Each worker starts on its own slice of the dirty tiles and steals from the other
+   slices when it runs out, so a slow tile does not hold back the others.
+   The draw proc runs on the pool threads: it must only write the tile it is given. */
+
+#define RENDER_TILE_SIZE 		64
+#define RENDER_MAX_WORKERS 		16
+#define RENDER_MIN_PARALLEL 	4		/* dirty tiles below this are drawn on the calling thread */
+
+/* pixels points to the top-left pixel of tile, a rect in client coordinates;
+   a pixel is 0x00rrggbb, see render_pixel */
+typedef void (*RenderTileProc)(void *context, UINT32 *pixels, int stride, const RECT *tile);
+
+typedef struct Renderer {
+	HDC hdc;
+	HBITMAP bitmap;
+	HGDIOBJ old_bitmap;
+	UINT32 *pixels;
+	int stride;								/* in pixels */
+	int capacity_width, capacity_height;	/* the DIB only grows, a shrink keeps it */
+	int width, height;
+	int tiles_x, tiles_y;					/* covering width and height */
+	int tiles_stride;						/* covering capacity_width, keeps the tile indices across resizes */
+	unsigned char *dirty;					/* one per tile of the capacity */
+	int *dirty_tiles;						/* the current job */
+	RenderTileProc draw;
+	void *context;
+} Renderer;
+
+typedef struct RenderQueue {
+	volatile LONG next;
+	LONG end;
+	char padding[64 - 2*sizeof(LONG)];		/* one cache line per queue */
+} RenderQueue;
+
+static struct {
+	bool started;
+	int worker_count;						/* including the thread calling renderer_render */
+	HANDLE threads[RENDER_MAX_WORKERS];
+	HANDLE wake;							/* semaphore, one release per helper */
+	HANDLE done;
+	volatile LONG running;
+	volatile LONG quit;
+	Renderer *job;
+	RenderQueue queues[RENDER_MAX_WORKERS];
+} render_pool;
+
+UINT32 render_pixel(COLORREF color) {
+	return ((color & 0xff) << 16) | (color & 0xff00) | ((color >> 16) & 0xff);
+}
+
+static void render_tile(Renderer *renderer, int tile) {
+	int tx = tile % renderer->tiles_stride, ty = tile / renderer->tiles_stride;
+	RECT rect = { tx*RENDER_TILE_SIZE, ty*RENDER_TILE_SIZE, (tx + 1)*RENDER_TILE_SIZE, (ty + 1)*RENDER_TILE_SIZE };
+	if (rect.right > renderer->width) {
+		rect.right = renderer->width;
+	}
+	if (rect.bottom > renderer->height) {
+		rect.bottom = renderer->height;
+	}
+	renderer->draw(renderer->context, renderer->pixels + rect.top*renderer->stride + rect.left, renderer->stride, &rect);
+}
+
+static void render_drain(int worker) {
+	Renderer *renderer = render_pool.job;
+	for (int i = 0; i < render_pool.worker_count; i++) {
+		RenderQueue *queue = &render_pool.queues[(worker + i) % render_pool.worker_count];
+		LONG next;
+		while ((next = InterlockedIncrement(&queue->next) - 1) < queue->end) {
+			render_tile(renderer, renderer->dirty_tiles[next]);
+		}
+	}
+}
+
+static DWORD WINAPI render_worker(LPVOID param) {
+	int worker = (int) (INT_PTR) param;
+	while (WaitForSingleObject(render_pool.wake, INFINITE) == WAIT_OBJECT_0 && !render_pool.quit) {
+		render_drain(worker);
+		if (InterlockedDecrement(&render_pool.running) == 0) {
+			SetEvent(render_pool.done);
+		}
+	}
+	return 0;
+}
+
+static void render_pool_start(void) {
+	render_pool.started = true;
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	int count = si.dwNumberOfProcessors > RENDER_MAX_WORKERS ? RENDER_MAX_WORKERS : (int) si.dwNumberOfProcessors;
+	render_pool.worker_count = 1;
+	if (count <= 1) {
+		return;
+	}
+	render_pool.wake = CreateSemaphore(NULL, 0, RENDER_MAX_WORKERS, NULL);
+	render_pool.done = CreateEvent(NULL, false, false, NULL);
+	if (render_pool.wake == NULL || render_pool.done == NULL) {
+		return;
+	}
+	for (int i = 1; i < count; i++) {
+		render_pool.threads[i] = CreateThread(NULL, 0, render_worker, (LPVOID) (INT_PTR) i, 0, NULL);
+		if (render_pool.threads[i] == NULL) {
+			break;
+		}
+		render_pool.worker_count++;
+	}
+}
+
+/* stop the pool, call it once after the message loop */
+void render_pool_shutdown(void) {
+	if (render_pool.worker_count > 1) {
+		InterlockedExchange(&render_pool.quit, 1);
+		ReleaseSemaphore(render_pool.wake, render_pool.worker_count - 1, NULL);
+		for (int i = 1; i < render_pool.worker_count; i++) {
+			WaitForSingleObject(render_pool.threads[i], INFINITE);
+			CloseHandle(render_pool.threads[i]);
+		}
+	}
+	if (render_pool.wake != NULL) {
+		CloseHandle(render_pool.wake);
+	}
+	if (render_pool.done != NULL) {
+		CloseHandle(render_pool.done);
+	}
+	memset(&render_pool, 0, sizeof(render_pool));
+}
+
+/* NULL marks every tile */
+void renderer_invalidate(Renderer *renderer, const RECT *rect) {
+	if (renderer->dirty == NULL) {
+		return;
+	}
+	RECT all = { 0, 0, renderer->width, renderer->height }, r;
+	if (!IntersectRect(&r, rect != NULL ? rect : &all, &all)) {
+		return;
+	}
+	for (int ty = r.top/RENDER_TILE_SIZE; ty <= (r.bottom - 1)/RENDER_TILE_SIZE; ty++) {
+		for (int tx = r.left/RENDER_TILE_SIZE; tx <= (r.right - 1)/RENDER_TILE_SIZE; tx++) {
+			renderer->dirty[ty*renderer->tiles_stride + tx] = true;
+		}
+	}
+}
+
+void renderer_set_draw(Renderer *renderer, RenderTileProc draw, void *context) {
+	renderer->draw = draw;
+	renderer->context = context;
+	renderer_invalidate(renderer, NULL);
+}
+
+/* release the framebuffer, the draw proc is kept */
+void renderer_free(Renderer *renderer) {
+	if (renderer->hdc != NULL) {
+		if (renderer->old_bitmap != NULL) {
+			SelectObject(renderer->hdc, renderer->old_bitmap);
+		}
+		DeleteDC(renderer->hdc);
+	}
+	if (renderer->bitmap != NULL) {
+		DeleteObject(renderer->bitmap);
+	}
+	free(renderer->dirty);
+	free(renderer->dirty_tiles);
+	RenderTileProc draw = renderer->draw;
+	void *context = renderer->context;
+	memset(renderer, 0, sizeof(Renderer));
+	renderer->draw = draw;
+	renderer->context = context;
+}
+
+/* a size change marks every tile, the client content is laid out for the size */
+bool renderer_resize(Renderer *renderer, HDC reference, int width, int height) {
+	if (width <= 0 || height <= 0) {
+		return false;
+	}
+	if (width == renderer->width && height == renderer->height && renderer->bitmap != NULL) {
+		return true;
+	}
+	if (width > renderer->capacity_width || height > renderer->capacity_height) {
+		int capacity_width = width > renderer->capacity_width ? width : renderer->capacity_width;
+		int capacity_height = height > renderer->capacity_height ? height : renderer->capacity_height;
+		capacity_width = (capacity_width + RENDER_TILE_SIZE - 1)/RENDER_TILE_SIZE*RENDER_TILE_SIZE;
+		capacity_height = (capacity_height + RENDER_TILE_SIZE - 1)/RENDER_TILE_SIZE*RENDER_TILE_SIZE;
+		renderer_free(renderer);
+
+		BITMAPINFO bmi = { 0 };
+		bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		bmi.bmiHeader.biWidth = capacity_width;
+		bmi.bmiHeader.biHeight = -capacity_height;		/* top-down */
+		bmi.bmiHeader.biPlanes = 1;
+		bmi.bmiHeader.biBitCount = 32;
+		bmi.bmiHeader.biCompression = BI_RGB;
+		void *bits = NULL;
+		renderer->bitmap = CreateDIBSection(reference, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+		renderer->hdc = CreateCompatibleDC(reference);
+		int tile_count = (capacity_width/RENDER_TILE_SIZE)*(capacity_height/RENDER_TILE_SIZE);
+		renderer->dirty = (unsigned char*) calloc(tile_count, sizeof(unsigned char));
+		renderer->dirty_tiles = (int*) calloc(tile_count, sizeof(int));
+		assert(renderer->dirty != NULL && renderer->dirty_tiles != NULL);
+		if (renderer->bitmap == NULL || renderer->hdc == NULL) {
+			renderer_free(renderer);
+			return false;
+		}
+		renderer->old_bitmap = SelectObject(renderer->hdc, renderer->bitmap);
+		renderer->pixels = (UINT32*) bits;
+		renderer->stride = capacity_width;
+		renderer->capacity_width = capacity_width;
+		renderer->capacity_height = capacity_height;
+		renderer->tiles_stride = capacity_width/RENDER_TILE_SIZE;
+	}
+	renderer->width = width;
+	renderer->height = height;
+	renderer->tiles_x = (width + RENDER_TILE_SIZE - 1)/RENDER_TILE_SIZE;
+	renderer->tiles_y = (height + RENDER_TILE_SIZE - 1)/RENDER_TILE_SIZE;
+	renderer_invalidate(renderer, NULL);
+	return true;
+}
+
+/* rasterize the dirty tiles, returns the number of tiles drawn */
+int renderer_render(Renderer *renderer) {
+	if (renderer->bitmap == NULL || renderer->draw == NULL) {
+		return 0;
+	}
+	int count = 0;
+	for (int ty = 0; ty < renderer->tiles_y; ty++) {
+		unsigned char *dirty = renderer->dirty + ty*renderer->tiles_stride;
+		for (int tx = 0; tx < renderer->tiles_x; tx++) {
+			if (dirty[tx]) {
+				dirty[tx] = false;
+				renderer->dirty_tiles[count++] = ty*renderer->tiles_stride + tx;
+			}
+		}
+	}
+	if (count == 0) {
+		return 0;
+	}
+	GdiFlush();								/* GDI may still be writing into the DIB */
+	if (!render_pool.started) {
+		render_pool_start();
+	}
+
+	render_pool.job = renderer;
+	int workers = count < RENDER_MIN_PARALLEL ? 1 : render_pool.worker_count;
+	for (int w = 0; w < render_pool.worker_count; w++) {
+		render_pool.queues[w].next = count*w/workers;
+		render_pool.queues[w].end = w < workers ? count*(w + 1)/workers : 0;
+	}
+	if (workers > 1) {
+		render_pool.running = workers - 1;
+		ReleaseSemaphore(render_pool.wake, workers - 1, NULL);
+	}
+	render_drain(0);
+	if (workers > 1) {
+		WaitForSingleObject(render_pool.done, INFINITE);
+	}
+	render_pool.job = NULL;
+	return count;
+}
+
+/* one blit of the part of the client area inside the clip box of hdc */
+void renderer_present(Renderer *renderer, HDC hdc, int x, int y) {
+	if (renderer->bitmap == NULL) {
+		return;
+	}
+	RECT client = { x, y, x + renderer->width, y + renderer->height }, clip;
+	if (GetClipBox(hdc, &clip) != NULLREGION && IntersectRect(&clip, &clip, &client)) {
+		BitBlt(hdc, clip.left, clip.top, clip.right - clip.left, clip.bottom - clip.top,
+				renderer->hdc, clip.left - x, clip.top - y, SRCCOPY);
+	}
+}
@@ -0,0 +1,147 @@
+/* Synchronized resize
+   With SYNC_RESIZE, the frame and the client area for the size being committed are
+   drawn into a back buffer in WM_WINDOWPOSCHANGING, before the window rect changes.
+   WM_NCCALCSIZE keeps the system from copying the old bits, and WM_WINDOWPOSCHANGED
+   blits the prepared frame right away and waits for the DWM composition, so no
+   composition sees the new rect with the content of the old one (the right and bottom
+   edge jitter). Only done between WM_ENTERSIZEMOVE and WM_EXITSIZEMOVE, the buffer is
+   freed at the end of the drag.
+   DwmFlush blocks the UI thread until the composition, so a drag gets at most one
+   size per refresh of the display.
+   With RESIZE_STATS, every committed size change of a drag is counted, with how many
+   of them DWM composed at least once before content drawn for that size was presented
+   (stale, from the composition counter read at commit and at present, see
+   dwm_frame_count) and how many prepared frames did not match the committed size
+   (mismatched, the rect was changed after WM_WINDOWPOSCHANGING). Without the counter a
+   size is not timed. */
+
+#define RESIZE_BUFFER_GRANULARITY 	128		/* the buffer only grows, by this step */
+
+typedef struct ResizeBuffer {
+	HDC hdc;
+	HBITMAP bitmap;
+	HGDIOBJ old_bitmap;
+	int capacity_width, capacity_height;
+	SIZE size;								/* the window size drawn, zero when none is pending */
+	bool is_maximized;
+} ResizeBuffer;
+
+typedef struct ResizeStats {
+	UINT sizes;
+	UINT timed;								/* sizes checked against the composition counter */
+	UINT stale;
+	UINT mismatched;
+	UINT presented;
+} ResizeStats;
+
+/* the committed size no content was presented for yet */
+typedef struct ResizeCommit {
+	SIZE size;
+	UINT64 frame;							/* the composition counter at the commit */
+	bool is_pending;
+	bool is_timed;
+} ResizeCommit;
+
+void resize_buffer_free(ResizeBuffer *buffer) {
+	if (buffer->hdc != NULL) {
+		if (buffer->old_bitmap != NULL) {
+			SelectObject(buffer->hdc, buffer->old_bitmap);
+		}
+		DeleteDC(buffer->hdc);
+	}
+	if (buffer->bitmap != NULL) {
+		DeleteObject(buffer->bitmap);
+	}
+	memset(buffer, 0, sizeof(ResizeBuffer));
+}
+
+/* a dc to draw the window at size into, NULL when it could not be allocated */
+HDC resize_buffer_begin(ResizeBuffer *buffer, HDC reference, SIZE size, bool is_maximized) {
+	buffer->size = (SIZE) { 0, 0 };
+	if (size.cx <= 0 || size.cy <= 0) {
+		return NULL;
+	}
+	if (size.cx > buffer->capacity_width || size.cy > buffer->capacity_height) {
+		int capacity_width = size.cx > buffer->capacity_width ? size.cx : buffer->capacity_width;
+		int capacity_height = size.cy > buffer->capacity_height ? size.cy : buffer->capacity_height;
+		capacity_width = (capacity_width + RESIZE_BUFFER_GRANULARITY - 1)/RESIZE_BUFFER_GRANULARITY*RESIZE_BUFFER_GRANULARITY;
+		capacity_height = (capacity_height + RESIZE_BUFFER_GRANULARITY - 1)/RESIZE_BUFFER_GRANULARITY*RESIZE_BUFFER_GRANULARITY;
+		resize_buffer_free(buffer);
+		buffer->hdc = CreateCompatibleDC(reference);
+		buffer->bitmap = CreateCompatibleBitmap(reference, capacity_width, capacity_height);
+		if (buffer->hdc == NULL || buffer->bitmap == NULL) {
+			resize_buffer_free(buffer);
+			return NULL;
+		}
+		buffer->old_bitmap = SelectObject(buffer->hdc, buffer->bitmap);
+		buffer->capacity_width = capacity_width;
+		buffer->capacity_height = capacity_height;
+	}
+	buffer->size = size;
+	buffer->is_maximized = is_maximized;
+	return buffer->hdc;
+}
+
+/* blit the frame from resize_buffer_begin if it was drawn for size, the pending frame is dropped either way */
+bool resize_buffer_present(ResizeBuffer *buffer, HWND hwnd, SIZE size, bool is_maximized) {
+	bool match = buffer->hdc != NULL && buffer->size.cx == size.cx && buffer->size.cy == size.cy
+				&& buffer->is_maximized == is_maximized;
+	buffer->size = (SIZE) { 0, 0 };
+	if (!match) {
+		return false;
+	}
+	HDC hdc = GetDC(hwnd);
+	BitBlt(hdc, 0, 0, size.cx, size.cy, buffer->hdc, 0, 0, SRCCOPY);
+	ReleaseDC(hwnd, hdc);
+	ValidateRect(hwnd, NULL);
+	return true;
+}
+
+static void resize_stats_settle(ResizeStats *stats, ResizeCommit *commit) {
+	if (!commit->is_pending) {
+		return;
+	}
+	commit->is_pending = false;
+	UINT64 frame;
+	if (commit->is_timed && dwm_frame_count(&frame)) {
+		stats->timed++;
+		if (frame != commit->frame) {
+			stats->stale++;					/* a composition showed the new rect with the old content */
+		}
+	}
+}
+
+/* call when the window rect changes size, a size never presented is settled */
+void resize_stats_commit(ResizeStats *stats, ResizeCommit *commit, SIZE size) {
+	resize_stats_settle(stats, commit);
+	stats->sizes++;
+	commit->size = size;
+	commit->is_timed = dwm_frame_count(&commit->frame);
+	commit->is_pending = true;
+}
+
+/* call when content drawn for size reached the window */
+void resize_stats_present(ResizeStats *stats, ResizeCommit *commit, SIZE size) {
+	if (commit->is_pending && commit->size.cx == size.cx && commit->size.cy == size.cy) {
+		resize_stats_settle(stats, commit);
+	}
+}
+
+/* call at the end of the drag */
+void resize_stats_end(ResizeStats *stats, ResizeCommit *commit) {
+	resize_stats_settle(stats, commit);
+}
+
+void resize_stats_add(ResizeStats *total, const ResizeStats *stats) {
+	total->sizes += stats->sizes;
+	total->timed += stats->timed;
+	total->stale += stats->stale;
+	total->mismatched += stats->mismatched;
+	total->presented += stats->presented;
+}
+
+void resize_stats_print(FILE *out, const ResizeStats *stats) {
+	fprintf(out, "resize: %u sizes, %u stale of %u timed (%.1f%%), %u mismatched, %u presented before returning\n",
+			stats->sizes, stats->stale, stats->timed, stats->timed ? 100.0*stats->stale/stats->timed : 0.0,
+			stats->mismatched, stats->presented);
+}
@@ -0,0 +1,66 @@
+/* Snap/resize state machine
+   Follows a window through the modal size/move loop and through maximize, both the
+   caption button and Aero snap, using only the messages and the monitor geometry.
+   While the window is maximized every proposed rect is pinned to the maximized rect
+   in WM_WINDOWPOSCHANGING, so the window is sized once instead of being sized by the
+   system first and then corrected by another SetWindowPos and a second repaint.
+   No window is touched here: feed it recorded WINDOWPOS sequences to test it. */
+
+typedef enum SnapState {
+	SnapState_Idle,
+	SnapState_SizeMove,						/* inside the modal size/move loop */
+	SnapState_Snapped,						/* maximized by dragging, still inside the loop */
+	SnapState_Maximized,
+} SnapState;
+
+typedef enum SnapAction {
+	SnapAction_None,
+	SnapAction_Pinned,						/* the WINDOWPOS was rewritten to the maximized rect */
+	SnapAction_SaveNormal,					/* a plain move/resize ended, the rect is the new normal position */
+} SnapAction;
+
+typedef struct Snap {
+	SnapState state;
+} Snap;
+
+static bool snap_wpos_equals(const WINDOWPOS *wpos, const RECT *r) {
+	return wpos->x == r->left && wpos->y == r->top
+		&& wpos->cx == r->right - r->left && wpos->cy == r->bottom - r->top;
+}
+
+/* msg is WM_ENTERSIZEMOVE, WM_WINDOWPOSCHANGING or WM_EXITSIZEMOVE;
+   wpos and maximized_rect are only read for WM_WINDOWPOSCHANGING */
+SnapAction snap_feed(Snap *snap, UINT msg, WINDOWPOS *wpos, bool is_maximized, const RECT *maximized_rect) {
+	switch (msg) {
+		case WM_ENTERSIZEMOVE: {
+			snap->state = SnapState_SizeMove;
+			return SnapAction_None;
+		}
+		case WM_EXITSIZEMOVE: {
+			SnapState old_state = snap->state;
+			snap->state = is_maximized ? SnapState_Maximized : SnapState_Idle;
+			return old_state == SnapState_SizeMove && !is_maximized ? SnapAction_SaveNormal : SnapAction_None;
+		}
+		case WM_WINDOWPOSCHANGING: {
+			bool in_size_move = snap->state == SnapState_SizeMove || snap->state == SnapState_Snapped;
+			if (!is_maximized) {
+				snap->state = in_size_move ? SnapState_SizeMove : SnapState_Idle;
+				return SnapAction_None;
+			}
+			snap->state = in_size_move ? SnapState_Snapped : SnapState_Maximized;
+			if ((wpos->flags & SWP_NOSIZE) && (wpos->flags & SWP_NOMOVE)) {
+				return SnapAction_None;			/* z-order or show state only */
+			}
+			if (maximized_rect == NULL || snap_wpos_equals(wpos, maximized_rect)) {
+				return SnapAction_None;
+			}
+			wpos->x = maximized_rect->left;
+			wpos->y = maximized_rect->top;
+			wpos->cx = maximized_rect->right - maximized_rect->left;
+			wpos->cy = maximized_rect->bottom - maximized_rect->top;
+			wpos->flags &= ~(SWP_NOSIZE | SWP_NOMOVE);
+			return SnapAction_Pinned;
+		}
+	}
+	return SnapAction_None;
+}
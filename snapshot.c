@@ -0,0 +1,361 @@
+/* Snapshots
+   The first snapshot of a window (snapshot_window, WM_PRINT, WM_PRINTCLIENT) gives it
+   a SnapshotFrame, a top-down 32bpp DIB of the whole window: from then on WM_PAINT
+   draws the update region into it and blits that part to the window, so the frame is
+   always what the window shows and every later snapshot is a copy of it, with no
+   paint. Windows that are never captured do not have one.
+   snapshot_copy copies or box filters the frame down by an integer factor (SSE2 when
+   the target has it), into a Snapshot that keeps its buffer across calls, and a
+   SnapshotStream writes the snapshots as a numbered sequence of raw (bgr0, no header)
+   or PNG (stored deflate, no compression cost) files. */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SNAPSHOT_SSE2 			1
+#endif
+
+#define SNAPSHOT_FRAME_GRANULARITY 	128		/* the frame only grows, by this step */
+#define SNAPSHOT_MAX_FACTOR 		16		/* 16x16 samples of 255 still fit 16 bits */
+
+typedef struct SnapshotFrame {
+	HDC hdc;								/* NULL until the window is captured */
+	HBITMAP bitmap;
+	HGDIOBJ old_bitmap;
+	UINT32 *pixels;							/* 0x00rrggbb, see render_pixel */
+	int stride;								/* in pixels */
+	int capacity_width, capacity_height;
+	SIZE size;								/* the window size drawn */
+	bool is_valid;							/* every pixel of size is what the window shows */
+} SnapshotFrame;
+
+typedef struct Snapshot {
+	UINT32 *pixels;							/* width*height, top-down */
+	int width, height;
+	size_t capacity;						/* in pixels */
+} Snapshot;
+
+typedef enum SnapshotFormat {
+	SnapshotFormat_Raw,
+	SnapshotFormat_Png,
+} SnapshotFormat;
+
+typedef struct SnapshotStream {
+	const char *pattern;					/* a printf pattern with one %u for the frame number, "frame%05u.png" */
+	SnapshotFormat format;
+	int factor;								/* see snapshot_copy */
+	UINT frame;								/* the number of the next file */
+	Snapshot snapshot;
+	unsigned char *encoded;
+	size_t encoded_capacity;
+} SnapshotStream;
+
+void snapshot_frame_free(SnapshotFrame *frame) {
+	if (frame->hdc != NULL) {
+		if (frame->old_bitmap != NULL) {
+			SelectObject(frame->hdc, frame->old_bitmap);
+		}
+		DeleteDC(frame->hdc);
+	}
+	if (frame->bitmap != NULL) {
+		DeleteObject(frame->bitmap);
+	}
+	memset(frame, 0, sizeof(SnapshotFrame));
+}
+
+/* a dc to draw the window at size into, NULL when it could not be allocated;
+   a new size leaves the frame invalid until all of it is drawn */
+HDC snapshot_frame_begin(SnapshotFrame *frame, HDC reference, SIZE size) {
+	if (size.cx <= 0 || size.cy <= 0) {
+		return NULL;
+	}
+	if (size.cx > frame->capacity_width || size.cy > frame->capacity_height) {
+		int capacity_width = size.cx > frame->capacity_width ? size.cx : frame->capacity_width;
+		int capacity_height = size.cy > frame->capacity_height ? size.cy : frame->capacity_height;
+		capacity_width = (capacity_width + SNAPSHOT_FRAME_GRANULARITY - 1)/SNAPSHOT_FRAME_GRANULARITY*SNAPSHOT_FRAME_GRANULARITY;
+		capacity_height = (capacity_height + SNAPSHOT_FRAME_GRANULARITY - 1)/SNAPSHOT_FRAME_GRANULARITY*SNAPSHOT_FRAME_GRANULARITY;
+		snapshot_frame_free(frame);
+
+		BITMAPINFO bmi = { 0 };
+		bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		bmi.bmiHeader.biWidth = capacity_width;
+		bmi.bmiHeader.biHeight = -capacity_height;		/* top-down */
+		bmi.bmiHeader.biPlanes = 1;
+		bmi.bmiHeader.biBitCount = 32;
+		bmi.bmiHeader.biCompression = BI_RGB;
+		void *bits = NULL;
+		frame->bitmap = CreateDIBSection(reference, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+		frame->hdc = CreateCompatibleDC(reference);
+		if (frame->bitmap == NULL || frame->hdc == NULL) {
+			snapshot_frame_free(frame);
+			return NULL;
+		}
+		frame->old_bitmap = SelectObject(frame->hdc, frame->bitmap);
+		frame->pixels = (UINT32*) bits;
+		frame->stride = capacity_width;
+		frame->capacity_width = capacity_width;
+		frame->capacity_height = capacity_height;
+	}
+	if (frame->size.cx != size.cx || frame->size.cy != size.cy) {
+		frame->size = size;
+		frame->is_valid = false;
+	}
+	return frame->hdc;
+}
+
+static bool snapshot_reserve(Snapshot *snapshot, int width, int height) {
+	size_t count = (size_t) width*height;
+	if (count > snapshot->capacity) {
+		UINT32 *pixels = (UINT32*) realloc(snapshot->pixels, count*sizeof(UINT32));
+		if (pixels == NULL) {
+			return false;
+		}
+		snapshot->pixels = pixels;
+		snapshot->capacity = count;
+	}
+	snapshot->width = width;
+	snapshot->height = height;
+	return true;
+}
+
+/* the rounded average of the factor x factor block at src: (sum + count/2)/count, with
+   count = factor*factor, is a multiply high by reciprocal = 65536/count, which falls
+   short by one at most, and a correction */
+UINT32 snapshot_box_scalar(const UINT32 *src, int stride, int factor, UINT32 count, UINT32 reciprocal) {
+	UINT32 sum[4] = { 0 };
+	for (int y = 0; y < factor; y++, src += stride) {
+		for (int x = 0; x < factor; x++) {
+			for (int c = 0; c < 4; c++) {
+				sum[c] += (src[x] >> (c*8)) & 0xff;
+			}
+		}
+	}
+	UINT32 pixel = 0;
+	for (int c = 0; c < 4; c++) {
+		UINT32 value = sum[c] + count/2;
+		UINT32 quotient = (value*reciprocal) >> 16;
+		quotient += value - quotient*count >= count;
+		pixel |= quotient << (c*8);
+	}
+	return pixel;
+}
+
+/* snapshot_box_scalar with the four channels of two pixels at once */
+static UINT32 snapshot_box(const UINT32 *src, int stride, int factor, UINT32 count, UINT32 reciprocal) {
+#ifdef SNAPSHOT_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;						/* two pixels of four 16-bit channels */
+	for (int y = 0; y < factor; y++, src += stride) {
+		int x = 0;
+		for (; x + 4 <= factor; x += 4) {
+			__m128i p = _mm_loadu_si128((const __m128i*) (src + x));
+			sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(p, zero));
+			sum = _mm_add_epi16(sum, _mm_unpackhi_epi8(p, zero));
+		}
+		for (; x + 2 <= factor; x += 2) {
+			sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (src + x)), zero));
+		}
+		if (x < factor) {
+			sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_cvtsi32_si128((int) src[x]), zero));
+		}
+	}
+	sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+	sum = _mm_add_epi16(sum, _mm_set1_epi16((short) (count/2)));
+	__m128i quotient = _mm_mulhi_epu16(sum, _mm_set1_epi16((short) reciprocal));
+	__m128i remainder = _mm_sub_epi16(sum, _mm_mullo_epi16(quotient, _mm_set1_epi16((short) count)));
+	quotient = _mm_sub_epi16(quotient, _mm_cmpgt_epi16(remainder, _mm_set1_epi16((short) (count - 1))));
+	return (UINT32) _mm_cvtsi128_si32(_mm_packus_epi16(quotient, quotient));
+#else
+	return snapshot_box_scalar(src, stride, factor, count, reciprocal);
+#endif
+}
+
+/* width x height pixels of a 32bpp buffer, reduced factor times (1 to SNAPSHOT_MAX_FACTOR)
+   with a box filter; the last width % factor columns and height % factor rows are dropped */
+bool snapshot_copy(Snapshot *snapshot, const UINT32 *pixels, int stride, int width, int height, int factor) {
+	if (factor < 1 || factor > SNAPSHOT_MAX_FACTOR || width/factor <= 0 || height/factor <= 0) {
+		return false;
+	}
+	if (!snapshot_reserve(snapshot, width/factor, height/factor)) {
+		return false;
+	}
+	if (factor == 1) {
+		for (int y = 0; y < height; y++) {
+			memcpy(snapshot->pixels + y*width, pixels + y*stride, width*sizeof(UINT32));
+		}
+		return true;
+	}
+	UINT32 count = factor*factor;
+	UINT32 reciprocal = 65536/count;
+	for (int y = 0; y < snapshot->height; y++) {
+		const UINT32 *src = pixels + y*factor*stride;
+		UINT32 *dst = snapshot->pixels + y*snapshot->width;
+		for (int x = 0; x < snapshot->width; x++) {
+			dst[x] = snapshot_box(src + x*factor, stride, factor, count, reciprocal);
+		}
+	}
+	return true;
+}
+
+void snapshot_free(Snapshot *snapshot) {
+	free(snapshot->pixels);
+	memset(snapshot, 0, sizeof(Snapshot));
+}
+
+static UINT32 snapshot_crc_table[256];
+
+static UINT32 snapshot_crc(UINT32 crc, const unsigned char *data, size_t size) {
+	if (snapshot_crc_table[1] == 0) {
+		for (UINT32 n = 0; n < 256; n++) {
+			UINT32 c = n;
+			for (int k = 0; k < 8; k++) {
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			snapshot_crc_table[n] = c;
+		}
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = snapshot_crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static UINT32 snapshot_adler(const unsigned char *data, size_t size) {
+	UINT32 a = 1, b = 0;
+	while (size > 0) {
+		size_t count = size < 5552 ? size : 5552;	/* the most bytes before b can overflow */
+		size -= count;
+		while (count-- > 0) {
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+static unsigned char* snapshot_put32(unsigned char *out, UINT32 value) {
+	out[0] = (unsigned char) (value >> 24);
+	out[1] = (unsigned char) (value >> 16);
+	out[2] = (unsigned char) (value >> 8);
+	out[3] = (unsigned char) value;
+	return out + 4;
+}
+
+/* the chunk whose type and data were written at start, followed by its crc */
+static unsigned char* snapshot_end_chunk(unsigned char *start, unsigned char *out) {
+	snapshot_put32(start, (UINT32) (out - start - 8));
+	return snapshot_put32(out, snapshot_crc(0, start + 4, out - start - 4));
+}
+
+/* 8-bit RGB, every row unfiltered and the zlib stream made of stored blocks */
+static size_t snapshot_encode_png(const Snapshot *snapshot, unsigned char *out) {
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	unsigned char *start = out;
+	memcpy(out, signature, 8);
+	out += 8;
+
+	unsigned char *chunk = out;
+	out = snapshot_put32(out, 0);
+	memcpy(out, "IHDR", 4);
+	out = snapshot_put32(out + 4, (UINT32) snapshot->width);
+	out = snapshot_put32(out, (UINT32) snapshot->height);
+	*out++ = 8;								/* bit depth */
+	*out++ = 2;								/* truecolor */
+	*out++ = 0;
+	*out++ = 0;
+	*out++ = 0;
+	out = snapshot_end_chunk(chunk, out);
+
+	chunk = out;
+	out = snapshot_put32(out, 0);
+	memcpy(out, "IDAT", 4);
+	out += 4;
+	*out++ = 0x78;							/* deflate, 32K window, no compression */
+	*out++ = 0x01;
+	size_t row_size = 1 + (size_t) snapshot->width*3;
+	size_t data_size = row_size*snapshot->height;
+	size_t blocks = (data_size + 65534)/65535;
+	/* the rows go past the room of the block headers, then every block is moved down behind its header */
+	unsigned char *rows = out + blocks*5;
+	unsigned char *row = rows;
+	for (int y = 0; y < snapshot->height; y++) {
+		const UINT32 *pixels = snapshot->pixels + y*snapshot->width;
+		*row++ = 0;							/* filter: none */
+		for (int x = 0; x < snapshot->width; x++, row += 3) {
+			row[0] = (unsigned char) (pixels[x] >> 16);
+			row[1] = (unsigned char) (pixels[x] >> 8);
+			row[2] = (unsigned char) pixels[x];
+		}
+	}
+	UINT32 adler = snapshot_adler(rows, data_size);
+	for (size_t offset = 0; offset < data_size; offset += 65535) {
+		size_t block = data_size - offset < 65535 ? data_size - offset : 65535;
+		*out++ = offset + block == data_size;	/* BFINAL, BTYPE 00 */
+		*out++ = (unsigned char) block;
+		*out++ = (unsigned char) (block >> 8);
+		*out++ = (unsigned char) ~block;
+		*out++ = (unsigned char) (~block >> 8);
+		memmove(out, rows + offset, block);
+		out += block;
+	}
+	out = snapshot_put32(out, adler);
+	out = snapshot_end_chunk(chunk, out);
+
+	chunk = out;
+	out = snapshot_put32(out, 0);
+	memcpy(out, "IEND", 4);
+	out = snapshot_end_chunk(chunk, out + 4);
+	return out - start;
+}
+
+static size_t snapshot_png_size(const Snapshot *snapshot) {
+	size_t data = (1 + (size_t) snapshot->width*3)*snapshot->height;
+	size_t blocks = (data + 65534)/65535;
+	return 8 + 25 + 12 + 2 + data + blocks*5 + 4 + 12;
+}
+
+static bool snapshot_write_file(const char *path, const void *data, size_t size) {
+	HANDLE file = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	DWORD written;
+	bool ok = WriteFile(file, data, (DWORD) size, &written, NULL) && written == size;
+	CloseHandle(file);
+	return ok;
+}
+
+/* write the snapshot of the stream as the next file of the sequence */
+bool snapshot_stream_write(SnapshotStream *stream) {
+	const Snapshot *snapshot = &stream->snapshot;
+	char path[MAX_PATH];
+	snprintf(path, sizeof(path), stream->pattern, stream->frame);
+	bool ok;
+	if (stream->format == SnapshotFormat_Png) {
+		size_t size = snapshot_png_size(snapshot);
+		if (size > stream->encoded_capacity) {
+			unsigned char *encoded = (unsigned char*) realloc(stream->encoded, size);
+			if (encoded == NULL) {
+				return false;
+			}
+			stream->encoded = encoded;
+			stream->encoded_capacity = size;
+		}
+		size = snapshot_encode_png(snapshot, stream->encoded);
+		ok = snapshot_write_file(path, stream->encoded, size);
+	}
+	else {
+		ok = snapshot_write_file(path, snapshot->pixels, (size_t) snapshot->width*snapshot->height*sizeof(UINT32));
+	}
+	stream->frame += ok;
+	return ok;
+}
+
+void snapshot_stream_free(SnapshotStream *stream) {
+	snapshot_free(&stream->snapshot);
+	free(stream->encoded);
+	stream->encoded = NULL;
+	stream->encoded_capacity = 0;
+}
@@ -0,0 +1,177 @@
+/* Soak run (SOAK only)
+   Drives SIW_SOAK_WINDOWS windows through SIW_SOAK_PHASES phases of SIW_SOAK_ITERATIONS
+   caption hover, resize, maximize/restore, title change and activation sequences at
+   full speed, then reports messages/sec, paints/sec, the peak and final GDI/USER
+   handle counts and the private bytes (the commit charge, PagefileUsage). The first phase
+   warms up the caches and is the baseline; the run fails when the handles or the private
+   bytes end up above it. */
+
+#ifndef HEADLESS
+#include <psapi.h>
+#endif
+
+#define SOAK_DEFAULT_WINDOWS 		4
+#define SOAK_DEFAULT_PHASES 		10
+#define SOAK_DEFAULT_ITERATIONS 	1000
+#define SOAK_HANDLE_SLACK 			8
+#define SOAK_COMMIT_SLACK 			(1024*1024)
+
+typedef struct SoakSample {
+	DWORD gdi_objects;
+	DWORD user_objects;
+	SIZE_T private_bytes;					/* committed, heap and everything else the process allocated */
+} SoakSample;
+
+static struct {
+	WNDPROC proc;
+	UINT64 messages;
+	UINT64 paints;
+} soak;
+
+static int soak_env(const char *name, int fallback) {
+	const char *value = getenv(name);
+	int n = value != NULL ? atoi(value) : 0;
+	return n > 0 ? n : fallback;
+}
+
+static LRESULT soak_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
+	soak.messages++;
+	if (msg == WM_PAINT) {
+		soak.paints++;
+	}
+	return soak.proc(hwnd, msg, wparam, lparam);
+}
+
+static void soak_pump(void) {
+	MSG msg;
+	while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+		if (msg.message == WM_QUIT) {
+			continue;						/* posted by WM_DESTROY */
+		}
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+}
+
+static SoakSample soak_sample(void) {
+	SoakSample sample = {
+		.gdi_objects = GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS),
+		.user_objects = GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS),
+	};
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+		sample.private_bytes = pmc.PagefileUsage;
+	}
+	return sample;
+}
+
+/* one user session in fast forward */
+static void soak_iteration(HWND hwnd, int iteration) {
+	static const int hit_tests[] = { HTSYSMENU, HTCAPTION, HTMINBUTTON, HTMAXBUTTON, HTCLOSE };
+	RECT rect;
+	GetWindowRect(hwnd, &rect);
+	LPARAM caption = MAKELPARAM(rect.left + 8, rect.top + FRAME_TITLEBAR_HEIGHT/2);
+
+	SetActiveWindow(hwnd);
+	for (size_t i = 0; i < sizeof(hit_tests)/sizeof(*hit_tests); i++) {
+		SendMessage(hwnd, WM_NCMOUSEMOVE, hit_tests[i], caption);
+		UpdateWindow(hwnd);
+	}
+	SendMessage(hwnd, WM_NCMOUSELEAVE, 0, 0);
+
+	int delta = (iteration & 1) ? -16 : 16;
+	SendMessage(hwnd, WM_ENTERSIZEMOVE, 0, 0);
+	SetWindowPos(hwnd, NULL, 0, 0, rect.right - rect.left + delta, rect.bottom - rect.top + delta,
+				SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOMOVE);
+	UpdateWindow(hwnd);
+	SendMessage(hwnd, WM_EXITSIZEMOVE, 0, 0);
+
+	if (iteration % 8 == 0) {
+		ShowWindow(hwnd, SW_MAXIMIZE);
+		UpdateWindow(hwnd);
+		ShowWindow(hwnd, SW_RESTORE);
+		UpdateWindow(hwnd);
+	}
+	if (iteration % 4 == 0) {
+		char title[32];
+		snprintf(title, sizeof(title), "Soak Window %d", iteration % 100);
+		SetWindowText(hwnd, title);
+		UpdateWindow(hwnd);
+	}
+	soak_pump();
+}
+
+int soak_run(HMODULE hmodule) {
+	int window_count = soak_env("SIW_SOAK_WINDOWS", SOAK_DEFAULT_WINDOWS);
+	int phases = soak_env("SIW_SOAK_PHASES", SOAK_DEFAULT_PHASES);
+	int iterations = soak_env("SIW_SOAK_ITERATIONS", SOAK_DEFAULT_ITERATIONS);
+
+	soak.proc = (WNDPROC) win_proc;
+	if (!register_window_class("SoakWindow", (WNDPROC) soak_proc)) {
+		fprintf(stderr, "ERROR: could not register class: %ld\n", GetLastError());
+		return 1;
+	}
+	HWND *windows = (HWND*) calloc(window_count, sizeof(HWND));
+	assert(windows != NULL);
+	for (int i = 0; i < window_count; i++) {
+		windows[i] = CreateWindowEx(0, "SoakWindow", "Soak Window",
+			WS_POPUP | WS_THICKFRAME | WS_MAXIMIZEBOX | WS_MINIMIZEBOX | WS_SYSMENU | WS_VISIBLE,
+			40 + i*24, 40 + i*24, 700, 500, NULL, NULL, hmodule, NULL);
+		if (windows[i] == NULL) {
+			fprintf(stderr, "ERROR: could not create window %d: %ld\n", i, GetLastError());
+			return 1;
+		}
+	}
+	soak_pump();
+
+	printf("%6s %12s %12s %8s %8s %12s\n", "phase", "msgs/sec", "paints/sec", "gdi", "user", "private");
+	SoakSample baseline = { 0 }, peak = { 0 }, sample = { 0 };
+	for (int phase = 0; phase < phases; phase++) {
+		UINT64 messages = soak.messages, paints = soak.paints;
+		DWORD start = GetTickCount();
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			for (int i = 0; i < window_count; i++) {
+				soak_iteration(windows[i], phase*iterations + iteration);
+			}
+		}
+		double seconds = (GetTickCount() - start)/1000.0;
+		if (seconds <= 0) {
+			seconds = 0.001;
+		}
+		sample = soak_sample();
+		if (phase == 0) {
+			baseline = sample;
+		}
+		peak.gdi_objects = sample.gdi_objects > peak.gdi_objects ? sample.gdi_objects : peak.gdi_objects;
+		peak.user_objects = sample.user_objects > peak.user_objects ? sample.user_objects : peak.user_objects;
+		peak.private_bytes = sample.private_bytes > peak.private_bytes ? sample.private_bytes : peak.private_bytes;
+		printf("%6d %12.0f %12.0f %8lu %8lu %12lu\n", phase,
+				(soak.messages - messages)/seconds, (soak.paints - paints)/seconds,
+				(unsigned long) sample.gdi_objects, (unsigned long) sample.user_objects, (unsigned long) sample.private_bytes);
+		fflush(stdout);
+	}
+	printf("peak: gdi %lu, user %lu, private bytes %lu\n",
+			(unsigned long) peak.gdi_objects, (unsigned long) peak.user_objects, (unsigned long) peak.private_bytes);
+	fflush(stdout);
+
+	for (int i = 0; i < window_count; i++) {
+		DestroyWindow(windows[i]);
+	}
+	soak_pump();
+	free(windows);
+
+	bool failed = false;
+	if (sample.gdi_objects > baseline.gdi_objects + SOAK_HANDLE_SLACK) {
+		fprintf(stderr, "ERROR: GDI handles grew from %lu to %lu\n", (unsigned long) baseline.gdi_objects, (unsigned long) sample.gdi_objects);
+		failed = true;
+	}
+	if (sample.user_objects > baseline.user_objects + SOAK_HANDLE_SLACK) {
+		fprintf(stderr, "ERROR: USER handles grew from %lu to %lu\n", (unsigned long) baseline.user_objects, (unsigned long) sample.user_objects);
+		failed = true;
+	}
+	if (sample.private_bytes > baseline.private_bytes + SOAK_COMMIT_SLACK) {
+		fprintf(stderr, "ERROR: private bytes grew from %lu to %lu\n", (unsigned long) baseline.private_bytes, (unsigned long) sample.private_bytes);
+		failed = true;
+	}
+	return failed ? 1 : 0;
+}
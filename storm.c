@@ -0,0 +1,422 @@
+/* Message storm (HEADLESS only)
+   Creates SIW_WINDOWS windows and drives SIW_ROUNDS rounds of synthetic activation,
+   caption hover, interactive resize and maximize/restore through win_proc, then
+   prints the throughput per message type. The monitors and the auto-hide taskbars
+   are set with SIW_MONITORS and SIW_AUTOHIDE, see headless.c; SIW_PRINT traces
+   every message.
+   After the storm, the checks replay recorded sequences through the pieces that can
+   be checked without a screen, compare the caption text of the glyph atlas with GDI
+   and exercise the snapshots; the run exits with 1 when one of them fails. */
+
+#define STORM_DEFAULT_WINDOWS 	256
+#define STORM_DEFAULT_ROUNDS 	20
+
+static int storm_env(const char *name, int fallback) {
+	const char *value = getenv(name);
+	int n = value != NULL ? atoi(value) : 0;
+	return n > 0 ? n : fallback;
+}
+
+/* one message of a recorded sequence and what snap_feed must make of it */
+typedef struct StormSnapStep {
+	UINT msg;
+	bool is_maximized;
+	RECT proposed;							/* WM_WINDOWPOSCHANGING only, empty is SWP_NOMOVE | SWP_NOSIZE */
+	SnapAction action;
+	SnapState state;
+} StormSnapStep;
+
+typedef struct StormSnapSequence {
+	const char *name;
+	SnapState initial;
+	int count;
+	StormSnapStep steps[8];
+} StormSnapSequence;
+
+/* WINDOWPOS sequences recorded from the modal loop, the work area is 0,0,1920,1040 */
+static const StormSnapSequence storm_snap_sequences[] = {
+	{ "drag move", SnapState_Idle, 4, {
+		{ WM_ENTERSIZEMOVE, false, { 0 }, SnapAction_None, SnapState_SizeMove },
+		{ WM_WINDOWPOSCHANGING, false, { 110, 100, 810, 600 }, SnapAction_None, SnapState_SizeMove },
+		{ WM_WINDOWPOSCHANGING, false, { 140, 120, 840, 620 }, SnapAction_None, SnapState_SizeMove },
+		{ WM_EXITSIZEMOVE, false, { 0 }, SnapAction_SaveNormal, SnapState_Idle },
+	} },
+	{ "aero snap", SnapState_Idle, 5, {
+		{ WM_ENTERSIZEMOVE, false, { 0 }, SnapAction_None, SnapState_SizeMove },
+		{ WM_WINDOWPOSCHANGING, false, { 300, 4, 1000, 504 }, SnapAction_None, SnapState_SizeMove },
+		{ WM_WINDOWPOSCHANGING, true, { -8, -8, 1928, 1048 }, SnapAction_Pinned, SnapState_Snapped },
+		{ WM_WINDOWPOSCHANGING, true, { 0, 0, 1920, 1040 }, SnapAction_None, SnapState_Snapped },
+		{ WM_EXITSIZEMOVE, true, { 0 }, SnapAction_None, SnapState_Maximized },
+	} },
+	{ "maximize", SnapState_Idle, 3, {
+		{ WM_WINDOWPOSCHANGING, true, { -8, -8, 1928, 1048 }, SnapAction_Pinned, SnapState_Maximized },
+		{ WM_WINDOWPOSCHANGING, true, { 0 }, SnapAction_None, SnapState_Maximized },
+		{ WM_WINDOWPOSCHANGING, true, { 0, 0, 1920, 1040 }, SnapAction_None, SnapState_Maximized },
+	} },
+	{ "restore", SnapState_Maximized, 1, {
+		{ WM_WINDOWPOSCHANGING, false, { 100, 100, 800, 600 }, SnapAction_None, SnapState_Idle },
+	} },
+	{ "drag out", SnapState_Maximized, 4, {
+		{ WM_ENTERSIZEMOVE, true, { 0 }, SnapAction_None, SnapState_SizeMove },
+		{ WM_WINDOWPOSCHANGING, true, { 0, 0, 1920, 1040 }, SnapAction_None, SnapState_Snapped },
+		{ WM_WINDOWPOSCHANGING, false, { 600, 10, 1300, 510 }, SnapAction_None, SnapState_SizeMove },
+		{ WM_EXITSIZEMOVE, false, { 0 }, SnapAction_SaveNormal, SnapState_Idle },
+	} },
+};
+
+static int storm_check_snap(void) {
+	const RECT work = { 0, 0, 1920, 1040 };
+	int failures = 0;
+	for (size_t i = 0; i < sizeof(storm_snap_sequences)/sizeof(*storm_snap_sequences); i++) {
+		const StormSnapSequence *sequence = &storm_snap_sequences[i];
+		Snap snap = { sequence->initial };
+		for (int j = 0; j < sequence->count; j++) {
+			const StormSnapStep *step = &sequence->steps[j];
+			WINDOWPOS wpos = {
+				.x = step->proposed.left, .y = step->proposed.top,
+				.cx = step->proposed.right - step->proposed.left, .cy = step->proposed.bottom - step->proposed.top,
+				.flags = IsRectEmpty(&step->proposed) ? SWP_NOMOVE | SWP_NOSIZE : 0,
+			};
+			SnapAction action = snap_feed(&snap, step->msg, &wpos, step->is_maximized, &work);
+			bool pinned = action != SnapAction_Pinned || (wpos.x == work.left && wpos.y == work.top
+							&& wpos.cx == work.right - work.left && wpos.cy == work.bottom - work.top);
+			if (action != step->action || snap.state != step->state || !pinned) {
+				fprintf(stderr, "ERROR: snap %s, step %d: action %d state %d, expected %d %d\n",
+						sequence->name, j, action, snap.state, step->action, step->state);
+				failures++;
+				break;
+			}
+		}
+	}
+	printf("snap: %d of %d sequences replayed\n",
+			(int) (sizeof(storm_snap_sequences)/sizeof(*storm_snap_sequences)) - failures,
+			(int) (sizeof(storm_snap_sequences)/sizeof(*storm_snap_sequences)));
+	return failures;
+}
+
+typedef struct StormDib {
+	HDC hdc;
+	HBITMAP bitmap;
+	HGDIOBJ old_bitmap;
+	UINT32 *pixels;							/* top-down */
+} StormDib;
+
+static StormDib storm_dib(HDC reference, int width, int height) {
+	BITMAPINFO bmi = { 0 };
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = width;
+	bmi.bmiHeader.biHeight = -height;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+	StormDib dib = { .hdc = CreateCompatibleDC(reference) };
+	void *bits = NULL;
+	dib.bitmap = CreateDIBSection(reference, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+	assert(dib.hdc != NULL && dib.bitmap != NULL);
+	dib.old_bitmap = SelectObject(dib.hdc, dib.bitmap);
+	dib.pixels = (UINT32*) bits;
+	return dib;
+}
+
+static void storm_dib_free(StormDib *dib) {
+	SelectObject(dib->hdc, dib->old_bitmap);
+	DeleteDC(dib->hdc);
+	DeleteObject(dib->bitmap);
+}
+
+/* the caption text the atlas blends into the title bar against the same title bar drawn by GDI */
+static int storm_check_caption(HMODULE hmodule) {
+	static const char *const titles[] = {
+		"Storm Window",
+		"A title too long for the caption of a window this narrow, it ends with an ellipsis "
+		"and is longer than a cached run, so it is fitted again on every paint",
+	};
+	int failures = 0;
+	for (size_t i = 0; i < sizeof(titles)/sizeof(*titles); i++) {
+		HWND hwnd = CreateWindowEx(0, "SWindow", titles[i], WS_POPUP | WS_THICKFRAME | WS_SYSMENU | WS_VISIBLE,
+								60, 60, 400, 300, NULL, NULL, hmodule, NULL);
+		assert(hwnd != NULL);
+		headless_pump();
+		UpdateWindow(hwnd);
+		RECT rect;
+		GetWindowRect(hwnd, &rect);
+		SIZE size = { rect.right - rect.left, FRAME_TITLEBAR_HEIGHT };
+		FrameLayout layout = frame_layout(frame_metrics((UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA)),
+										(SIZE) { size.cx, rect.bottom - rect.top }, IsZoomed(hwnd));
+
+		HDC hdc = GetDC(hwnd);
+		StormDib shown = storm_dib(hdc, size.cx, size.cy), reference = storm_dib(hdc, size.cx, size.cy);
+		BitBlt(shown.hdc, 0, 0, size.cx, size.cy, hdc, 0, 0, SRCCOPY);
+		ReleaseDC(hwnd, hdc);
+		on_draw_title_bar(hwnd, reference.hdc, NULL, &layout, !!GetFocus());
+		GdiFlush();
+
+		int mismatched = 0, ink = 0;
+		UINT32 caption = reference.pixels[layout.text.top*size.cx + layout.text.right - 1];
+		for (int y = layout.text.top; y < layout.text.bottom; y++) {
+			for (int x = layout.text.left; x < layout.text.right; x++) {
+				mismatched += shown.pixels[y*size.cx + x] != reference.pixels[y*size.cx + x];
+				ink += reference.pixels[y*size.cx + x] != caption;
+			}
+		}
+		if (mismatched > 0 || ink == 0) {
+			fprintf(stderr, "ERROR: caption \"%.16s...\": %d of %d pixels differ from GDI, %d drawn\n", titles[i], mismatched,
+					(int) ((layout.text.right - layout.text.left)*(layout.text.bottom - layout.text.top)), ink);
+			failures++;
+		}
+		storm_dib_free(&shown);
+		storm_dib_free(&reference);
+		DestroyWindow(hwnd);
+		headless_pump();
+	}
+	printf("caption: %d of %d titles match GDI\n", (int) (sizeof(titles)/sizeof(*titles)) - failures,
+			(int) (sizeof(titles)/sizeof(*titles)));
+	return failures;
+}
+
+#define STORM_SNAPSHOT_RATE 	30			/* per second, of an idle window */
+#define STORM_SNAPSHOT_PATH 	"siw_storm%u.png"
+
+static UINT32 storm_read32(const unsigned char *in) {
+	return ((UINT32) in[0] << 24) | ((UINT32) in[1] << 16) | ((UINT32) in[2] << 8) | in[3];
+}
+
+/* read back a PNG of snapshot_encode_png, every chunk crc, the zlib stream of stored
+   blocks and its adler included, and compare its pixels with snapshot */
+static bool storm_read_png(const char *path, const Snapshot *snapshot) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char *png = (unsigned char*) malloc(size > 0 ? size : 1);
+	assert(png != NULL);
+	bool ok = size > 8 && fread(png, 1, size, file) == (size_t) size && memcmp(png, "\x89PNG\r\n\x1a\n", 8) == 0;
+	fclose(file);
+
+	size_t row_size = 1 + (size_t) snapshot->width*3, data_size = row_size*snapshot->height;
+	unsigned char *zlib = (unsigned char*) malloc(size), *data = (unsigned char*) malloc(data_size);
+	assert(zlib != NULL && data != NULL);
+	size_t zlib_size = 0;
+	bool has_header = false, has_end = false;
+	for (long offset = 8; ok && !has_end; ) {
+		UINT32 length = offset + 12 <= size ? storm_read32(png + offset) : 0;
+		ok = offset + 12 + (long) length <= size
+			&& snapshot_crc(0, png + offset + 4, length + 4) == storm_read32(png + offset + 8 + length);
+		const unsigned char *chunk = png + offset + 8;
+		if (ok && memcmp(png + offset + 4, "IHDR", 4) == 0) {
+			has_header = length == 13 && storm_read32(chunk) == (UINT32) snapshot->width
+						&& storm_read32(chunk + 4) == (UINT32) snapshot->height && chunk[8] == 8 && chunk[9] == 2;
+		}
+		else if (ok && memcmp(png + offset + 4, "IDAT", 4) == 0) {
+			memcpy(zlib + zlib_size, chunk, length);
+			zlib_size += length;
+		}
+		has_end = ok && memcmp(png + offset + 4, "IEND", 4) == 0;
+		offset += 12 + length;
+	}
+	ok = ok && has_header && has_end && zlib_size >= 6 && (zlib[0]*256 + zlib[1]) % 31 == 0 && (zlib[0] & 0x0f) == 8;
+
+	size_t in = 2, out = 0;
+	for (bool is_final = false; ok && !is_final; ) {
+		UINT32 block = in + 5 <= zlib_size ? zlib[in + 1] | (zlib[in + 2] << 8) : 0;
+		ok = in + 5 <= zlib_size && (zlib[in] & 0x06) == 0 && (block ^ (zlib[in + 3] | (zlib[in + 4] << 8))) == 0xffff
+			&& in + 5 + block <= zlib_size && out + block <= data_size;
+		if (ok) {
+			is_final = zlib[in] & 1;
+			memcpy(data + out, zlib + in + 5, block);
+			in += 5 + block;
+			out += block;
+		}
+	}
+	ok = ok && out == data_size && in + 4 == zlib_size && snapshot_adler(data, data_size) == storm_read32(zlib + in);
+	for (int y = 0; ok && y < snapshot->height; y++) {
+		const unsigned char *row = data + y*row_size;
+		ok = row[0] == 0;
+		for (int x = 0; ok && x < snapshot->width; x++) {
+			ok = ((UINT32) row[1 + x*3] << 16 | (UINT32) row[2 + x*3] << 8 | row[3 + x*3]) == (snapshot->pixels[y*snapshot->width + x] & 0xffffff);
+		}
+	}
+	free(data);
+	free(zlib);
+	free(png);
+	return ok;
+}
+
+/* an idle window captured STORM_SNAPSHOT_RATE times a second is never painted again,
+   the box filter matches the scalar one for every factor, and a PNG reads back */
+static int storm_check_snapshot(HMODULE hmodule) {
+	int failures = 0;
+	HWND hwnd = CreateWindowEx(0, "SWindow", "Snapshot Window", WS_POPUP | WS_THICKFRAME | WS_SYSMENU | WS_VISIBLE,
+							80, 80, 640, 480, NULL, NULL, hmodule, NULL);
+	assert(hwnd != NULL);
+	headless_pump();
+	UpdateWindow(hwnd);
+
+	Snapshot snapshot = { 0 };
+	snapshot_window(hwnd, 1, &snapshot);		/* gives the window its frame, the one paint */
+	UINT64 paints = headless.stats[WM_PAINT].count;
+	bool is_same = true;
+	for (int i = 0; i < STORM_SNAPSHOT_RATE; i++) {
+		Sleep(1000/STORM_SNAPSHOT_RATE);
+		headless_pump();
+		is_same = snapshot_window(hwnd, 1, &snapshot) && is_same;
+	}
+	HDC hdc = GetDC(hwnd);
+	StormDib shown = storm_dib(hdc, snapshot.width, snapshot.height);
+	BitBlt(shown.hdc, 0, 0, snapshot.width, snapshot.height, hdc, 0, 0, SRCCOPY);
+	ReleaseDC(hwnd, hdc);
+	GdiFlush();
+	is_same = is_same && memcmp(shown.pixels, snapshot.pixels, (size_t) snapshot.width*snapshot.height*sizeof(UINT32)) == 0;
+	storm_dib_free(&shown);
+	UINT64 repaints = headless.stats[WM_PAINT].count - paints;
+	if (repaints > 0 || !is_same) {
+		fprintf(stderr, "ERROR: snapshot: %llu paints for %d snapshots of an idle window, %s what it shows\n",
+				(unsigned long long) repaints, STORM_SNAPSHOT_RATE, is_same ? "same as" : "differs from");
+		failures++;
+	}
+
+	/* printing the client area alone leaves the caption rows and the borders as they were */
+	struct { UINT msg; LPARAM flags; } prints[] = {
+		{ WM_PRINTCLIENT, PRF_CLIENT }, { WM_PRINT, PRF_CLIENT }, { WM_PRINT, PRF_CLIENT | PRF_NONCLIENT }
+	};
+	FrameLayout layout = get_frame_layout(hwnd, (UserData*) GetWindowLongPtr(hwnd, GWLP_USERDATA), NULL);
+	const UINT32 sentinel = 0x00123456;
+	int mismatched_prints = 0;
+	for (size_t i = 0; i < sizeof(prints)/sizeof(prints[0]); i++) {
+		hdc = GetDC(hwnd);
+		StormDib printed = storm_dib(hdc, snapshot.width, snapshot.height);
+		ReleaseDC(hwnd, hdc);
+		for (int p = 0; p < snapshot.width*snapshot.height; p++) {
+			printed.pixels[p] = sentinel;
+		}
+		SendMessage(hwnd, prints[i].msg, (WPARAM) printed.hdc, prints[i].flags);
+		GdiFlush();
+		bool ok = true;
+		for (int y = 0; ok && y < snapshot.height; y++) {
+			for (int x = 0; ok && x < snapshot.width; x++) {
+				bool is_printed = (prints[i].flags & PRF_NONCLIENT) || PtInRect(&layout.client, (POINT) { x, y });
+				UINT32 pixel = printed.pixels[y*snapshot.width + x];
+				ok = pixel == (is_printed ? snapshot.pixels[y*snapshot.width + x] : sentinel);
+			}
+		}
+		if (!ok) {
+			fprintf(stderr, "ERROR: snapshot: %s with flags 0x%x differs outside or inside the parts asked for\n",
+					prints[i].msg == WM_PRINT ? "WM_PRINT" : "WM_PRINTCLIENT", (unsigned) prints[i].flags);
+			mismatched_prints++;
+		}
+		storm_dib_free(&printed);
+	}
+	failures += mismatched_prints > 0;
+
+	/* an odd size, so the dropped columns and rows are there too */
+	enum { width = 203, height = 131 };
+	UINT32 *pixels = (UINT32*) malloc(width*height*sizeof(UINT32));
+	assert(pixels != NULL);
+	UINT32 seed = 1;
+	for (int i = 0; i < width*height; i++) {
+		seed = seed*1664525u + 1013904223u;
+		pixels[i] = (i & 64) ? seed >> 8 : 0xffffff - (seed >> 24);		/* noise and near white, the rounding extremes */
+	}
+	int mismatched_factors = 0;
+	for (int factor = 2; factor <= SNAPSHOT_MAX_FACTOR; factor++) {
+		UINT32 count = factor*factor;
+		bool ok = snapshot_copy(&snapshot, pixels, width, width, height, factor)
+				&& snapshot.width == width/factor && snapshot.height == height/factor;
+		for (int y = 0; ok && y < snapshot.height; y++) {
+			for (int x = 0; ok && x < snapshot.width; x++) {
+				ok = snapshot.pixels[y*snapshot.width + x]
+					== snapshot_box_scalar(pixels + y*factor*width + x*factor, width, factor, count, 65536/count);
+			}
+		}
+		if (!ok) {
+			fprintf(stderr, "ERROR: snapshot: factor %d differs from the scalar box filter\n", factor);
+			mismatched_factors++;
+		}
+	}
+	free(pixels);
+	failures += mismatched_factors > 0;
+
+	SnapshotStream stream = { .pattern = STORM_SNAPSHOT_PATH, .format = SnapshotFormat_Png, .factor = 3 };
+	char path[MAX_PATH];
+	snprintf(path, sizeof(path), STORM_SNAPSHOT_PATH, 0u);
+	bool is_read = snapshot_stream_frame(&stream, hwnd) && storm_read_png(path, &stream.snapshot);
+	remove(path);
+	if (!is_read) {
+		fprintf(stderr, "ERROR: snapshot: %s does not read back as the snapshot written\n", path);
+		failures++;
+	}
+	snapshot_stream_free(&stream);
+	snapshot_free(&snapshot);
+	DestroyWindow(hwnd);
+	headless_pump();
+	printf("snapshot: %llu paints for %d idle snapshots, factors 2 to %d %s the scalar filter, png %s, %d of %d prints keep to their parts\n",
+			(unsigned long long) repaints, STORM_SNAPSHOT_RATE, SNAPSHOT_MAX_FACTOR,
+			mismatched_factors > 0 ? "differ from" : "match", is_read ? "read back" : "failed",
+			(int) (sizeof(prints)/sizeof(prints[0])) - mismatched_prints, (int) (sizeof(prints)/sizeof(prints[0])));
+	return failures;
+}
+
+int storm_run(HMODULE hmodule) {
+	int window_count = storm_env("SIW_WINDOWS", STORM_DEFAULT_WINDOWS);
+	int rounds = storm_env("SIW_ROUNDS", STORM_DEFAULT_ROUNDS);
+	print_message = getenv("SIW_PRINT") != NULL;
+
+	HWND *windows = (HWND*) calloc(window_count, sizeof(HWND));
+	assert(windows != NULL);
+	for (int i = 0; i < window_count; i++) {
+		windows[i] = CreateWindowEx(0, "SWindow", "Storm Window",
+			WS_POPUP | WS_THICKFRAME | WS_MAXIMIZEBOX | WS_MINIMIZEBOX | WS_SYSMENU | WS_VISIBLE,
+			40 + (i % 32)*16, 40 + (i / 32 % 32)*16, 700, 500, NULL, NULL, hmodule, NULL);
+		if (windows[i] == NULL) {
+			fprintf(stderr, "ERROR: could not create window %d: %ld\n", i, GetLastError());
+			return 1;
+		}
+	}
+	headless_pump();
+	headless_reset_stats();
+
+	UINT64 start = headless_now_ns();
+	for (int round = 0; round < rounds; round++) {
+		for (int i = 0; i < window_count; i++) {
+			HWND hwnd = windows[i];
+			SetActiveWindow(hwnd);
+			RECT rect;
+			GetWindowRect(hwnd, &rect);
+			/* sweep the caption from the system menu to the close button, then leave it */
+			for (int x = rect.left + 4; x < rect.right; x += FRAME_CAPTION_MENU_WIDTH/2) {
+				headless_mouse_move(hwnd, x, rect.top + FRAME_TITLEBAR_HEIGHT/2);
+				headless_pump();
+			}
+			headless_mouse_move(hwnd, (rect.left + rect.right)/2, (rect.top + rect.bottom)/2);
+			headless_drag_resize(hwnd, (round & 1) ? -32 : 32, (round & 1) ? -24 : 24, 4);
+			ShowWindow(hwnd, (round + i) % 4 == 0 ? SW_MAXIMIZE : SW_RESTORE);
+			headless_pump();
+		}
+	}
+	double seconds = (double) (headless_now_ns() - start)/1e9;
+
+	headless_report(stdout, messages, messages_len);
+#ifdef RESIZE_STATS
+	resize_stats_print(stdout, &resize_stats_total);
+#endif
+	UINT64 total = 0;
+	for (UINT msg = 0; msg <= HEADLESS_STAT_MESSAGES; msg++) {
+		total += headless.stats[msg].count;
+	}
+	printf("%d windows, %d rounds, %llu messages in %.3f s (%.0f msgs/sec)\n",
+			window_count, rounds, (unsigned long long) total, seconds, seconds > 0 ? total/seconds : 0);
+
+	for (int i = 0; i < window_count; i++) {
+		DestroyWindow(windows[i]);
+	}
+	headless_pump();
+	free(windows);
+
+	int failures = storm_check_snap();
+	failures += storm_check_caption(hmodule);
+	failures += storm_check_snapshot(hmodule);
+	return failures > 0;
+}
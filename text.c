@@ -0,0 +1,288 @@
+/* Text
+   A font is rasterized once, when text_font first asks for it: GDI (or the bundled
+   rasterizer of headless.c) draws every glyph from ' ' to 0xff white on black into a
+   32bpp DIB, and the coverage, cropped to the ink, is packed into an 8-bit atlas with
+   the advance of the glyph. Measuring is then a sum of advances, and text_fit keeps
+   the last runs it laid out (the caption is fitted again on every paint of a resized
+   title bar). text_draw blends the coverage of each glyph into a 32bpp pixel buffer,
+   a DIB section or a tile of the client renderer, with no GDI call.
+   A font is DPI independent here, the size is in pixels and every size is its own font.
+   The atlas is never written after text_font returns, so text_draw may run on the
+   render threads; text_font and text_fit belong to the UI thread. */
+
+#define TEXT_MAX_FONTS 			8
+#define TEXT_FIRST_CHAR 		' '
+#define TEXT_GLYPH_COUNT 		(256 - TEXT_FIRST_CHAR)
+#define TEXT_ATLAS_WIDTH 		256
+#define TEXT_GLYPH_PADDING 		2			/* around the pen, for the overhang of a glyph */
+#define TEXT_RUN_CACHE 			8
+#define TEXT_RUN_MAX_LENGTH 	128			/* longer strings are fitted on every call */
+#define TEXT_ELLIPSIS 			"..."
+
+typedef struct TextGlyph {
+	short x, y;								/* in the atlas */
+	short width, height;					/* of the ink, 0 for a space */
+	short left, top;						/* of the ink, from the pen and the top of the line */
+	short advance;
+} TextGlyph;
+
+/* the part of a string that fits a width, see text_fit */
+typedef struct TextRun {
+	UINT32 hash;
+	int length;
+	int max_width;
+	int fit_length;							/* of the string, without the ellipsis */
+	int width;								/* with the ellipsis */
+	bool has_ellipsis;
+} TextRun;
+
+typedef struct TextFont {
+	char family[LF_FACESIZE];
+	int size;								/* in pixels */
+	int weight;
+	HFONT hfont;							/* for the GDI fallback, see dr_caption */
+	int height;								/* of a line */
+	TextGlyph glyphs[TEXT_GLYPH_COUNT];
+	unsigned char *atlas;					/* TEXT_ATLAS_WIDTH wide */
+	int atlas_height;
+	TextRun runs[TEXT_RUN_CACHE];
+	char run_strings[TEXT_RUN_CACHE][TEXT_RUN_MAX_LENGTH];	/* of runs, a hash match is checked against them */
+	int next_run;
+} TextFont;
+
+static struct {
+	TextFont *fonts[TEXT_MAX_FONTS];
+	int font_count;
+} text;
+
+static HFONT text_create_hfont(const char *family, int size, int weight) {
+	HFONT hfont = CreateFont(-size, 0, 0, 0, weight, 0, 0, 0,
+							DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+							ANTIALIASED_QUALITY, DEFAULT_PITCH, family);
+	if (hfont == NULL) {
+		HFONT def_font = GetStockObject(DEFAULT_GUI_FONT);
+		LOGFONT lf;
+		GetObject(def_font, sizeof(LOGFONT), &lf);
+		lf.lfHeight = -size;
+		lf.lfWeight = weight;
+		lf.lfQuality = ANTIALIASED_QUALITY;
+		hfont = CreateFontIndirect(&lf);
+	}
+	return hfont;
+}
+
+/* shelf packing, one row of glyphs as high as the line */
+static bool text_rasterize(TextFont *font) {
+	HDC hdc = CreateCompatibleDC(NULL);
+	if (hdc == NULL) {
+		return false;
+	}
+	HGDIOBJ old_font = SelectObject(hdc, font->hfont);
+	SIZE line;
+	GetTextExtentPoint32(hdc, "Ag", 2, &line);
+	font->height = line.cy;
+	int cell_width = 0;
+	for (int i = 0; i < TEXT_GLYPH_COUNT; i++) {
+		char c = (char) (TEXT_FIRST_CHAR + i);
+		SIZE extent;
+		GetTextExtentPoint32(hdc, &c, 1, &extent);
+		font->glyphs[i].advance = (short) extent.cx;
+		cell_width = extent.cx > cell_width ? extent.cx : cell_width;
+	}
+	cell_width += TEXT_GLYPH_PADDING*2;
+
+	BITMAPINFO bmi = { 0 };
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = cell_width;
+	bmi.bmiHeader.biHeight = -font->height;		/* top-down */
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+	void *bits = NULL;
+	HBITMAP bitmap = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+	if (bitmap == NULL) {
+		SelectObject(hdc, old_font);
+		DeleteDC(hdc);
+		return false;
+	}
+	HGDIOBJ old_bitmap = SelectObject(hdc, bitmap);
+	SetTextColor(hdc, RGB(255, 255, 255));
+	SetBkMode(hdc, TRANSPARENT);
+	UINT32 *cell = (UINT32*) bits;
+
+	int pen_x = 0, pen_y = 0;
+	font->atlas_height = font->height;
+	font->atlas = (unsigned char*) calloc(TEXT_ATLAS_WIDTH*font->atlas_height, 1);
+	assert(font->atlas != NULL);
+	for (int i = 0; i < TEXT_GLYPH_COUNT; i++) {
+		char c = (char) (TEXT_FIRST_CHAR + i);
+		memset(cell, 0, cell_width*font->height*sizeof(UINT32));
+		ExtTextOut(hdc, TEXT_GLYPH_PADDING, 0, 0, NULL, &c, 1, NULL);
+		GdiFlush();
+
+		/* crop to the ink, the coverage is the green channel */
+		int left = cell_width, right = 0, top = font->height, bottom = 0;
+		for (int y = 0; y < font->height; y++) {
+			for (int x = 0; x < cell_width; x++) {
+				if (cell[y*cell_width + x] & 0xff00) {
+					left = x < left ? x : left;
+					right = x + 1 > right ? x + 1 : right;
+					top = y < top ? y : top;
+					bottom = y + 1 > bottom ? y + 1 : bottom;
+				}
+			}
+		}
+		TextGlyph *glyph = &font->glyphs[i];
+		if (right <= left) {
+			continue;						/* no ink */
+		}
+		int width = right - left, height = bottom - top;
+		if (pen_x + width > TEXT_ATLAS_WIDTH) {
+			pen_x = 0;
+			pen_y += font->height;
+		}
+		if (pen_y + font->height > font->atlas_height) {
+			int atlas_height = font->atlas_height*2;
+			font->atlas = (unsigned char*) realloc(font->atlas, TEXT_ATLAS_WIDTH*atlas_height);
+			assert(font->atlas != NULL);
+			memset(font->atlas + TEXT_ATLAS_WIDTH*font->atlas_height, 0, TEXT_ATLAS_WIDTH*(atlas_height - font->atlas_height));
+			font->atlas_height = atlas_height;
+		}
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				font->atlas[(pen_y + y)*TEXT_ATLAS_WIDTH + pen_x + x] = (unsigned char) ((cell[(top + y)*cell_width + left + x] >> 8) & 0xff);
+			}
+		}
+		glyph->x = (short) pen_x;
+		glyph->y = (short) pen_y;
+		glyph->width = (short) width;
+		glyph->height = (short) height;
+		glyph->left = (short) (left - TEXT_GLYPH_PADDING);
+		glyph->top = (short) top;
+		pen_x += width;
+	}
+
+	SelectObject(hdc, old_bitmap);
+	DeleteObject(bitmap);
+	SelectObject(hdc, old_font);
+	DeleteDC(hdc);
+	return true;
+}
+
+/* the font of family at size pixels, rasterized on the first call; NULL when it could not be */
+TextFont* text_font(const char *family, int size, int weight) {
+	for (int i = 0; i < text.font_count; i++) {
+		TextFont *font = text.fonts[i];
+		if (font->size == size && font->weight == weight && strcmp(font->family, family) == 0) {
+			return font;
+		}
+	}
+	if (text.font_count == TEXT_MAX_FONTS) {
+		return NULL;
+	}
+	TextFont *font = (TextFont*) calloc(1, sizeof(TextFont));
+	assert(font != NULL);
+	snprintf(font->family, sizeof(font->family), "%s", family);
+	font->size = size;
+	font->weight = weight;
+	font->hfont = text_create_hfont(family, size, weight);
+	if (font->hfont == NULL || !text_rasterize(font)) {
+		if (font->hfont != NULL) {
+			DeleteObject(font->hfont);
+		}
+		free(font->atlas);
+		free(font);
+		return NULL;
+	}
+	text.fonts[text.font_count++] = font;
+	return font;
+}
+
+void text_shutdown(void) {
+	for (int i = 0; i < text.font_count; i++) {
+		DeleteObject(text.fonts[i]->hfont);
+		free(text.fonts[i]->atlas);
+		free(text.fonts[i]);
+	}
+	text.font_count = 0;
+}
+
+static const TextGlyph* text_glyph(const TextFont *font, char c) {
+	unsigned char index = (unsigned char) c;
+	return index >= TEXT_FIRST_CHAR ? &font->glyphs[index - TEXT_FIRST_CHAR] : &font->glyphs['?' - TEXT_FIRST_CHAR];
+}
+
+int text_width(const TextFont *font, const char *string, int length) {
+	int width = 0;
+	for (int i = 0; i < length; i++) {
+		width += text_glyph(font, string[i])->advance;
+	}
+	return width;
+}
+
+/* the longest prefix of string that fits max_width, followed by an ellipsis when it is not all of it */
+TextRun text_fit(TextFont *font, const char *string, int length, int max_width) {
+	UINT32 hash = 2166136261u;				/* FNV-1a */
+	for (int i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char) string[i])*16777619u;
+	}
+	for (int i = 0; i < TEXT_RUN_CACHE; i++) {
+		TextRun *run = &font->runs[i];
+		if (run->hash == hash && run->length == length && run->max_width == max_width
+			&& memcmp(font->run_strings[i], string, length) == 0) {
+			return *run;
+		}
+	}
+	TextRun run = { .hash = hash, .length = length, .max_width = max_width, .fit_length = length };
+	run.width = text_width(font, string, length);
+	if (run.width > max_width) {
+		int ellipsis_width = text_width(font, TEXT_ELLIPSIS, 3);
+		while (run.width + ellipsis_width > max_width && run.fit_length > 1) {
+			run.width -= text_glyph(font, string[--run.fit_length])->advance;
+		}
+		run.width += ellipsis_width;
+		run.has_ellipsis = true;
+	}
+	if (length <= TEXT_RUN_MAX_LENGTH) {
+		font->runs[font->next_run] = run;
+		memcpy(font->run_strings[font->next_run], string, length);
+		font->next_run = (font->next_run + 1) % TEXT_RUN_CACHE;
+	}
+	return run;
+}
+
+/* pixels is the pixel at area.left, area.top of a 32bpp buffer (0x00rrggbb, see
+   render_pixel) and only area is written; x, y is the top-left of the line, in the
+   coordinates of area. Returns the advance. */
+int text_draw(const TextFont *font, UINT32 *pixels, int stride, const RECT *area, int x, int y,
+			const char *string, int length, COLORREF color) {
+	UINT32 pixel = render_pixel(color);
+	int red = (pixel >> 16) & 0xff, green = (pixel >> 8) & 0xff, blue = pixel & 0xff;
+	int pen_x = x;
+	for (int i = 0; i < length; i++) {
+		const TextGlyph *glyph = text_glyph(font, string[i]);
+		RECT ink = { pen_x + glyph->left, y + glyph->top, pen_x + glyph->left + glyph->width, y + glyph->top + glyph->height };
+		pen_x += glyph->advance;
+		RECT visible;
+		if (glyph->width == 0 || !IntersectRect(&visible, &ink, area)) {
+			continue;
+		}
+		for (int py = visible.top; py < visible.bottom; py++) {
+			const unsigned char *coverage = font->atlas + (glyph->y + py - ink.top)*TEXT_ATLAS_WIDTH + glyph->x + visible.left - ink.left;
+			UINT32 *row = pixels + (py - area->top)*stride + visible.left - area->left;
+			for (int px = 0; px < visible.right - visible.left; px++) {
+				int alpha = coverage[px];
+				if (alpha == 0) {
+					continue;
+				}
+				UINT32 dst = row[px];
+				int r = (dst >> 16) & 0xff, g = (dst >> 8) & 0xff, b = dst & 0xff;
+				r += (red - r)*alpha/255;
+				g += (green - g)*alpha/255;
+				b += (blue - b)*alpha/255;
+				row[px] = (UINT32) ((r << 16) | (g << 8) | b);
+			}
+		}
+	}
+	return pen_x - x;
+}
@@ -0,0 +1,302 @@
+/* Theme
+   Every color painted comes from one table, computed when the theme changes: the
+   palette of the theme (dark, light, the system colors in high contrast, or a user
+   theme file next to the executable) is expanded into the colors of both focus states
+   and of the hovered buttons, so a paint only looks colors up.
+   WM_SETTINGCHANGE and WM_SYSCOLORCHANGE reach every top-level window; the first one
+   posts WM_THEME_CHANGED to itself, which reloads the theme once and invalidates all
+   the registered windows in one pass. */
+
+#define WM_THEME_CHANGED 		(WM_APP + 2)
+#define THEME_HOVER_ALPHA 		20
+#define THEME_PERSONALIZE_KEY 	"Software\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize"
+
+typedef enum ThemeKind {
+	ThemeKind_Dark,
+	ThemeKind_Light,
+	ThemeKind_HighContrast,
+	ThemeKind_File,
+} ThemeKind;
+
+/* what a theme defines, colors are bgr as the winapi */
+typedef struct ThemePalette {
+	unsigned long border;
+	unsigned long background;
+	unsigned long caption[2];				/* indexed by has_focus */
+	unsigned long caption_text[2];
+	unsigned long close_hover;
+	unsigned long close_hover_text;
+	unsigned long button_hover;				/* the maximize and minimize buttons */
+	unsigned long button_hover_text;
+} ThemePalette;
+
+/* what a paint uses in one focus state */
+typedef struct ThemeColors {
+	unsigned long border;
+	unsigned long background;
+	unsigned long caption;
+	unsigned long caption_text;
+	unsigned long sysmenu_hover;
+	unsigned long sysmenu_hover_border;
+	unsigned long close_hover;
+	unsigned long close_hover_text;
+	unsigned long button_hover;
+	unsigned long button_hover_text;
+} ThemeColors;
+
+static const ThemePalette theme_dark = {
+	.border = 0x4f4f4f,
+	.background = 0x1e1e1e,
+	.caption = { 0x2f2f2f, 0x000000 },
+	.caption_text = { 0x7f7f7f, 0xffffff },
+	.close_hover = 0x2311e8,
+	.close_hover_text = 0xffffff,
+	.button_hover = 0x1a1a1a,
+	.button_hover_text = 0xffffff,
+};
+
+static const ThemePalette theme_light = {
+	.border = 0xaaaaaa,
+	.background = 0xf9f9f9,
+	.caption = { 0xf3f3f3, 0xffffff },
+	.caption_text = { 0x999999, 0x000000 },
+	.close_hover = 0x2311e8,
+	.close_hover_text = 0xffffff,
+	.button_hover = 0xe5e5e5,
+	.button_hover_text = 0x000000,
+};
+
+static struct {
+	bool loaded;
+	HWND pending;							/* the window WM_THEME_CHANGED is posted to, NULL when none is */
+	ThemeKind kind;
+	UINT generation;						/* bumped on every change, see theme_generation */
+	ThemeColors colors[2];					/* indexed by has_focus */
+	HWND *windows;
+	int window_count;
+	int window_capacity;
+} theme;
+
+/* NOTE: Both bg and fg are in rgb */
+unsigned long blend_color(unsigned long bg, unsigned long fg, unsigned char alpha) {
+	int blue = ((bg & 0xff) * (255 - alpha) + (fg & 0xff) * alpha) / 255;
+	bg >>= 8; fg >>= 8;
+	int green = ((bg & 0xff) * (255 - alpha) + (fg & 0xff) * alpha) / 255;
+	bg >>= 8; fg >>= 8;
+	int red = ((bg & 0xff) * (255 - alpha) + (fg & 0xff) * alpha) / 255;
+	return (blue << 16) | (green << 8) | red;						/* the winapi use bgr */
+}
+
+static bool theme_is_high_contrast(void) {
+	HIGHCONTRAST hc = { .cbSize = sizeof(HIGHCONTRAST) };
+	return SystemParametersInfo(SPI_GETHIGHCONTRAST, sizeof(HIGHCONTRAST), &hc, 0) && (hc.dwFlags & HCF_HIGHCONTRASTON);
+}
+
+/* the "Choose your app mode" setting, dark when it is missing (before Windows 10) */
+static bool theme_apps_use_light(void) {
+	HKEY key;
+	if (RegOpenKeyEx(HKEY_CURRENT_USER, THEME_PERSONALIZE_KEY, 0, KEY_READ, &key) != ERROR_SUCCESS) {
+		return false;
+	}
+	DWORD value = 0, size = sizeof(value), type = 0;
+	bool light = RegQueryValueEx(key, "AppsUseLightTheme", NULL, &type, (LPBYTE) &value, &size) == ERROR_SUCCESS
+					&& type == REG_DWORD && value != 0;
+	RegCloseKey(key);
+	return light;
+}
+
+static ThemePalette theme_high_contrast(void) {
+	return (ThemePalette) {
+		.border = GetSysColor(COLOR_WINDOWTEXT),
+		.background = GetSysColor(COLOR_WINDOW),
+		.caption = { GetSysColor(COLOR_INACTIVECAPTION), GetSysColor(COLOR_ACTIVECAPTION) },
+		.caption_text = { GetSysColor(COLOR_INACTIVECAPTIONTEXT), GetSysColor(COLOR_CAPTIONTEXT) },
+		.close_hover = GetSysColor(COLOR_HIGHLIGHT),
+		.close_hover_text = GetSysColor(COLOR_HIGHLIGHTTEXT),
+		.button_hover = GetSysColor(COLOR_HIGHLIGHT),
+		.button_hover_text = GetSysColor(COLOR_HIGHLIGHTTEXT),
+	};
+}
+
+/* <exe>.theme, one "name = #rrggbb" per line, ';' starts a comment; "base = light"
+   starts from the light theme instead of the dark one */
+static bool theme_load_file(ThemePalette *palette) {
+	char path[MAX_PATH];
+	DWORD length = GetModuleFileName(NULL, path, MAX_PATH - 8);
+	if (length == 0) {
+		return false;
+	}
+	char *ext = strrchr(path, '.');
+	if (ext == NULL || strchr(ext, '\\') != NULL || strchr(ext, '/') != NULL) {
+		ext = path + length;
+	}
+	strcpy(ext, ".theme");
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+
+	static const struct { const char *name; size_t offset; } keys[] = {
+		{ "border", offsetof(ThemePalette, border) },
+		{ "background", offsetof(ThemePalette, background) },
+		{ "inactive_caption", offsetof(ThemePalette, caption[0]) },
+		{ "caption", offsetof(ThemePalette, caption[1]) },
+		{ "inactive_caption_text", offsetof(ThemePalette, caption_text[0]) },
+		{ "caption_text", offsetof(ThemePalette, caption_text[1]) },
+		{ "close_hover", offsetof(ThemePalette, close_hover) },
+		{ "close_hover_text", offsetof(ThemePalette, close_hover_text) },
+		{ "button_hover", offsetof(ThemePalette, button_hover) },
+		{ "button_hover_text", offsetof(ThemePalette, button_hover_text) },
+	};
+	*palette = theme_dark;
+	char line[128], name[64], value[64];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *comment = strchr(line, ';');
+		if (comment != NULL) {
+			*comment = '\0';
+		}
+		if (sscanf(line, " %63[a-z_] = %63s", name, value) != 2) {
+			continue;
+		}
+		if (strcmp(name, "base") == 0) {
+			*palette = strcmp(value, "light") == 0 ? theme_light : theme_dark;
+			continue;
+		}
+		unsigned long rgb;
+		if (value[0] != '#' || strlen(value) != 7 || strspn(value + 1, "0123456789abcdefABCDEF") != 6
+			|| sscanf(value + 1, "%lx", &rgb) != 1) {
+			continue;
+		}
+		for (size_t i = 0; i < sizeof(keys)/sizeof(*keys); i++) {
+			if (strcmp(name, keys[i].name) == 0) {
+				*(unsigned long*) ((char*) palette + keys[i].offset) = ((rgb & 0xff) << 16) | (rgb & 0xff00) | ((rgb >> 16) & 0xff);
+				break;
+			}
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+static void theme_expand(ThemeKind kind, const ThemePalette *palette, ThemeColors colors[2]) {
+	for (int has_focus = 0; has_focus < 2; has_focus++) {
+		ThemeColors *c = &colors[has_focus];
+		c->border = palette->border;
+		c->background = palette->background;
+		c->caption = palette->caption[has_focus];
+		c->caption_text = palette->caption_text[has_focus];
+		c->close_hover = palette->close_hover;
+		c->close_hover_text = palette->close_hover_text;
+		c->button_hover = palette->button_hover;
+		c->button_hover_text = palette->button_hover_text;
+		if (kind == ThemeKind_HighContrast) {
+			/* no blended shades in high contrast, they are not in the scheme */
+			c->sysmenu_hover = palette->button_hover;
+			c->sysmenu_hover_border = palette->button_hover_text;
+		}
+		else {
+			c->sysmenu_hover = blend_color(c->caption, c->caption_text, THEME_HOVER_ALPHA);
+			c->sysmenu_hover_border = blend_color(c->sysmenu_hover, c->caption_text, THEME_HOVER_ALPHA);
+		}
+	}
+}
+
+/* returns whether any color changed */
+static bool theme_load(void) {
+	ThemePalette palette;
+	ThemeKind kind;
+	if (theme_is_high_contrast()) {
+		kind = ThemeKind_HighContrast;
+		palette = theme_high_contrast();
+	}
+	else if (theme_load_file(&palette)) {
+		kind = ThemeKind_File;
+	}
+	else if (theme_apps_use_light()) {
+		kind = ThemeKind_Light;
+		palette = theme_light;
+	}
+	else {
+		kind = ThemeKind_Dark;
+		palette = theme_dark;
+	}
+	ThemeColors colors[2];
+	theme_expand(kind, &palette, colors);
+	bool changed = !theme.loaded || memcmp(colors, theme.colors, sizeof(colors)) != 0;
+	theme.loaded = true;
+	theme.kind = kind;
+	if (changed) {
+		memcpy(theme.colors, colors, sizeof(colors));
+		theme.generation++;
+	}
+	return changed;
+}
+
+const ThemeColors* theme_colors(bool has_focus) {
+	if (!theme.loaded) {
+		theme_load();
+	}
+	return &theme.colors[has_focus];
+}
+
+/* changes whenever the colors change, anything drawn with an older one is stale */
+UINT theme_generation(void) {
+	if (!theme.loaded) {
+		theme_load();
+	}
+	return theme.generation;
+}
+
+/* call on WM_SYSCOLORCHANGE and on a WM_SETTINGCHANGE for the colors, see theme_is_setting */
+void theme_invalidate(HWND hwnd) {
+	if (theme.pending == NULL && PostMessage(hwnd, WM_THEME_CHANGED, 0, 0)) {
+		theme.pending = hwnd;
+	}
+}
+
+/* the windows repainted on a theme change */
+void theme_register(HWND hwnd) {
+	if (theme.window_count == theme.window_capacity) {
+		theme.window_capacity = theme.window_capacity ? theme.window_capacity*2 : 16;
+		theme.windows = (HWND*) realloc(theme.windows, theme.window_capacity*sizeof(HWND));
+		assert(theme.windows != NULL);
+	}
+	theme.windows[theme.window_count++] = hwnd;
+}
+
+void theme_unregister(HWND hwnd) {
+	for (int i = 0; i < theme.window_count; i++) {
+		if (theme.windows[i] == hwnd) {
+			theme.windows[i] = theme.windows[--theme.window_count];
+			break;
+		}
+	}
+	/* the posted WM_THEME_CHANGED goes away with the window, post it to one that stays */
+	if (theme.pending == hwnd) {
+		theme.pending = NULL;
+		if (theme.window_count > 0) {
+			theme_invalidate(theme.windows[0]);
+		}
+	}
+	if (theme.window_count == 0) {
+		free(theme.windows);
+		theme.windows = NULL;
+		theme.window_capacity = 0;
+	}
+}
+
+bool theme_is_setting(WPARAM wparam, LPARAM lparam) {
+	return wparam == SPI_SETHIGHCONTRAST
+		|| (lparam != 0 && strcmp((const char*) lparam, "ImmersiveColorSet") == 0);
+}
+
+/* call on WM_THEME_CHANGED */
+void theme_reload(void) {
+	theme.pending = NULL;
+	if (!theme_load()) {
+		return;
+	}
+	for (int i = 0; i < theme.window_count; i++) {
+		InvalidateRect(theme.windows[i], NULL, false);
+	}
+}